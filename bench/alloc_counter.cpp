@@ -0,0 +1,48 @@
+#include <bench.hpp>
+
+#include <cstdlib>
+#include <new>
+
+// replace global allocation functions to count heap allocations
+// (all other operator new variants forward to these)
+
+namespace {
+thread_local uint64_t allocation_count = 0;
+}
+
+uint64_t bench::thread_allocations() {
+    return allocation_count;
+}
+
+void* operator new(std::size_t size) {
+    allocation_count++;
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    allocation_count++;
+    const std::size_t alignment = static_cast<std::size_t>(align);
+    if (void* ptr = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
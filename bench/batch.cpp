@@ -0,0 +1,176 @@
+#include <bench.hpp>
+#include <metric.hpp>
+#include <metric_batch.hpp>
+#include <recording.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+/// number of samples per batch
+constexpr std::size_t batch_samples = 1 << 16;
+
+/// number of repetitions per variant
+constexpr std::size_t repetitions = 20;
+
+/**
+ * maximum deviation of batch values from tmam_metric_values_t::derive()
+ * @return maximum absolute difference of fractions, infinity if any integral value differs
+ */
+double max_deviation(const std::vector<perf_tmam_data_t>& samples, const tmam_batch_values_t& batch_values) {
+    double deviation = 0;
+    tmam_metric_values_t values;
+    for (std::size_t i = 0; i + 1 < samples.size(); i++) {
+        values.derive(samples[i + 1] - samples[i]);
+        for (const auto& metric : tmam_metric_t::all) {
+            if (!tmam_batch_values_t::covers(metric.category)) {
+                continue;
+            }
+            const tmam_metric_value_t expected = values.by_index[metric.index];
+            const tmam_metric_value_t actual = batch_values.get(metric.category, i);
+            if (metric.is_integral()) {
+                if (expected.u64 != actual.u64) {
+                    return INFINITY;
+                }
+            } else {
+                deviation = std::max(deviation, std::abs(expected.f64 - actual.f64));
+            }
+        }
+    }
+    return deviation;
+}
+
+/// number of samples checked per instruction set (check_batch())
+constexpr std::size_t check_samples = 4096;
+
+/// maximum deviation of fractions accepted by check_batch() (vectorized division may round differently)
+constexpr double max_allowed_deviation = 1e-12;
+
+/**
+ * accumulated samples of a hybrid CPU: P-core part with level 2, E-core part with level 1 only (ecore_* shares)
+ *
+ * Every fourth interval runs on E-cores only (no level 2).
+ * @param n number of samples
+ * @return samples
+ */
+std::vector<perf_tmam_data_t> hybrid_samples(std::size_t n) {
+    synthetic_source pcore(1);
+    synthetic_source ecore(2);
+    std::vector<perf_tmam_data_t> samples;
+    perf_tmam_data_t accumulated;
+    perf_tmam_data_t last_pcore;
+    perf_tmam_data_t last_ecore;
+    for (std::size_t i = 0; i < n; i++) {
+        const perf_tmam_data_t current_ecore = ecore.read();
+        const perf_tmam_data_t e = current_ecore - last_ecore;
+        last_ecore = current_ecore;
+        perf_tmam_data_t p;
+        if (3 != i % 4) {
+            const perf_tmam_data_t current_pcore = pcore.read();
+            p = current_pcore - last_pcore;
+            last_pcore = current_pcore;
+        }
+
+        accumulated.slots += p.slots + e.slots;
+        accumulated.retiring += p.retiring + e.retiring;
+        accumulated.bad_spec += p.bad_spec + e.bad_spec;
+        accumulated.fe_bound += p.fe_bound + e.fe_bound;
+        accumulated.be_bound += p.be_bound + e.be_bound;
+        accumulated.heavy_ops += p.heavy_ops;
+        accumulated.br_mispredict += p.br_mispredict;
+        accumulated.fetch_lat += p.fetch_lat;
+        accumulated.mem_bound += p.mem_bound;
+        accumulated.ecore_slots += e.slots;
+        accumulated.ecore_retiring += e.retiring;
+        accumulated.ecore_bad_spec += e.bad_spec;
+        accumulated.ecore_fe_bound += e.fe_bound;
+        accumulated.ecore_be_bound += e.be_bound;
+        samples.push_back(accumulated);
+    }
+    return samples;
+}
+
+} // namespace
+
+bool bench::check_batch() {
+    std::printf("# batch derivation: deviation of every instruction set from derive()\n");
+
+    bool ok = true;
+    for (const bool hybrid : {false, true}) {
+        std::vector<perf_tmam_data_t> samples;
+        if (hybrid) {
+            samples = hybrid_samples(check_samples);
+        } else {
+            synthetic_source source(0);
+            for (std::size_t i = 0; i < check_samples; i++) {
+                samples.push_back(source.read());
+            }
+        }
+        tmam_sample_batch_t batch;
+        for (const auto& sample : samples) {
+            batch.push_back(sample);
+        }
+
+        const tmam_batch_isa best = detect_tmam_batch_isa();
+        for (const auto isa : {tmam_batch_isa::scalar, tmam_batch_isa::avx2, tmam_batch_isa::avx512}) {
+            if (isa > best) {
+                continue;
+            }
+            tmam_batch_values_t batch_values;
+            derive_batch(batch, batch_values, isa);
+            const double deviation = max_deviation(samples, batch_values);
+            const bool agrees = batch_values.size() + 1 == samples.size() && deviation <= max_allowed_deviation;
+            std::printf("%-28s %-8s %14g %s\n", ("derive_batch() " + to_string(isa)).c_str(), hybrid ? "hybrid" : "core",
+                        deviation, agrees ? "ok" : "FAILED");
+            ok = ok && agrees;
+        }
+    }
+    return ok;
+}
+
+void bench::run_batch() {
+    synthetic_source source(0);
+    std::vector<perf_tmam_data_t> samples;
+    tmam_sample_batch_t batch;
+    batch.reserve(batch_samples);
+    for (std::size_t i = 0; i < batch_samples; i++) {
+        samples.push_back(source.read());
+        batch.push_back(samples.back());
+    }
+    const double intervals = batch_samples - 1;
+
+    std::printf("# derivation of slots, level 1/2 fractions & bottlenecks for %zu samples (ns per interval)\n", batch_samples);
+    std::printf("%-28s %12s %14s %14s\n", "variant", "ns/interval", "allocs/batch", "max deviation");
+
+    // reference: one derive() per interval
+    tmam_metric_values_t values;
+    const auto per_sample = bench::measure(repetitions, [&]() {
+        for (std::size_t i = 0; i + 1 < samples.size(); i++) {
+            values.derive(samples[i + 1] - samples[i]);
+            do_not_optimize(values);
+        }
+    });
+    std::printf("%-28s %12.2f %14.2f %14s\n", "derive() per sample", per_sample.ns / intervals, per_sample.allocations, "-");
+
+    const tmam_batch_isa best = detect_tmam_batch_isa();
+    for (const auto isa : {tmam_batch_isa::scalar, tmam_batch_isa::avx2, tmam_batch_isa::avx512}) {
+        const std::string variant = "derive_batch() " + to_string(isa);
+        if (isa > best) {
+            std::printf("%-28s %12s\n", variant.c_str(), "unsupported");
+            continue;
+        }
+
+        tmam_batch_values_t batch_values;
+        batch_values.resize(batch_samples - 1);
+        const auto m = bench::measure(repetitions, [&]() {
+            derive_batch(batch, batch_values, isa);
+            do_not_optimize(batch_values.slots.data());
+        });
+        std::printf("%-28s %12.2f %14.2f %14g\n", variant.c_str(), m.ns / intervals, m.allocations,
+                    max_deviation(samples, batch_values));
+    }
+}
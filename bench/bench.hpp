@@ -0,0 +1,137 @@
+#pragma once
+
+#include <barrier>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * minimal benchmark harness for the topdown plugin
+ *
+ * Intentionally dependency-free, s.t. the benchmarks build wherever the plugin builds.
+ */
+namespace bench {
+
+/// thread counts to measure: powers of two up to (at least) the given maximum
+inline std::vector<std::size_t> thread_counts(std::size_t max_threads) {
+    std::vector<std::size_t> counts;
+    for (std::size_t n = 1; n < max_threads; n *= 2) {
+        counts.push_back(n);
+    }
+    counts.push_back(max_threads);
+    return counts;
+}
+
+/// number of heap allocations (operator new) performed so far by the calling thread
+uint64_t thread_allocations();
+
+/// number of read()/ioctl()/syscall() calls performed so far by the calling thread
+uint64_t thread_syscalls();
+
+/// cost of one call, averaged over all calls (and threads)
+struct measurement_t {
+    double ns;
+    double syscalls;
+    double allocations;
+};
+
+/**
+ * run a function on several threads simultaneously, measure mean cost per call
+ *
+ * Every thread first calls setup() (not measured), then all threads start calling fn() simultaneously.
+ * @param threads number of threads
+ * @param iterations number of calls to fn per thread
+ * @param setup called once per thread before measurement
+ * @param fn function to measure
+ * @return mean ns, syscalls & allocations per call (averaged over all threads)
+ */
+template <typename Setup, typename F>
+measurement_t measure(std::size_t threads, std::size_t iterations, Setup&& setup, F&& fn) {
+    std::barrier start_barrier(threads);
+    std::vector<measurement_t> per_thread(threads);
+    std::vector<std::thread> workers;
+
+    for (std::size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            setup();
+            start_barrier.arrive_and_wait();
+
+            const uint64_t syscalls_before = thread_syscalls();
+            const uint64_t allocations_before = thread_allocations();
+            const auto begin = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < iterations; i++) {
+                fn();
+            }
+            const auto end = std::chrono::steady_clock::now();
+            const uint64_t allocations_after = thread_allocations();
+            const uint64_t syscalls_after = thread_syscalls();
+
+            per_thread[t] = {
+                std::chrono::duration<double, std::nano>(end - begin).count() / iterations,
+                static_cast<double>(syscalls_after - syscalls_before) / iterations,
+                static_cast<double>(allocations_after - allocations_before) / iterations,
+            };
+        });
+    }
+
+    measurement_t total = {0, 0, 0};
+    for (std::size_t t = 0; t < threads; t++) {
+        workers[t].join();
+        total.ns += per_thread[t].ns;
+        total.syscalls += per_thread[t].syscalls;
+        total.allocations += per_thread[t].allocations;
+    }
+
+    return {total.ns / threads, total.syscalls / threads, total.allocations / threads};
+}
+
+/// single-threaded variant of measure()
+template <typename F>
+measurement_t measure(std::size_t iterations, F&& fn) {
+    return measure(1, iterations, []() {}, std::forward<F>(fn));
+}
+
+/// like measure(), but only the mean time per call (ns)
+template <typename Setup, typename F>
+double ns_per_call(std::size_t threads, std::size_t iterations, Setup&& setup, F&& fn) {
+    return measure(threads, iterations, std::forward<Setup>(setup), std::forward<F>(fn)).ns;
+}
+
+/// prevent compiler from optimizing away a value
+template <typename T>
+inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/// benchmark: thread state lookup, registry vs. previous std::map implementation
+void run_registry(std::size_t max_threads);
+
+/// benchmark: derivation of metric values from samples & sample arithmetic
+void run_derivation();
+
+/// benchmark: batch derivation (derive_batch(), all instruction sets supported) vs. derive() per sample
+void run_batch();
+
+/// benchmark: counter readout, perf_tmam_handle (read() & rdpmc, if available) and synthetic mock source
+void run_source();
+
+/// benchmark: full get_optional_value() path of the plugin (synthetic backend), called from 1..max_threads threads
+void run_plugin(std::size_t max_threads);
+
+/**
+ * check: record a synthetic source, replay it past its end & compare derived values of every interval
+ * @return true if replayed values are identical to recorded ones
+ */
+bool check_recording();
+
+/**
+ * check: derive_batch() with every supported instruction set agrees with derive() (incl. hybrid samples)
+ * @return true if all deviations are within rounding
+ */
+bool check_batch();
+
+} // namespace bench
@@ -0,0 +1,89 @@
+#include <bench.hpp>
+#include <metric.hpp>
+#include <perf_util.hpp>
+
+#include <cstdio>
+#include <utility>
+
+namespace {
+
+/// synthetic accumulated counters, advancing by a plausible breakdown per sample
+perf_tmam_data_t synthetic_sample(uint64_t n) {
+    perf_tmam_data_t d;
+    d.nr = 9;
+    d.slots = 1000000 * n;
+    d.retiring = 400000 * n;
+    d.bad_spec = 50000 * n;
+    d.fe_bound = 150000 * n;
+    d.be_bound = 400000 * n;
+    d.heavy_ops = 100000 * n;
+    d.br_mispredict = 40000 * n;
+    d.fetch_lat = 100000 * n;
+    d.mem_bound = 300000 * n;
+    return d;
+}
+
+/// measure single-threaded cost per call of fn
+template <typename F>
+bench::measurement_t measure_single(F&& fn) {
+    return bench::measure(1000000, std::forward<F>(fn));
+}
+
+/// print one result row
+void print_row(const char* variant, const bench::measurement_t& m) {
+    std::printf("%-28s %12.2f %14.2f %14.2f\n", variant, m.ns, m.syscalls, m.allocations);
+}
+
+} // namespace
+
+void bench::run_derivation() {
+    const perf_tmam_data_t last = synthetic_sample(1);
+    const perf_tmam_data_t current = synthetic_sample(2);
+
+    // per metric: compute delta & extract field (as every metric readout did before)
+    const auto per_metric = measure_single([&]() {
+        for (const auto& metric : tmam_metric_t::all) {
+            const perf_tmam_data_t delta = current - last;
+            const uint64_t raw = metric.extract_tmam_field(delta);
+            if (metric.is_integral()) {
+                do_not_optimize(raw);
+            } else {
+                do_not_optimize(static_cast<double>(raw) / static_cast<double>(delta.slots));
+            }
+        }
+    });
+
+    // per sample: derive all at once, then one lookup per metric
+    tmam_metric_values_t values;
+    const auto per_sample = measure_single([&]() {
+        values.derive(current - last);
+        for (const auto& metric : tmam_metric_t::all) {
+            do_not_optimize(values.by_index[metric.index]);
+        }
+    });
+
+    // lookup only: metric readouts while no new sample is taken
+    const auto lookup_only = measure_single([&]() {
+        for (const auto& metric : tmam_metric_t::all) {
+            do_not_optimize(values.by_index[metric.index]);
+        }
+    });
+
+    // sample arithmetic: interval & accumulation (as done per readout)
+    perf_tmam_data_t accumulated;
+    const auto difference = measure_single([&]() {
+        do_not_optimize(current - last);
+    });
+    const auto sum = measure_single([&]() {
+        accumulated = accumulated + current;
+        do_not_optimize(accumulated);
+    });
+
+    std::printf("# derivation of all %zu metrics from one sample\n", tmam_metric_count);
+    std::printf("%-28s %12s %14s %14s\n", "variant", "ns/sample", "syscalls/sample", "allocs/sample");
+    print_row("extract per metric", per_metric);
+    print_row("derive once + lookup", per_sample);
+    print_row("lookup only", lookup_only);
+    print_row("sample difference", difference);
+    print_row("sample accumulation", sum);
+}
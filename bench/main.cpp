@@ -0,0 +1,29 @@
+#include <bench.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+int main(int argc, char** argv) {
+    // --check: correctness checks only (no measurement), exit code reports failure
+    if (argc > 1 && std::string(argv[1]) == "--check") {
+        const bool recording_ok = bench::check_recording();
+        const bool batch_ok = bench::check_batch();
+        return recording_ok && batch_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // max thread count: first argument, default all hardware threads (but at least 128, thread-dependent effects are the point)
+    std::size_t max_threads = std::max(128u, std::thread::hardware_concurrency());
+    if (argc > 1) {
+        max_threads = std::strtoull(argv[1], nullptr, 10);
+    }
+
+    bench::run_registry(max_threads);
+    bench::run_derivation();
+    bench::run_batch();
+    bench::run_source();
+    bench::run_plugin(max_threads);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,99 @@
+#include <bench.hpp>
+#include <plugin.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <mutex>
+#include <string>
+
+namespace {
+
+/// stands in for the Score-P value proxy
+struct proxy_t {
+    uint64_t u64 = 0;
+    double f64 = 0;
+
+    void write(uint64_t value) {
+        u64 = value;
+    }
+
+    void write(double value) {
+        f64 = value;
+    }
+};
+
+/**
+ * measure one Score-P event (get_optional_value() for every offered metric) on several threads
+ * @param threads number of threads
+ * @param interval_us minimum time between two readouts (INTERVAL_US)
+ * @param error receives the reason if the plugin could not be used, result invalid then
+ * @return cost per event
+ */
+bench::measurement_t measure_events(std::size_t threads, const char* interval_us, std::string& error) {
+    // mock counter source: no PMU required (plugin reads these on construction)
+    setenv("SCOREP_METRIC_TOPDOWN_PLUGIN_BACKEND", "synthetic", 1);
+    setenv("SCOREP_METRIC_TOPDOWN_PLUGIN_INTERVAL_US", interval_us, 1);
+
+    topdown_plugin plugin;
+    plugin.get_metric_properties("*");
+
+    const std::vector<tmam_metric_t>& metrics = tmam_metric_t::all;
+
+    std::mutex error_mutex;
+    bool failed = false;
+    const auto result = bench::measure(
+        threads, 20000,
+        [&]() {
+            try {
+                plugin.add_metric(metrics.front());
+                proxy_t proxy;
+                plugin.get_optional_value(metrics.front(), proxy);
+            } catch (const std::exception& e) {
+                std::lock_guard lock(error_mutex);
+                failed = true;
+                error = e.what();
+            }
+        },
+        [&]() {
+            if (failed) {
+                return;
+            }
+            for (const auto& metric : metrics) {
+                proxy_t proxy;
+                bench::do_not_optimize(plugin.get_optional_value(metric, proxy));
+            }
+        });
+
+    return failed ? bench::measurement_t{0, 0, 0} : result;
+}
+
+} // namespace
+
+void bench::run_plugin(std::size_t max_threads) {
+    std::printf("# get_optional_value() for all %zu metrics per event, synthetic backend\n", tmam_metric_count);
+    std::printf("%8s %-42s %-42s\n", "", "   readout every call (INTERVAL_US=0)", "   default interval (500 us)");
+    std::printf("%8s %12s %14s %14s %12s %14s %14s\n",
+                "threads",
+                "ns/event", "syscalls/event", "allocs/event",
+                "ns/event", "syscalls/event", "allocs/event");
+    // plugin logs to stderr
+    std::fflush(stdout);
+
+    for (const auto threads : thread_counts(max_threads)) {
+        std::string error;
+        const auto every_event = measure_events(threads, "0", error);
+        const auto default_interval = measure_events(threads, "500", error);
+        if (!error.empty()) {
+            std::printf("%8zu skipped: %s\n", threads, error.c_str());
+            std::fflush(stdout);
+            continue;
+        }
+
+        std::printf("%8zu %12.2f %14.2f %14.2f %12.2f %14.2f %14.2f\n",
+                    threads,
+                    every_event.ns, every_event.syscalls, every_event.allocations,
+                    default_interval.ns, default_interval.syscalls, default_interval.allocations);
+        std::fflush(stdout);
+    }
+}
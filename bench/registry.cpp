@@ -0,0 +1,75 @@
+#include <bench.hpp>
+#include <thread_registry.hpp>
+
+#include <cstdio>
+#include <map>
+#include <mutex>
+
+extern "C" {
+#include <sys/syscall.h>
+#include <unistd.h>
+}
+
+namespace {
+
+/// stand-in for thread_state_t, only the written counter matters
+struct fake_state_t {
+    uint64_t sample_cnt_total = 0;
+    uint64_t padding[15] = {};
+};
+
+/// previous implementation: std::map keyed by tid, looked up through gettid() on every call
+struct map_lookup {
+    std::mutex mutex;
+    std::map<pid_t, fake_state_t> state_by_tid;
+
+    void setup() {
+        std::lock_guard lock(mutex);
+        state_by_tid.emplace(std::piecewise_construct,
+                             std::forward_as_tuple(syscall(SYS_gettid)),
+                             std::forward_as_tuple());
+    }
+
+    void call() {
+        fake_state_t& s = state_by_tid.at(syscall(SYS_gettid));
+        s.sample_cnt_total++;
+        bench::do_not_optimize(s.sample_cnt_total);
+    }
+};
+
+/// current implementation: thread_local pointer into slab of cache-line-aligned slots
+struct registry_lookup {
+    thread_registry<fake_state_t> registry;
+
+    void setup() {
+        registry.register_current();
+    }
+
+    void call() {
+        fake_state_t& s = *registry.current();
+        s.sample_cnt_total++;
+        bench::do_not_optimize(s.sample_cnt_total);
+    }
+};
+
+template <typename Lookup>
+double measure_lookup(std::size_t threads) {
+    constexpr std::size_t iterations = 200000;
+    Lookup lookup;
+    return bench::ns_per_call(threads, iterations,
+                              [&]() { lookup.setup(); },
+                              [&]() { lookup.call(); });
+}
+
+} // namespace
+
+void bench::run_registry(std::size_t max_threads) {
+    std::printf("# thread state lookup per call (ns)\n");
+    std::printf("%8s %14s %14s\n", "threads", "std::map", "registry");
+    for (const auto threads : thread_counts(max_threads)) {
+        std::printf("%8zu %14.2f %14.2f\n",
+                    threads,
+                    measure_lookup<map_lookup>(threads),
+                    measure_lookup<registry_lookup>(threads));
+    }
+}
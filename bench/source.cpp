@@ -0,0 +1,75 @@
+#include <bench.hpp>
+#include <perf_util.hpp>
+#include <recording.hpp>
+
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+/// print one result row
+void print_row(const char* variant, const bench::measurement_t& m) {
+    std::printf("%-28s %12.2f %14.2f %14.2f\n", variant, m.ns, m.syscalls, m.allocations);
+}
+
+/**
+ * measure readouts of a source, skip (with note) if it can not be opened
+ *
+ * The source is opened on the measuring thread: it counts (& rdpmc reads) the thread it has been opened on.
+ * @param variant name printed
+ * @param open creates the source, may throw (e.g. no PMU present)
+ */
+template <typename Open>
+void measure_source(const char* variant, Open&& open) {
+    std::unique_ptr<tmam_source> source;
+    std::string error;
+    const auto result = bench::measure(
+        1, 200000,
+        [&]() {
+            try {
+                source = open();
+            } catch (const std::exception& e) {
+                error = e.what();
+            }
+        },
+        [&]() {
+            if (source) {
+                bench::do_not_optimize(source->read());
+            }
+        });
+
+    if (!source) {
+        std::printf("%-28s skipped: %s\n", variant, error.c_str());
+        return;
+    }
+    print_row(variant, result);
+}
+
+} // namespace
+
+void bench::run_source() {
+    std::printf("# counter readout\n");
+    std::printf("%-28s %12s %14s %14s\n", "variant", "ns/read", "syscalls/read", "allocs/read");
+
+    measure_source("perf_tmam_handle read()", []() {
+        perf_tmam_config_t config;
+        config.use_rdpmc = false;
+        return std::make_unique<perf_tmam_handle>(config);
+    });
+
+    measure_source("perf_tmam_handle rdpmc", []() -> std::unique_ptr<tmam_source> {
+        perf_tmam_config_t config;
+        config.use_rdpmc = true;
+        auto handle = std::make_unique<perf_tmam_handle>(config);
+        if (!handle->use_rdpmc) {
+            throw std::runtime_error("rdpmc not available (cap_user_rdpmc unset)");
+        }
+        return handle;
+    });
+
+    // mock: stands in for the PMU where none is present (e.g. VMs, CI)
+    measure_source("synthetic_source (mock)", []() { return std::make_unique<synthetic_source>(1); });
+}
@@ -0,0 +1,59 @@
+#include <bench.hpp>
+
+#include <cstdarg>
+
+extern "C" {
+#include <dlfcn.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+}
+
+// interpose the libc wrappers of the syscalls the plugin issues on its hot path
+// (perf readout: read(), enable/reset: ioctl(), gettid & perf_event_open: syscall())
+// and count them per thread, the calls are forwarded to the next definition (libc)
+
+namespace {
+thread_local uint64_t syscall_count = 0;
+
+/// resolve next definition of a symbol (once)
+template <typename F>
+F next_definition(const char* name) {
+    return reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+}
+} // namespace
+
+uint64_t bench::thread_syscalls() {
+    return syscall_count;
+}
+
+extern "C" ssize_t read(int fd, void* buf, size_t count) {
+    static const auto next = next_definition<ssize_t (*)(int, void*, size_t)>("read");
+    syscall_count++;
+    return next(fd, buf, count);
+}
+
+extern "C" int ioctl(int fd, unsigned long request, ...) noexcept {
+    static const auto next = next_definition<int (*)(int, unsigned long, ...)>("ioctl");
+    std::va_list args;
+    va_start(args, request);
+    void* arg = va_arg(args, void*);
+    va_end(args);
+
+    syscall_count++;
+    return next(fd, request, arg);
+}
+
+extern "C" long syscall(long number, ...) noexcept {
+    static const auto next = next_definition<long (*)(long, ...)>("syscall");
+    // syscalls take at most 6 arguments, forward all of them (surplus ones are ignored)
+    std::va_list args;
+    va_start(args, number);
+    long a[6];
+    for (auto& arg : a) {
+        arg = va_arg(args, long);
+    }
+    va_end(args);
+
+    syscall_count++;
+    return next(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
@@ -0,0 +1,370 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include <sys/timerfd.h>
+    #include <unistd.h>
+}
+
+#if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
+#include <sys/syscall.h>
+#define gettid() syscall(SYS_gettid)
+#endif
+
+#include <scorep/SCOREP_MetricTypes.h>
+#pragma GCC diagnostic push 
+#pragma GCC diagnostic ignored "-Wvolatile"
+#include <scorep/plugin/plugin.hpp>
+#pragma GCC diagnostic pop
+
+#include <backend.hpp>
+#include <env.hpp>
+#include <metric.hpp>
+#include <metric_batch.hpp>
+#include <perf_util.hpp>
+#include <ring_buffer.hpp>
+#include <thread_registry.hpp>
+
+/// one sample taken by the collector
+struct timed_sample_t {
+    /// time of readout
+    scorep::chrono::ticks time;
+
+    /// accumulated counters
+    perf_tmam_data_t data;
+};
+
+/// measurement state of a single thread (asynchronous mode)
+struct async_thread_state_t {
+    /// id of thread this state belongs to
+    const pid_t tid;
+
+    /// counter source, read by the collector (hence no rdpmc)
+    std::unique_ptr<tmam_source> tmam_handle;
+
+    /// guards samples (collector appends, owning thread reads at flush)
+    std::mutex samples_mutex;
+
+    /// all samples taken by the collector (grows up to its capacity)
+    ring_buffer<timed_sample_t> samples;
+
+    /// flush: intervals derived by derive_batch(), shared by all metrics it covers (guarded by samples_mutex)
+    tmam_batch_values_t flush_values;
+
+    /// flush: end of every interval of flush_values
+    std::vector<scorep::chrono::ticks> flush_times;
+
+    /// flush: true if interval i of flush_values meets MIN_COVERAGE
+    std::vector<bool> flush_accepted;
+
+    /// flush: samples.pushed_total() flush_values have been derived from (valid only if flush_metrics_pending)
+    uint64_t flush_samples_pushed = 0;
+
+    /// flush: selected metrics covered by derive_batch() not yet written, flush_values are released at 0
+    std::size_t flush_metrics_pending = 0;
+
+    /**
+     * constructor
+     * @param tid id of calling thread
+     * @param capacity number of samples to hold
+     * @param backend opens counter source of calling thread
+     * @param config configuration of counter source
+     */
+    async_thread_state_t(pid_t tid, std::size_t capacity, const tmam_backend& backend, const perf_tmam_config_t& config)
+        : tid(tid), tmam_handle(backend.open(config, 0, -1)), samples(capacity) {
+        // nop
+    }
+};
+
+/**
+ * asynchronous variant of topdown_plugin
+ *
+ * A collector thread reads the counters of all registered threads at a fixed cadence (timerfd),
+ * independent of instrumentation density.
+ * Samples are buffered in per-thread ring buffers and handed to Score-P in bulk at flush time.
+ */
+class topdown_async_plugin :
+    public scorep::plugin::base<topdown_async_plugin,
+                                scorep::plugin::policy::async,
+                                scorep::plugin::policy::per_thread,
+                                scorep::plugin::policy::scorep_clock,
+                                tmam_metric_t_policy> {
+private:
+    /// microarchitecture backend, opens counter sources (declared first: outlives all sources)
+    std::unique_ptr<tmam_backend> backend;
+
+    /// thread-local state
+    thread_registry<async_thread_state_t> thread_states;
+
+    /// time between two samples
+    uint64_t interval_us = 500;
+
+    /// number of samples held per thread, older samples are overwritten (default: buffer_seconds of samples)
+    uint64_t buffer_size = 0;
+
+    /// default of buffer_size: time covered by the samples held per thread
+    static constexpr uint64_t buffer_seconds = 10;
+
+    /// configuration of counter sources (no rdpmc: read by the collector)
+    perf_tmam_config_t perf_config;
+
+    /// metrics selected by get_metric_properties() (bit mask, see tmam_metric_all_mask)
+    uint64_t selected_metrics = 0;
+
+    /// intervals whose counters have been counting less than this fraction of their time are not reported
+    double min_coverage = 0;
+
+    /// collector thread, running between start() and stop()
+    std::thread collector;
+
+    /// signals collector to stop
+    std::atomic<bool> collector_running = false;
+
+    /// serializes start()/stop()
+    std::mutex collector_mutex;
+
+    /// read all registered threads periodically until collector_running is unset
+    void collect() {
+        int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (0 > timer_fd) {
+            scorep::plugin::log::logging::error() << "timerfd_create failed, no samples collected: "
+                                                  << std::system_category().message(errno);
+            return;
+        }
+
+        const timespec interval = {
+            .tv_sec = static_cast<time_t>(interval_us / 1000000),
+            .tv_nsec = static_cast<long>(interval_us % 1000000) * 1000,
+        };
+        const itimerspec timer_spec = {
+            .it_interval = interval,
+            .it_value = interval,
+        };
+        timerfd_settime(timer_fd, 0, &timer_spec, nullptr);
+
+        while (collector_running.load(std::memory_order_relaxed)) {
+            // block until next tick (missed ticks are merged)
+            uint64_t expirations;
+            if (sizeof(expirations) != ::read(timer_fd, &expirations, sizeof(expirations))) {
+                continue;
+            }
+
+            thread_states.for_each([&](async_thread_state_t& ts) {
+                try {
+                    const timed_sample_t sample = {
+                        .time = scorep::chrono::measurement_clock::now(),
+                        .data = ts.tmam_handle->read(),
+                    };
+                    std::lock_guard lock(ts.samples_mutex);
+                    ts.samples.push(sample);
+                } catch (const std::exception&) {
+                    // thread may have exited in the meantime, skip it
+                }
+            });
+        }
+
+        close(timer_fd);
+    }
+
+    /**
+     * derive all intervals of a thread at once (unless already derived from the same samples)
+     *
+     * Score-P flushes every metric separately: the values are kept for all selected metrics covered by derive_batch()
+     * and released after the last of them has been written. samples_mutex must be held.
+     * @param ts state of thread to derive
+     */
+    void derive_flush(async_thread_state_t& ts) {
+        if (0 < ts.flush_metrics_pending && ts.samples.pushed_total() == ts.flush_samples_pushed) {
+            return;
+        }
+
+        tmam_sample_batch_t batch;
+        batch.reserve(ts.samples.size());
+        ts.flush_times.clear();
+        ts.flush_accepted.clear();
+        perf_tmam_data_t last;
+        ts.samples.for_each([&](const timed_sample_t& sample) {
+            if (0 < batch.size()) {
+                ts.flush_times.push_back(sample.time);
+                ts.flush_accepted.push_back(0 == min_coverage || tmam_metric_t::get_coverage(sample.data - last) >= min_coverage);
+            }
+            batch.push_back(sample.data);
+            last = sample.data;
+        });
+        derive_batch(batch, ts.flush_values);
+
+        ts.flush_samples_pushed = ts.samples.pushed_total();
+        std::size_t covered_metrics = 0;
+        for (const auto& metric : tmam_metric_t::all) {
+            if (0 != (selected_metrics & (1ull << metric.index)) && tmam_batch_values_t::covers(metric.category)) {
+                covered_metrics++;
+            }
+        }
+        // at least the metric being flushed
+        ts.flush_metrics_pending = std::max<std::size_t>(1, covered_metrics);
+    }
+
+    /**
+     * write all intervals of a thread for a metric covered by derive_batch()
+     *
+     * samples_mutex must be held.
+     * @param ts state of thread to report
+     * @param metric to report, tmam_batch_values_t::covers() must hold
+     * @param c cursor to write to
+     */
+    template <class Cursor>
+    void write_batched(async_thread_state_t& ts, const tmam_metric_t& metric, Cursor& c) {
+        derive_flush(ts);
+
+        for (std::size_t i = 0; i < ts.flush_values.size(); i++) {
+            if (!ts.flush_accepted[i]) {
+                continue;
+            }
+            const tmam_metric_value_t value = ts.flush_values.get(metric.category, i);
+            if (metric.is_integral()) {
+                c.write(ts.flush_times[i], value.u64);
+            } else {
+                c.write(ts.flush_times[i], value.f64);
+            }
+        }
+
+        if (0 == --ts.flush_metrics_pending) {
+            // all covered metrics written
+            ts.flush_values = tmam_batch_values_t{};
+            ts.flush_times = {};
+            ts.flush_accepted = {};
+        }
+    }
+
+public:
+    /// constructor
+    topdown_async_plugin() {
+        interval_us = get_env_uint("INTERVAL_US", interval_us);
+        perf_config.pinned = get_env_flag("PINNED", perf_config.pinned);
+        min_coverage = get_env_double("MIN_COVERAGE", min_coverage);
+
+        backend = make_tmam_backend_from_env();
+        scorep::plugin::log::logging::info() << "using backend " << backend->name();
+
+        if (0 == interval_us) {
+            throw std::runtime_error("INTERVAL_US must be positive");
+        }
+        // at 500 us: 20000 samples, ~5 MiB per thread once filled
+        buffer_size = get_env_uint("BUFFER_SIZE", buffer_seconds * 1000000 / interval_us);
+    }
+
+    ~topdown_async_plugin() {
+        stop();
+    }
+
+    void add_metric(const tmam_metric_t&) {
+        // see topdown_plugin::add_metric(): one state for all metrics of a thread
+        thread_states.register_current(gettid(), buffer_size, *backend, perf_config);
+    }
+
+    void start() {
+        std::lock_guard lock(collector_mutex);
+        if (collector.joinable()) {
+            return;
+        }
+
+        collector_running = true;
+        collector = std::thread(&topdown_async_plugin::collect, this);
+    }
+
+    void stop() {
+        std::lock_guard lock(collector_mutex);
+        if (!collector.joinable()) {
+            return;
+        }
+
+        collector_running = false;
+        collector.join();
+    }
+
+    template <typename Cursor>
+    void get_all_values(const tmam_metric_t& metric, Cursor& c) {
+        // flushed per thread: report samples of *calling thread*
+        async_thread_state_t* ts = thread_states.current();
+        if (nullptr == ts) {
+            return;
+        }
+
+        std::lock_guard lock(ts->samples_mutex);
+
+        if (0 < ts->samples.overwritten() && tmam_metric_t::all.front().category == metric.category) {
+            scorep::plugin::log::logging::warn() << "thread " << ts->tid << ": " << ts->samples.overwritten()
+                                                 << " oldest samples lost, increase BUFFER_SIZE";
+        }
+
+        // every value describes the interval between two consecutive samples
+        // (written at the end of the interval, as in the synchronous plugin)
+        if (tmam_batch_values_t::covers(metric.category)) {
+            write_batched(*ts, metric, c);
+            return;
+        }
+
+        bool has_last = false;
+        perf_tmam_data_t last;
+        tmam_metric_values_t values;
+        ts->samples.for_each([&](const timed_sample_t& sample) {
+            // skip intervals whose counters have been descheduled for too long
+            const perf_tmam_data_t delta = sample.data - last;
+            if (has_last && tmam_metric_t::get_coverage(delta) >= min_coverage) {
+                values.derive(delta, 1ull << metric.index);
+                const tmam_metric_value_t value = values.by_index[metric.index];
+                if (metric.is_integral()) {
+                    c.write(sample.time, value.u64);
+                } else {
+                    c.write(sample.time, value.f64);
+                }
+            }
+
+            last = sample.data;
+            has_last = true;
+        });
+    }
+
+    std::vector<scorep::plugin::metric_property> get_metric_properties(const std::string& pattern) {
+        std::vector<scorep::plugin::metric_property> result;
+        bool matched = false;
+        for (const auto& metric : tmam_metric_t::all) {
+            if (!backend->supports(metric.category) ||
+                !tmam_metric_matches(pattern, metric.get_name(), metric.requires_explicit_selection())) {
+                continue;
+            }
+            matched = true;
+
+            // see topdown_plugin::get_metric_properties()
+            const uint64_t bit = 1ull << metric.index;
+            if (0 != (selected_metrics & bit)) {
+                continue;
+            }
+            selected_metrics |= bit;
+
+            make_handle(metric.get_name(), metric);
+            result.push_back(metric.get_metric_property());
+        }
+
+        if (!matched) {
+            throw std::runtime_error("no metric matches " + pattern);
+        }
+
+        perf_config.level2 = true;
+        perf_config.level3 = true;
+        tmam_restrict_config(perf_config, selected_metrics);
+
+        return result;
+    }
+};
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+extern "C" {
+#include <sys/types.h>
+}
+
+#include <metric.hpp>
+#include <multiplexed_source.hpp>
+#include <perf_util.hpp>
+#include <recording.hpp>
+
+/**
+ * microarchitecture backend: which events to open and how to translate them into the common category model
+ *
+ * One backend is selected at startup (see make_tmam_backend()), it opens one tmam_source per thread (or CPU).
+ */
+class tmam_backend {
+public:
+    virtual ~tmam_backend() = default;
+
+    /// name of backend, as accepted by make_tmam_backend()
+    virtual std::string name() const = 0;
+
+    /**
+     * check if a metric can be derived with this backend
+     * @param category of metric
+     * @return true if supported, unsupported metrics are not offered
+     */
+    virtual bool supports(tmam_metric_category category) const = 0;
+
+    /// true if rdpmc & overflow sampling (see perf_tmam_config_t) are supported, i.e. sources provide a perf_tmam_handle (see tmam_source::perf_handle())
+    virtual bool supports_perf_metrics() const {
+        return false;
+    }
+
+    /**
+     * check if read_slots() of opened sources avoids a syscall, i.e. is cheap enough to gate every event on (GATE=slots)
+     * @param config perf configuration sources are opened with
+     * @return true if slots are read without a syscall (e.g. rdpmc), false if read_slots() reads all counters through the kernel
+     */
+    virtual bool reads_slots_without_syscall(const perf_tmam_config_t& /* config */) const {
+        return false;
+    }
+
+    /**
+     * open counters
+     * @param config perf configuration, only rdpmc, sampling, pinned, inherit & level 2/3 settings are considered (if supported)
+     * @param pid thread to be monitored, current if 0
+     * @param cpu cpu to be monitored, any if -1
+     * @return opened source
+     */
+    virtual std::unique_ptr<tmam_source> open(const perf_tmam_config_t& config, pid_t pid, int cpu) const = 0;
+};
+
+/**
+ * backend for the PERF_METRICS register of Intel CPUs
+ *
+ * With level 2: Golden Cove & newer (Alder/Raptor Lake P-cores, Sapphire/Emerald/Granite Rapids), incl. hybrid CPUs.
+ * Without: Ice Lake, Tiger Lake.
+ */
+class perf_metrics_backend : public tmam_backend {
+public:
+    /**
+     * constructor
+     * @param level2 if set, level 2 metrics are available
+     * @param level3 if set, level 3 drill-down events are opened additionally (Golden Cove only, ignored without level 2)
+     * @param companions companion counters opened in the TMAM group (see parse_companion_event()), checked against the counter budget
+     */
+    explicit perf_metrics_backend(bool level2, bool level3 = false, const std::vector<std::string>& companions = {});
+
+    std::string name() const override;
+    bool supports(tmam_metric_category category) const override;
+    bool supports_perf_metrics() const override {
+        return true;
+    }
+    bool reads_slots_without_syscall(const perf_tmam_config_t& config) const override;
+    std::unique_ptr<tmam_source> open(const perf_tmam_config_t& config, pid_t pid, int cpu) const override;
+
+private:
+    /// level 2 metrics available
+    bool level2;
+
+    /// level 3 drill-down events, nullptr if not enabled
+    std::unique_ptr<multiplexed_event_set_t> level3_events;
+
+    /// companion counters, opened in the TMAM group
+    std::vector<companion_event_t> companion_events;
+};
+
+/// backend reading a multiplexed_event_set_t (e.g. AMD Zen 4, generic fallback)
+class multiplexed_backend : public tmam_backend {
+public:
+    /**
+     * constructor
+     * @param name name of backend
+     * @param event_set events & derivation
+     * @param categories metrics supported
+     */
+    multiplexed_backend(std::string name,
+                        multiplexed_event_set_t event_set,
+                        std::vector<tmam_metric_category> categories);
+
+    std::string name() const override;
+    bool supports(tmam_metric_category category) const override;
+    std::unique_ptr<tmam_source> open(const perf_tmam_config_t& config, pid_t pid, int cpu) const override;
+
+private:
+    std::string backend_name;
+    multiplexed_event_set_t event_set;
+    std::vector<tmam_metric_category> categories;
+};
+
+/**
+ * decorates a backend s.t. every opened source records its readouts
+ *
+ * The n-th opened source (counting from 0) records to <path prefix>.<n>.tmam.
+ */
+class recording_backend : public tmam_backend {
+public:
+    /**
+     * constructor
+     * @param inner backend to record
+     * @param path_prefix prefix of recorded streams
+     */
+    recording_backend(std::unique_ptr<tmam_backend> inner, std::string path_prefix);
+
+    std::string name() const override;
+    bool supports(tmam_metric_category category) const override;
+    bool supports_perf_metrics() const override;
+    bool reads_slots_without_syscall(const perf_tmam_config_t& config) const override;
+    std::unique_ptr<tmam_source> open(const perf_tmam_config_t& config, pid_t pid, int cpu) const override;
+
+private:
+    std::unique_ptr<tmam_backend> inner;
+    std::string path_prefix;
+
+    /// number of sources opened so far
+    mutable std::atomic<uint64_t> opened = 0;
+};
+
+/**
+ * backend replaying streams recorded by recording_backend, no hardware access
+ *
+ * The n-th opened source replays <path prefix>.<n>.tmam.
+ * Supports the metrics of the recording backend (as stored in the first stream).
+ */
+class replay_backend : public tmam_backend {
+public:
+    /**
+     * constructor
+     * @param path_prefix prefix of recorded streams
+     */
+    explicit replay_backend(std::string path_prefix);
+
+    std::string name() const override;
+    bool supports(tmam_metric_category category) const override;
+    bool reads_slots_without_syscall(const perf_tmam_config_t&) const override {
+        return true;
+    }
+    std::unique_ptr<tmam_source> open(const perf_tmam_config_t& config, pid_t pid, int cpu) const override;
+
+private:
+    std::string path_prefix;
+
+    /// metadata of first stream
+    tmam_recording_header_t header;
+
+    /// number of sources opened so far
+    mutable std::atomic<uint64_t> opened = 0;
+};
+
+/// backend generating synthetic readouts (see synthetic_source), no hardware access
+class synthetic_backend : public tmam_backend {
+public:
+    /**
+     * constructor
+     * @param companions number of companion counters to generate
+     */
+    explicit synthetic_backend(std::size_t companions = 0);
+
+    std::string name() const override;
+    bool supports(tmam_metric_category category) const override;
+    bool reads_slots_without_syscall(const perf_tmam_config_t&) const override {
+        return true;
+    }
+    std::unique_ptr<tmam_source> open(const perf_tmam_config_t& config, pid_t pid, int cpu) const override;
+
+private:
+    /// number of companion counters generated
+    std::size_t companions;
+
+    /// number of sources opened so far, used as seed
+    mutable std::atomic<uint64_t> opened = 0;
+};
+
+/**
+ * get metrics supported by a backend as bitmask
+ * @param backend to query
+ * @return bit i set if metric with tmam_metric_index() i is supported
+ */
+uint64_t get_supported_mask(const tmam_backend& backend);
+
+/// options of make_tmam_backend() beyond its name
+struct tmam_backend_options_t {
+    /// prefix of streams to replay (replay backend)
+    std::string replay_path = "topdown-recording";
+
+    /// if not empty, record all readouts to streams with this prefix (see recording_backend)
+    std::string record_path;
+
+    /// open level 3 drill-down events (golden_cove backend only, see perf_metrics_backend)
+    bool level3 = false;
+
+    /// companion counters (golden_cove & ice_lake backends, synthetic generates counts), also names the companion metrics
+    std::vector<std::string> companions;
+};
+
+/**
+ * detect backend matching the CPU
+ *
+ * Uses the CPUID vendor/family/model and the events exported by the kernel's core PMU,
+ * unknown CPUs get the generic backend. Candidates are probed by opening a source for the calling thread,
+ * the first one that counts is selected (e.g. zen4 falls back to generic if its events are not available).
+ * @return name of backend
+ * @throws std::runtime_error if no candidate can count (e.g. no generic stall events on Intel, perf_event_paranoid)
+ */
+std::string detect_tmam_backend();
+
+/**
+ * create backend
+ * @param name one of "golden_cove", "ice_lake", "zen4", "skylake", "generic", "replay", "synthetic",
+ *             empty to detect (see detect_tmam_backend())
+ * @param options paths for recording & replay, level 3 & companion counters
+ * @return created backend
+ */
+std::unique_ptr<tmam_backend> make_tmam_backend(const std::string& name = "", const tmam_backend_options_t& options = {});
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * companion counters: additional events counted in the TMAM group of perf_tmam_handle
+ *
+ * Read by the same group read as the TMAM events, i.e. over exactly the same interval
+ * (e.g. instructions & cycles for IPC, LLC misses, branch misses).
+ */
+
+/// maximum number of companion counters
+constexpr std::size_t perf_tmam_companion_max = 4;
+
+/// one companion counter, as opened by perf_tmam_handle
+struct companion_event_t {
+    /// name as configured (e.g. "instructions" or "r412e"), part of the metric name
+    std::string name;
+
+    /// perf type
+    uint32_t type;
+
+    /// perf config
+    uint64_t config = 0;
+
+    /// perf config1 (e.g. offcore response, load latency)
+    uint64_t config1 = 0;
+};
+
+/**
+ * resolve companion counter specification
+ *
+ * Accepted are event names exported by the core PMU in sysfs (e.g. "instructions", "branch-misses", "mem-loads"),
+ * raw codes as accepted by perf ("r<hex>", e.g. "r412e"),
+ * and perf's generic events (e.g. "cycles", "instructions", "branch-misses", "LLC-loads", "LLC-misses") if not in sysfs.
+ * @param spec specification
+ * @param pmu_name name of core PMU in /sys/bus/event_source/devices ("cpu", "cpu_core" on hybrid CPUs)
+ * @param pmu_type perf type of core PMU
+ * @return resolved event
+ */
+companion_event_t parse_companion_event(const std::string& spec, const std::string& pmu_name, uint32_t pmu_type);
+
+/**
+ * number of general-purpose counters needed by companion counters
+ *
+ * Instructions, cycles & reference cycles are counted by the fixed counters (one event each),
+ * all other events need a general-purpose counter. Slots (TMAM) use a fixed counter of their own.
+ * @param events companion counters
+ * @param fixed_cycles_available false if the cycles fixed counter is taken (e.g. by the NMI watchdog)
+ * @return number of general-purpose counters
+ */
+std::size_t count_companion_gp_counters(const std::vector<companion_event_t>& events, bool fixed_cycles_available);
+
+/// number of general-purpose counters per logical CPU (CPUID leaf 0xA), 0 if unknown
+unsigned read_gp_counter_count();
+
+/// true if the NMI watchdog is enabled (occupies a counter)
+bool nmi_watchdog_enabled();
+
+/**
+ * check that companion counters fit the core PMU together with the TMAM events
+ *
+ * A group exceeding the counters is never scheduled, i.e. would not count at all.
+ * Does nothing if the number of counters is unknown.
+ * @param events companion counters
+ * @throws std::runtime_error if too many general-purpose counters are needed
+ */
+void check_companion_budget(const std::vector<companion_event_t>& events);
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <scorep/SCOREP_MetricTypes.h>
+#pragma GCC diagnostic push 
+#pragma GCC diagnostic ignored "-Wvolatile"
+#include <scorep/plugin/plugin.hpp>
+#pragma GCC diagnostic pop
+
+#include <backend.hpp>
+
+/**
+ * interpret environment variable as boolean
+ * @param name of variable (without plugin prefix)
+ * @param default_value returned if unset
+ * @return true if set to 1/true/yes/on (case-insensitive)
+ */
+inline bool get_env_flag(const std::string& name, bool default_value) {
+    std::string value = scorep::environment_variable::get(name, default_value ? "1" : "0");
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+    return "1" == value || "true" == value || "yes" == value || "on" == value;
+}
+
+/**
+ * interpret environment variable as unsigned integer
+ * @param name of variable (without plugin prefix)
+ * @param default_value returned if unset
+ * @return parsed value
+ */
+inline uint64_t get_env_uint(const std::string& name, uint64_t default_value) {
+    return std::stoull(scorep::environment_variable::get(name, std::to_string(default_value)));
+}
+
+/**
+ * interpret environment variable as floating point number
+ * @param name of variable (without plugin prefix)
+ * @param default_value returned if unset
+ * @return parsed value
+ */
+inline double get_env_double(const std::string& name, double default_value) {
+    return std::stod(scorep::environment_variable::get(name, std::to_string(default_value)));
+}
+
+/**
+ * interpret environment variable as comma-separated list
+ * @param name of variable (without plugin prefix)
+ * @return elements with surrounding whitespace removed, empty elements skipped (empty if unset)
+ */
+inline std::vector<std::string> get_env_list(const std::string& name) {
+    std::vector<std::string> result;
+    std::stringstream ss(scorep::environment_variable::get(name, ""));
+    std::string element;
+    while (std::getline(ss, element, ',')) {
+        const auto first = element.find_first_not_of(" \t");
+        if (std::string::npos != first) {
+            result.push_back(element.substr(first, element.find_last_not_of(" \t") - first + 1));
+        }
+    }
+    return result;
+}
+
+/**
+ * create backend as configured by environment variables BACKEND, REPLAY_PATH, RECORD, LEVEL3 & COMPANIONS
+ * @return created backend
+ */
+inline std::unique_ptr<tmam_backend> make_tmam_backend_from_env() {
+    tmam_backend_options_t options;
+    options.replay_path = scorep::environment_variable::get("REPLAY_PATH", options.replay_path);
+    options.record_path = scorep::environment_variable::get("RECORD", options.record_path);
+    options.level3 = get_env_flag("LEVEL3", options.level3);
+    options.companions = get_env_list("COMPANIONS");
+    auto backend = make_tmam_backend(scorep::environment_variable::get("BACKEND", ""), options);
+    if (options.level3 && !backend->supports(tmam_metric_category::l3_l1_bound)) {
+        scorep::plugin::log::logging::warn() << "LEVEL3 is not supported by backend " << backend->name() << ", ignored";
+    }
+    if (!options.companions.empty() && !backend->supports(tmam_metric_category::companion_0)) {
+        scorep::plugin::log::logging::warn() << "COMPANIONS is not supported by backend " << backend->name() << ", ignored";
+    }
+    if (options.level3 && !options.companions.empty() && backend->supports(tmam_metric_category::l3_l1_bound)) {
+        // level 3 groups occupy the general-purpose counters too
+        scorep::plugin::log::logging::warn() << "LEVEL3 and COMPANIONS compete for counters, the TMAM group may be multiplexed "
+                                             << "(see topdown-coverage)";
+    }
+    return backend;
+}
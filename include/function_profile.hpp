@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+#include <perf_util.hpp>
+
+/**
+ * aggregates overflow samples by code location, summarizes them per function
+ *
+ * The counters between two consecutive samples of one thread are attributed to the instruction pointer of the later sample
+ * (where the overflow hit).
+ * Symbols are only resolved when writing the summary.
+ *
+ * Not synchronized.
+ */
+class function_profile {
+private:
+    /// aggregated data of one location (instruction pointer or function)
+    struct location_t {
+        /// number of samples
+        uint64_t samples = 0;
+
+        /// time between previous and this sample, in ns (kernel timestamps)
+        uint64_t time_ns = 0;
+
+        /// counters between previous and this sample
+        perf_tmam_data_t tmam;
+    };
+
+    std::unordered_map<uint64_t, location_t> location_by_ip;
+
+public:
+    /**
+     * add one sample
+     * @param sample newly recorded sample
+     * @param previous sample recorded before by the same thread
+     */
+    void add(const perf_tmam_sample_t& sample, const perf_tmam_sample_t& previous);
+
+    /// true if no samples have been added
+    bool empty() const {
+        return location_by_ip.empty();
+    }
+
+    /**
+     * resolve locations to functions, write per-function summary as csv (sorted by slots, descending)
+     * @param out stream to write to
+     */
+    void write_summary(std::ostream& out) const;
+
+    /**
+     * resolve instruction pointer to function name
+     * @param ip instruction pointer (of this process)
+     * @return demangled function name if available, otherwise object file + offset or raw address
+     */
+    static std::string resolve_function(uint64_t ip);
+};
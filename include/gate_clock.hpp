@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+extern "C" {
+#include <x86intrin.h>
+}
+
+/**
+ * clock gating readouts on the hot path (see INTERVAL_US)
+ *
+ * Reads the invariant TSC (rdtsc, no syscall, no vDSO) if available, std::chrono::steady_clock otherwise.
+ * Timestamps are opaque ticks, only differences are meaningful;
+ * the TSC frequency is taken from CPUID leaf 0x15 or calibrated against steady_clock once on construction.
+ */
+class gate_clock {
+public:
+    /**
+     * constructor, calibrates the TSC (may take a few ms)
+     * @param use_tsc if unset (or no invariant TSC available), steady_clock is used
+     */
+    explicit gate_clock(bool use_tsc = true);
+
+    /// current timestamp, in ticks
+    uint64_t now() const {
+        if (tsc) [[likely]] {
+            return __rdtsc();
+        }
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * convert a duration into ticks
+     * @param us duration in microseconds
+     * @return number of ticks of duration
+     */
+    uint64_t ticks_from_us(uint64_t us) const {
+        return static_cast<uint64_t>(us * ticks_per_us);
+    }
+
+    /// true if the TSC is used
+    bool uses_tsc() const {
+        return tsc;
+    }
+
+    /// ticks per microsecond (TSC frequency in MHz, 1000 for steady_clock)
+    double get_ticks_per_us() const {
+        return ticks_per_us;
+    }
+
+private:
+    /// read TSC instead of steady_clock
+    bool tsc = false;
+
+    /// ticks per microsecond
+    double ticks_per_us = 1000;
+};
+
+/**
+ * check if the CPU provides an invariant TSC (constant rate across P-/C-states, CPUID 0x80000007 EDX bit 8)
+ * @return true if invariant TSC is available
+ */
+bool has_invariant_tsc();
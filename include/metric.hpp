@@ -1,6 +1,9 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <string>
+#include <vector>
 
 #include <scorep/SCOREP_MetricTypes.h>
 #pragma GCC diagnostic push 
@@ -22,6 +25,28 @@ enum class tmam_metric_category : uint64_t {
     l1_bottleneck = (1ull << 40) + 1,
     l2_bottleneck = (1ull << 40) + 2,
 
+    // hybrid CPUs only
+    core_type = (1ull << 40) + 3,
+    ecore_residency = (1ull << 40) + 4,
+
+    // fraction of the interval the counters have actually been counting (multiplexing)
+    coverage = (1ull << 40) + 5,
+
+    // companion counters (see perf_tmam_config_t::companion_events), events per interval
+    companion_0 = (1ull << 40) + 6,
+    companion_1 = (1ull << 40) + 7,
+    companion_2 = (1ull << 40) + 8,
+    companion_3 = (1ull << 40) + 9,
+
+    // level 1 & 2 breakdown in one value, 8 bit per category (see tmam_pack_breakdown())
+    packed = (1ull << 40) + 10,
+
+    // length of the reported interval (synchronous plugin only, varies with the gate)
+    interval = (1ull << 40) + 11,
+
+    // id of the phase the interval belongs to (synchronous plugin only, see phase_detector)
+    phase = (1ull << 40) + 12,
+
     // start count from 0 such that traces have "nice" numbers
     // (note: these are in the order as mentioned in the optimization manual figure)
     l1_retiring = 0,
@@ -36,6 +61,106 @@ enum class tmam_metric_category : uint64_t {
     l2_fetch_bandwidth = 9,
     l2_core_bound = 10,
     l2_memory_bound = 11,
+
+    // level 3 drill-down (Golden Cove, optional), below core bound & memory bound
+    l3_divider = 12,
+    l3_ports_utilization = 13,
+    l3_l1_bound = 14,
+    l3_l2_bound = 15,
+    l3_l3_bound = 16,
+    l3_dram_bound = 17,
+    l3_store_bound = 18,
+};
+
+/// number of tmam_metric_category values, i.e. of distinct metrics
+constexpr std::size_t tmam_metric_count = 32;
+
+/// set of all metrics, as bit mask: bit i set for metric with tmam_metric_index() i
+constexpr uint64_t tmam_metric_all_mask = (1ull << tmam_metric_count) - 1;
+
+/// core type reported by tmam_metric_category::core_type
+enum class tmam_core_type : uint64_t {
+    p_core = 0,
+    e_core = 1,
+    mixed = 2,
+};
+
+/**
+ * compact (dense) index of a category, to be used for array lookups
+ *
+ * l1/l2 categories map onto their own number (0..11), followed by slots, l1 bottleneck, l2 bottleneck, core type, E-core residency,
+ * then the l3 categories, coverage, the companions, the packed breakdown, the interval and the phase
+ * (indices are stored in recordings, hence appended).
+ * note: this is *not* the number used in traces
+ * @param category to index
+ * @return index in [0, tmam_metric_count)
+ */
+constexpr std::size_t tmam_metric_index(tmam_metric_category category) {
+    switch (category) {
+    case tmam_metric_category::slots:
+        return 12;
+    case tmam_metric_category::l1_bottleneck:
+        return 13;
+    case tmam_metric_category::l2_bottleneck:
+        return 14;
+    case tmam_metric_category::core_type:
+        return 15;
+    case tmam_metric_category::ecore_residency:
+        return 16;
+    case tmam_metric_category::l3_divider:
+    case tmam_metric_category::l3_ports_utilization:
+    case tmam_metric_category::l3_l1_bound:
+    case tmam_metric_category::l3_l2_bound:
+    case tmam_metric_category::l3_l3_bound:
+    case tmam_metric_category::l3_dram_bound:
+    case tmam_metric_category::l3_store_bound:
+        return 17 + static_cast<std::size_t>(category) - static_cast<std::size_t>(tmam_metric_category::l3_divider);
+    case tmam_metric_category::coverage:
+        return 24;
+    case tmam_metric_category::companion_0:
+    case tmam_metric_category::companion_1:
+    case tmam_metric_category::companion_2:
+    case tmam_metric_category::companion_3:
+        return 25 + static_cast<std::size_t>(category) - static_cast<std::size_t>(tmam_metric_category::companion_0);
+    case tmam_metric_category::packed:
+        return 29;
+    case tmam_metric_category::interval:
+        return 30;
+    case tmam_metric_category::phase:
+        return 31;
+    default:
+        return static_cast<std::size_t>(category);
+    }
+}
+
+/// one value of a metric, interpretation depends on metric type (see tmam_metric_t::is_integral())
+union tmam_metric_value_t {
+    uint64_t u64;
+    double f64;
+};
+
+/**
+ * values of all metrics derived from one tmam delta
+ *
+ * Computed once per sample, metrics are then reported by simple lookup.
+ */
+struct tmam_metric_values_t {
+    /// values indexed by tmam_metric_index()
+    std::array<tmam_metric_value_t, tmam_metric_count> by_index = {};
+
+    /**
+     * compute metrics from given delta
+     *
+     * does not allocate
+     * @param delta tmam difference between two samples
+     * @param mask metrics to compute (bit mask, see tmam_metric_all_mask), others keep their values
+     */
+    void derive(const perf_tmam_data_t& delta, uint64_t mask = tmam_metric_all_mask);
+
+    /// get value of given category
+    tmam_metric_value_t operator[](tmam_metric_category category) const {
+        return by_index[tmam_metric_index(category)];
+    }
 };
 
 /**
@@ -48,6 +173,9 @@ public:
     /// category represented
     tmam_metric_category category;
 
+    /// dense index of category, see tmam_metric_index()
+    std::size_t index;
+
     tmam_metric_t (tmam_metric_category category);
 
     /// list of all supported metrics
@@ -62,6 +190,88 @@ public:
     /// retrieve scorep metric type
     scorep::plugin::metric_property get_metric_property() const;
 
+    /// get metric name for accumulated reporting (see is_accumulable())
+    std::string get_accumulated_name() const;
+
+    /// retrieve scorep metric type for accumulated reporting: raw count of slots since start (see is_accumulable())
+    scorep::plugin::metric_property get_accumulated_metric_property() const;
+
+    /// true if reported as integer (uint64, count or category), false if reported as fraction (double)
+    bool is_integral() const {
+        return tmam_metric_category::l1_bottleneck == category ||
+            tmam_metric_category::l2_bottleneck == category ||
+            tmam_metric_category::slots == category ||
+            tmam_metric_category::core_type == category ||
+            tmam_metric_category::packed == category ||
+            tmam_metric_category::phase == category ||
+            is_companion();
+    }
+
+    /// true if not derived from counters but measured by the synchronous plugin (never supported by a backend)
+    bool is_plugin_only() const {
+        return tmam_metric_category::interval == category || tmam_metric_category::phase == category;
+    }
+
+    /// true if only selected by its exact name, not by glob patterns such as '*' (see tmam_metric_matches())
+    bool requires_explicit_selection() const {
+        return tmam_metric_category::packed == category;
+    }
+
+    /// true if the extracted field is a count, which may be reported accumulated (slots, l1 & l2 categories, companions)
+    bool is_accumulable() const {
+        return tmam_metric_category::slots == category || category <= tmam_metric_category::l2_memory_bound ||
+            is_companion();
+    }
+
+    /// true if companion counter (count of a configured event)
+    bool is_companion() const {
+        return tmam_metric_category::companion_0 <= category && category <= tmam_metric_category::companion_3;
+    }
+
+    /// number of companion counter (0..3), only valid if is_companion()
+    std::size_t get_companion_number() const {
+        return static_cast<std::size_t>(category) - static_cast<std::size_t>(tmam_metric_category::companion_0);
+    }
+
+    /**
+     * set names of companion counters, used for metric names & descriptions
+     *
+     * To be called once on startup (before metrics are named), unnamed companions are numbered.
+     * @param names names of events, in the order of perf_tmam_data_t::companion
+     */
+    static void set_companion_names(const std::vector<std::string>& names);
+
+    /// true if only meaningful on hybrid CPUs (not offered otherwise)
+    bool is_hybrid_only() const {
+        return tmam_metric_category::core_type == category ||
+            tmam_metric_category::ecore_residency == category;
+    }
+
+    /// true if level 3 drill-down metric (reported as fraction of cycles, not slots)
+    bool is_level3() const {
+        return tmam_metric_category::l3_divider <= category && category <= tmam_metric_category::l3_store_bound;
+    }
+
+    /// true if derived from level 2 events (level 2 categories, bottleneck & packed breakdown)
+    bool needs_level2() const {
+        return tmam_metric_category::l2_bottleneck == category || tmam_metric_category::packed == category ||
+            (tmam_metric_category::l2_light_ops <= category && category <= tmam_metric_category::l2_memory_bound);
+    }
+
+    /**
+     * get core type a tmam delta has been recorded on
+     * @param tmam results to examine
+     * @return P-core, E-core or mixed
+     */
+    static tmam_core_type get_core_type(const perf_tmam_data_t& tmam);
+
+    /**
+     * get fraction of a tmam delta's time the counters have actually been counting
+     * @param tmam results to examine
+     * @return time running / time enabled in [0, 1], 1 if no times are available
+     */
+    static double get_coverage(const perf_tmam_data_t& tmam);
+
     /**
      * extract category from given tmam results
      *
@@ -70,6 +280,15 @@ public:
      */
     uint64_t extract_tmam_field(const perf_tmam_data_t& tmam) const;
 
+    /**
+     * extract category from given tmam results
+     *
+     * @param category to extract
+     * @param tmam results to examine
+     * @return field from tmam given by category
+     */
+    static uint64_t extract_tmam_field(tmam_metric_category category, const perf_tmam_data_t& tmam);
+
     /**
      * extract l2 category with the most alotted slots, retiring (light/heavy ops) are ignored!
      * @param tmam results to examine
@@ -87,5 +306,75 @@ public:
 
 bool operator<(const tmam_metric_t& lhs, const tmam_metric_t& rhs);
 
+/**
+ * check if a metric name is selected, as by SCOREP_METRIC_<PLUGIN>
+ * @param pattern comma-separated names or glob patterns (see fnmatch(3), e.g. "topdown-l1-*"), the "topdown-" prefix may be omitted
+ * @param name of metric
+ * @param explicit_only only match names, not globs (see tmam_metric_t::requires_explicit_selection())
+ * @return true if any pattern matches
+ */
+bool tmam_metric_matches(const std::string& pattern, const std::string& name, bool explicit_only = false);
+
+/**
+ * pack level 1 & 2 breakdown of an interval into one value (topdown-packed)
+ *
+ * Layout as the PERF_METRICS register: 8 bit per category, fraction of slots scaled to [0,255] (rounded),
+ * byte 0 (lowest) retiring, 1 bad speculation, 2 frontend bound, 3 backend bound,
+ * 4 heavy ops, 5 branch misprediction, 6 fetch latency, 7 memory bound.
+ * The other level 2 categories are the differences to their level 1 parent (e.g. light ops = retiring - heavy ops).
+ * Level 2 bytes are fractions of P-core slots (as the level 2 metrics), 0 if level 2 is not available.
+ * @param delta tmam difference between two samples
+ * @return packed breakdown, 0 if no slots
+ */
+uint64_t tmam_pack_breakdown(const perf_tmam_data_t& delta);
+
+/**
+ * expand packed breakdown (see tmam_pack_breakdown()) into counts
+ *
+ * The result has no E-core slots & full coverage, tmam_metric_values_t::derive() yields the packed fractions (within 1/255).
+ * @param packed packed breakdown
+ * @param slots number of slots the fractions refer to (e.g. topdown-slots of the same interval, or 255 for plain fractions)
+ * @return slots & level 1/2 counts
+ */
+perf_tmam_data_t tmam_unpack_breakdown(uint64_t packed, uint64_t slots);
+
+/**
+ * open only the events needed by given metrics: level 2 & level 3 events are skipped if no metric needs them
+ * @param config configuration to restrict
+ * @param mask selected metrics (see tmam_metric_all_mask)
+ */
+void tmam_restrict_config(perf_tmam_config_t& config, uint64_t mask);
+
+/**
+ * dead band of change-only emission: decides whether metric values changed significantly
+ *
+ * Fractions are compared by absolute difference against the epsilon of their level,
+ * bottlenecks & core type change on any difference, slots & companion counts never trigger (they scale with the interval),
+ * neither do the packed breakdown (its fractions are compared individually) and the interval length.
+ * A new phase (see phase_detector) is always significant.
+ */
+struct tmam_deadband_t {
+    /// minimum absolute change of a fraction to be significant, by metric index (0: any change, infinity: never)
+    std::array<double, tmam_metric_count> epsilon_by_metric;
+
+    /**
+     * constructor
+     * @param l1 epsilon of level 1 fractions
+     * @param l2 epsilon of level 2 fractions
+     * @param l3 epsilon of level 3 fractions
+     * @param other epsilon of all other fractions (coverage, E-core residency)
+     */
+    tmam_deadband_t(double l1, double l2, double l3, double other);
+
+    /**
+     * check for significant change
+     * @param latest values of latest interval
+     * @param reported values reported last
+     * @param mask metrics to compare (see tmam_metric_all_mask)
+     * @return true if any metric of mask changed by more than its epsilon
+     */
+    bool exceeded(const tmam_metric_values_t& latest, const tmam_metric_values_t& reported, uint64_t mask) const;
+};
+
 template <typename T, typename Policies>
 using tmam_metric_t_policy = scorep::plugin::policy::object_id<tmam_metric_t, T, Policies>;
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <metric.hpp>
+#include <perf_util.hpp>
+
+/**
+ * accumulated TMAM samples as structure of arrays, input of derive_batch()
+ *
+ * Holds only the fields needed for level 1/2 derivation (incl. E-core shares of hybrid CPUs).
+ * n samples describe n-1 intervals.
+ */
+struct tmam_sample_batch_t {
+    std::vector<uint64_t> slots;
+    std::vector<uint64_t> retiring;
+    std::vector<uint64_t> bad_spec;
+    std::vector<uint64_t> fe_bound;
+    std::vector<uint64_t> be_bound;
+    std::vector<uint64_t> heavy_ops;
+    std::vector<uint64_t> br_mispredict;
+    std::vector<uint64_t> fetch_lat;
+    std::vector<uint64_t> mem_bound;
+    std::vector<uint64_t> ecore_slots;
+    std::vector<uint64_t> ecore_retiring;
+    std::vector<uint64_t> ecore_bad_spec;
+    std::vector<uint64_t> ecore_fe_bound;
+    std::vector<uint64_t> ecore_be_bound;
+
+    /// number of samples held
+    std::size_t size() const {
+        return slots.size();
+    }
+
+    /// preallocate storage for given number of samples
+    void reserve(std::size_t samples);
+
+    /// append accumulated sample
+    void push_back(const perf_tmam_data_t& sample);
+
+    /// remove all samples (keeps storage)
+    void clear();
+};
+
+/// number of level 1 & 2 categories, i.e. fractions computed by derive_batch()
+constexpr std::size_t tmam_batch_fraction_count = 12;
+
+/**
+ * metrics derived by derive_batch(), as structure of arrays
+ *
+ * Element i describes the interval between samples i and i+1.
+ * Same semantics as tmam_metric_values_t (incl. hybrid CPUs), for the categories it covers (see covers()).
+ */
+struct tmam_batch_values_t {
+    /// fractions of level 1 & 2 categories, indexed by tmam_metric_index() (i.e. category number 0..11)
+    std::array<std::vector<double>, tmam_batch_fraction_count> fractions;
+
+    /// slots per interval
+    std::vector<uint64_t> slots;
+
+    /// l1 bottleneck per interval (tmam_metric_category)
+    std::vector<uint64_t> l1_bottleneck;
+
+    /// l2 bottleneck per interval (tmam_metric_category)
+    std::vector<uint64_t> l2_bottleneck;
+
+    /// number of intervals held
+    std::size_t size() const {
+        return slots.size();
+    }
+
+    /// set number of intervals held
+    void resize(std::size_t intervals);
+
+    /**
+     * get value of one interval
+     * @param category one of covers()
+     * @param interval index of interval
+     * @return value as stored in tmam_metric_values_t
+     */
+    tmam_metric_value_t get(tmam_metric_category category, std::size_t interval) const;
+
+    /// true if category is derived by derive_batch(): slots, bottlenecks & level 1/2 fractions
+    static bool covers(tmam_metric_category category) {
+        return tmam_metric_category::slots == category ||
+            tmam_metric_category::l1_bottleneck == category ||
+            tmam_metric_category::l2_bottleneck == category ||
+            category <= tmam_metric_category::l2_memory_bound;
+    }
+};
+
+/// instruction set used by derive_batch()
+enum class tmam_batch_isa {
+    scalar,
+    avx2,
+    avx512,
+};
+
+/// best instruction set supported by the running CPU (and OS)
+tmam_batch_isa detect_tmam_batch_isa();
+
+/// name of instruction set
+std::string to_string(tmam_batch_isa isa);
+
+/**
+ * derive slots, level 1/2 fractions & both bottlenecks for all intervals of a batch at once
+ *
+ * Computes the deltas of consecutive samples and branch-free derives all covered metrics (see tmam_batch_values_t),
+ * vectorized with AVX-512 or AVX2 if supported, remainder & other CPUs scalar.
+ * Does not allocate if values already holds enough intervals.
+ * @param samples accumulated samples
+ * @param values resized to samples.size() - 1 intervals (0 if less than two samples)
+ * @param isa instruction set to use, must be supported by the running CPU (see detect_tmam_batch_isa())
+ */
+void derive_batch(const tmam_sample_batch_t& samples, tmam_batch_values_t& values,
+                  tmam_batch_isa isa = detect_tmam_batch_isa());
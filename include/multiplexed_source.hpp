@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <perf_util.hpp>
+
+/// one event of a multiplexed_event_set_t
+struct multiplexed_event_t {
+    /// name for error messages
+    std::string name;
+
+    /// perf type (e.g. PERF_TYPE_RAW)
+    uint32_t type;
+
+    /// perf config
+    uint64_t config;
+
+    /// open in the group of the preceding event (scheduled together, hence consistent ratios), on its own otherwise
+    bool grouped = false;
+};
+
+/**
+ * set of events which is translated into the common category model
+ *
+ * Events are not grouped by default: sets may exceed the number of hardware counters, then the kernel multiplexes them.
+ * Grouped events (see multiplexed_event_t::grouped) are multiplexed as a whole, every group must fit the hardware counters.
+ */
+struct multiplexed_event_set_t {
+    /// events to open
+    std::vector<multiplexed_event_t> events;
+
+    /**
+     * translate counts of one interval into the common category model
+     *
+     * @param counts (scaled) counts of the interval, in the order of events
+     * @param interval receives slots & categories of the interval (zero-initialized)
+     */
+    void (*derive_interval)(const uint64_t* counts, perf_tmam_data_t& interval);
+};
+
+/**
+ * counter source reading a (possibly multiplexed) set of perf events
+ *
+ * Every event is scaled by its time enabled/time running (as perf stat does),
+ * time_enabled & time_running of the result are summed over all events.
+ * Derivation happens per interval between two readouts (ratios of accumulated counts are not monotonic),
+ * the intervals are then accumulated to emulate accumulating counters.
+ */
+class multiplexed_source : public tmam_source {
+public:
+    /**
+     * constructor, opens & enables all events
+     * @param event_set events to open, must outlive this object
+     * @param pid thread to be monitored, current by default
+     * @param cpu cpu to be monitored, any by default
+     * @param inherit count children created after opening too (see perf_tmam_config_t::inherit)
+     */
+    multiplexed_source(const multiplexed_event_set_t& event_set, pid_t pid = 0, int cpu = -1, bool inherit = false);
+
+    multiplexed_source(const multiplexed_source&) = delete;
+    multiplexed_source& operator=(const multiplexed_source&) = delete;
+
+    /// destructor, closes all events
+    ~multiplexed_source() override;
+
+    /// read events, derive & accumulate interval since last readout
+    perf_tmam_data_t read() override;
+
+private:
+    /// event set (definition & derivation)
+    const multiplexed_event_set_t& event_set;
+
+    /// fds, indexed as event_set.events
+    std::vector<int> fds;
+
+    /// scaled counts at last readout
+    std::vector<uint64_t> counts_last;
+
+    /// scaled counts of current interval (preallocated)
+    std::vector<uint64_t> counts_interval;
+
+    /// time enabled & running at last readout, indexed as event_set.events
+    std::vector<std::pair<uint64_t, uint64_t>> times_last;
+
+    /// accumulated result
+    perf_tmam_data_t accumulated;
+};
@@ -1,17 +1,25 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
 #include <string>
+#include <vector>
 
 extern "C" {
 #include <sys/types.h>
 #include <linux/perf_event.h>
 }
 
+#include <companion.hpp>
+
 /**
  * holds all data associated with one perf TMAM readout
  *
  * Using `.read_format = PERF_FORMAT_GROUP` when opening perf means one can directly read into this struct with a single read.
+ * It also serves as common category model for all backends (see tmam_backend), which translate their events into slots.
  *
  * Note that the data are counters of events i.e., they are constantly accumulating (growing).
  * Fractions/Percentages are based on the slots member.
@@ -29,6 +37,45 @@ struct perf_tmam_data_t {
     uint64_t fetch_lat = 0;
     uint64_t mem_bound = 0;
 
+    // the following are not part of the perf group read of the TMAM (P-core) group
+
+    // E-core share of slots & level 1 categories (hybrid CPUs only):
+    // slots & level 1 members above hold the sum of P- and E-cores, level 2 members P-cores only
+
+    uint64_t ecore_slots = 0;
+    uint64_t ecore_retiring = 0;
+    uint64_t ecore_bad_spec = 0;
+    uint64_t ecore_fe_bound = 0;
+    uint64_t ecore_be_bound = 0;
+
+    /// time the counters have been enabled, i.e. the thread has been running (ns)
+    uint64_t time_enabled = 0;
+
+    /// time the thread has been running on E-cores (ns), only counted on hybrid CPUs
+    uint64_t time_ecore = 0;
+
+    // level 3 drill-down (Golden Cove, optional): stall cycles, counted by two multiplexed groups (P-cores only)
+
+    /// cycles counted by the memory group
+    uint64_t l3_mem_cycles = 0;
+    uint64_t l1_bound = 0;
+    uint64_t l2_bound = 0;
+    uint64_t l3_bound = 0;
+    uint64_t dram_bound = 0;
+    uint64_t store_bound = 0;
+
+    /// cycles counted by the core group
+    uint64_t l3_core_cycles = 0;
+    uint64_t divider = 0;
+    uint64_t ports_util = 0;
+
+    /// time the counters have actually been counting (ns), less than time_enabled if the groups were descheduled
+    /// (appended to the recorded fields, as are the companions)
+    uint64_t time_running = 0;
+
+    /// companion counters (see perf_tmam_config_t::companion_events), read with the TMAM group (P-cores only)
+    uint64_t companion[perf_tmam_companion_max] = {};
+
     /// print to stderr
     void dump() const;
 
@@ -42,13 +89,22 @@ struct perf_tmam_data_t {
      * read TMAM data from perf
      *
      * typical way to create a perf_tmam_data_t object.
+     * The group must have been opened with read_format GROUP | TOTAL_TIME_ENABLED | TOTAL_TIME_RUNNING.
      * @param perf_leader_fd file descriptor of perf TMAM group
-     * @return data as returned by perf
+     * @param size number of bytes of nr & TMAM values returned by group read, see perf_tmam_group_read_size
+     * @param companions number of companion counters following the TMAM values in the group
+     * @return data as returned by perf (incl. time_enabled & time_running)
      */
-    static perf_tmam_data_t read_from_perf(int perf_leader_fd);
+    static perf_tmam_data_t read_from_perf(int perf_leader_fd, std::size_t size, std::size_t companions = 0);
 };
 typedef struct perf_tmam_data_t perf_tmam_data_t;
 
+/// size of nr & values of group read of TMAM group, i.e. prefix of perf_tmam_data_t that is read from perf (times excluded)
+constexpr std::size_t perf_tmam_group_read_size = offsetof(perf_tmam_data_t, ecore_slots);
+
+/// size of group read of TMAM group with level 1 events only
+constexpr std::size_t perf_tmam_group_read_size_l1 = offsetof(perf_tmam_data_t, heavy_ops);
+
 /// component-wise addition
 perf_tmam_data_t operator+(const perf_tmam_data_t& lhs, const perf_tmam_data_t& rhs);
 
@@ -58,47 +114,184 @@ perf_tmam_data_t operator-(const perf_tmam_data_t& lhs, const perf_tmam_data_t&
 /// call syscall w/ error-checking
 int checked_perf_open(struct perf_event_attr* attr_ptr, pid_t pid, int cpu, int group, int flags);
 
+/// one overflow sample, as recorded by the kernel
+struct perf_tmam_sample_t {
+    /// instruction pointer at overflow
+    uint64_t ip = 0;
+
+    /// kernel timestamp (perf clock) at overflow
+    uint64_t time = 0;
+
+    /// accumulated counters at overflow
+    perf_tmam_data_t data;
+};
+
+class perf_tmam_handle;
+
+/**
+ * source of TMAM counters for one thread (or CPU), as opened by a tmam_backend
+ *
+ * Every source translates its hardware events into the common category model perf_tmam_data_t.
+ */
+class tmam_source {
+public:
+    virtual ~tmam_source() = default;
+
+    /// read accumulated counters
+    virtual perf_tmam_data_t read() = 0;
+
+    /// read accumulated slots only (work-based gating), sources may provide a cheaper readout than read()
+    virtual uint64_t read_slots() {
+        return read().slots;
+    }
+
+    /// underlying perf_tmam_handle (rdpmc state, overflow samples), nullptr if not backed by one
+    virtual perf_tmam_handle* perf_handle() {
+        return nullptr;
+    }
+};
+
+struct multiplexed_event_set_t;
+class multiplexed_source;
+
+/// configuration of a perf_tmam_handle
+struct perf_tmam_config_t {
+    /// read counters with rdpmc if supported (only applicable if monitoring the calling thread)
+    bool use_rdpmc = false;
+
+    /// see perf_tmam_handle::rdpmc_resync_ratio
+    uint64_t rdpmc_resync_ratio = 4;
+
+    /// let the kernel record an overflow sample every this many slots, 0 disables sampling
+    uint64_t sample_period = 0;
+
+    /// size of the sample ring buffer in pages (power of 2)
+    uint64_t sample_buffer_pages = 64;
+
+    /// open level 2 events (Golden Cove & newer), level 1 only otherwise (Ice Lake, or no level 2 metric selected)
+    bool level2 = true;
+
+    /// let the backend open its level 3 drill-down events (if enabled, see level3_events), unset if no level 3 metric is selected
+    bool level3 = true;
+
+    /// open groups pinned: never multiplexed, but unusable (read() fails) if the counters are taken by another perf user
+    bool pinned = false;
+
+    /// count children (threads & processes) created after opening too, as perf stat does (no rdpmc & sampling)
+    bool inherit = false;
+
+    /// perf type of PMU to open TMAM (Golden Cove) group on, empty to not open it (e.g. on E-cores)
+    std::optional<uint32_t> core_pmu_type = PERF_TYPE_RAW;
+
+    /// perf type of E-core PMU to open level 1 group on (hybrid CPUs), empty to not open it
+    std::optional<uint32_t> atom_pmu_type;
+
+    /// level 3 drill-down events, opened in addition to the TMAM group (must outlive the handle), nullptr to not open them
+    const multiplexed_event_set_t* level3_events = nullptr;
+
+    /// companion counters, opened in the TMAM group (must outlive the handle, no rdpmc), nullptr to not open any
+    const std::vector<companion_event_t>* companion_events = nullptr;
+};
+
 /**
  * RAII perf TMAM events
  *
  * Opens the TMAM events (for current process, any CPU) on construction and closes them on desctruction.
+ * Reads the PERF_METRICS register of Intel CPUs (Ice Lake & newer).
  */
-class perf_tmam_handle {
+class perf_tmam_handle : public tmam_source {
 public:
-    /// fd of leader (slots)
-    int fd_leader;
+    /// fd of leader (slots), -1 if TMAM group not opened
+    int fd_leader = -1;
 
     int fd_retiring;
     int fd_bad_spec;
     int fd_fe_bound;
     int fd_be_bound;
 
-    int fd_heavy_ops;
-    int fd_br_mispredict;
-    int fd_fetch_lat;
-    int fd_mem_bound;
+    // level 2 events, -1 if not opened
+
+    int fd_heavy_ops = -1;
+    int fd_br_mispredict = -1;
+    int fd_fetch_lat = -1;
+    int fd_mem_bound = -1;
+
+    /// size of group read of TMAM group (level 1 or 2)
+    std::size_t group_read_size = perf_tmam_group_read_size;
+
+    /// companion counters in TMAM group (read after the TMAM events), in the order of perf_tmam_data_t::companion
+    std::vector<int> fd_companions;
+
+    /// fd of E-core group leader (cycles), -1 if not opened
+    int fd_atom_cycles = -1;
+
+    int fd_atom_retiring;
+    int fd_atom_bad_spec;
+    int fd_atom_fe_bound;
+    int fd_atom_be_bound;
+
+    /// level 3 drill-down events (read() syscalls, also if using rdpmc), nullptr if not opened
+    std::unique_ptr<multiplexed_source> level3_source;
 
     /**
      * internally use rdpmc, but emulate behavior of traditional perf
-     * must be const, as rdpmc initialization is different from perf with counters
+     *
+     * Set on construction if requested *and* supported (cap_user_rdpmc),
+     * otherwise the handle silently falls back to read().
+     */
+    bool use_rdpmc;
+
+    /**
+     * maximum ratio of slots since the last kernel readout to slots of the current interval when using rdpmc
+     *
+     * PERF_METRICS holds 8-bit fractions of all slots since the hardware counters were last reset by the kernel,
+     * so the precision of a short interval deteriorates over time.
+     * Once the ratio is exceeded the counters are read (and thereby reset) by the kernel, costing one syscall.
+     * 0 disables such readouts, only context switches/migrations trigger kernel readouts then.
      */
-    const bool use_rdpmc;
+    uint64_t rdpmc_resync_ratio = 4;
 
-    /// store last tmam result for when using rdpmc
+    /// mmap'ed perf page of leader (slots), nullptr if not using rdpmc
+    perf_event_mmap_page* rdpmc_page_slots = nullptr;
+
+    /// mmap'ed perf page of a metric event (holds index of PERF_METRICS), nullptr if not using rdpmc
+    perf_event_mmap_page* rdpmc_page_metrics = nullptr;
+
+    /// accumulated counters as of the last kernel readout
+    perf_tmam_data_t rdpmc_sync_data;
+
+    /// seqlock values of perf pages at last kernel readout, any change indicates that the kernel touched the counters
+    uint32_t rdpmc_sync_seq_slots = 0;
+    uint32_t rdpmc_sync_seq_metrics = 0;
+
+    /// raw hardware slots & PERF_METRICS directly after last kernel readout
+    uint64_t rdpmc_sync_slots_raw = 0;
+    uint64_t rdpmc_sync_metrics_raw = 0;
+
+    /// time enabled according to perf page of slots at last kernel readout, 0 if not provided (cap_user_time unset)
+    uint64_t rdpmc_sync_time = 0;
+
+    /// last result returned, used to compute interval length & enforce monotonicity
     perf_tmam_data_t rdpmc_last_result;
 
-    /// pointer to memory region mapped to enable rdpmc
-    void* rdpmc_mmap_ptr;
+    /// mmap'ed ring buffer receiving overflow samples (starts with perf page), nullptr if not sampling
+    perf_event_mmap_page* sample_ring = nullptr;
+
+    /// size of data area of sample_ring in bytes
+    uint64_t sample_ring_data_size = 0;
+
+    /// number of samples the kernel could not store (ring buffer full)
+    uint64_t samples_lost = 0;
 
     /**
      * constructor
      *
      * opens & initializes TMAM perf events
-     * @param use_rdpmc uses RDPMC when enabled, otherwise plain perf
+     * @param config read mode & sampling configuration
      * @param pid thread to be monitored, current by default
      * @param cpu cpu to be monitored, any by default
      */
-    perf_tmam_handle(bool use_rdpmc = false, pid_t pid = 0, int cpu = -1);
+    perf_tmam_handle(const perf_tmam_config_t& config = {}, pid_t pid = 0, int cpu = -1);
 
     // delete move/copy constructors, which screws with RAII and file handle closing
     perf_tmam_handle (const perf_tmam_handle&) = delete;
@@ -112,7 +305,100 @@ public:
     virtual ~perf_tmam_handle();
 
     /// read TMAM results
-    perf_tmam_data_t read();
+    perf_tmam_data_t read() override;
+
+    /// read slots, with rdpmc only the slots counter (no kernel readout, if possible)
+    uint64_t read_slots() override;
+
+    perf_tmam_handle* perf_handle() override {
+        return this;
+    }
+
+    /**
+     * consume all overflow samples recorded since the last call
+     *
+     * Samples are parsed directly from the ring buffer (only samples wrapping around its end are copied).
+     * Must not be called concurrently for the same handle, but may be called from any thread.
+     * @param fn callable, receives const perf_tmam_sample_t&
+     * @return number of consumed samples
+     */
+    template <typename F>
+    uint64_t drain_samples(F&& fn) {
+        if (nullptr == sample_ring) {
+            return 0;
+        }
+
+        const uint64_t head = __atomic_load_n(&sample_ring->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = sample_ring->data_tail;
+        const char* data = reinterpret_cast<const char*>(sample_ring) + sample_ring->data_offset;
+
+        uint64_t consumed = 0;
+        alignas(8) char wrapped[sizeof(perf_event_header) + sizeof(perf_tmam_sample_t)];
+        while (tail < head) {
+            const uint64_t offset = tail % sample_ring_data_size;
+            const auto* header = reinterpret_cast<const perf_event_header*>(data + offset);
+            const char* record = data + offset;
+
+            if (offset + header->size > sample_ring_data_size) {
+                // record wraps around end of buffer -> copy into contiguous memory
+                if (header->size > sizeof(wrapped)) {
+                    // not one of ours, skip
+                    tail += header->size;
+                    continue;
+                }
+                const uint64_t first_part = sample_ring_data_size - offset;
+                std::memcpy(wrapped, record, first_part);
+                std::memcpy(wrapped + first_part, data, header->size - first_part);
+                record = wrapped;
+            }
+
+            if (PERF_RECORD_SAMPLE == header->type) {
+                perf_tmam_sample_t sample;
+                if (parse_sample_record(record, header->size, sample)) {
+                    fn(static_cast<const perf_tmam_sample_t&>(sample));
+                    consumed++;
+                }
+            } else if (PERF_RECORD_LOST == header->type) {
+                // layout: header, u64 id, u64 lost
+                uint64_t lost;
+                std::memcpy(&lost, record + sizeof(perf_event_header) + sizeof(uint64_t), sizeof(lost));
+                samples_lost += lost;
+            }
+
+            tail += header->size;
+        }
+
+        // release consumed space to kernel
+        __atomic_store_n(&sample_ring->data_tail, tail, __ATOMIC_RELEASE);
+        return consumed;
+    }
+
+private:
+    /// open TMAM group on PMU of given perf type (level 2 events & pinning as set in config), enables it
+    void open_core_group(uint32_t type, const perf_tmam_config_t& config, pid_t pid, int cpu);
+
+    /// open level 1 E-core (Gracemont) group on PMU of given perf type (pinned if set in config), enables it
+    void open_atom_group(uint32_t type, const perf_tmam_config_t& config, pid_t pid, int cpu);
+
+    /// read TMAM group (P-cores), zero if not opened
+    perf_tmam_data_t read_core();
+
+    /// read E-core group (if opened) and add to given data
+    void add_atom(perf_tmam_data_t& data) const;
+
+    /// read TMAM results through kernel (syscall), then record state of hardware counters for subsequent rdpmc readouts
+    perf_tmam_data_t rdpmc_sync();
+
+    /**
+     * parse PERF_RECORD_SAMPLE (sample_type IP|TIME|READ, read_format GROUP)
+     * @param record pointer to record (incl. header), must be contiguous
+     * @param size size of record in bytes
+     * @param sample receives parsed data
+     * @return true on success
+     */
+    bool parse_sample_record(const char* record, uint64_t size, perf_tmam_sample_t& sample) const;
+
+public:
 
     /// trigger perf readout, but discard results
     void nullread();
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+extern "C" {
+#include <sys/types.h>
+}
+
+#include <perf_util.hpp>
+
+/// number of fractions a phase is characterized by: level 1 & 2 categories (indexed by category number)
+constexpr std::size_t phase_fraction_count = 12;
+
+/// one phase of a thread: consecutive intervals with a stable breakdown
+struct phase_t {
+    /// id of phase, counted per thread from 0 (as reported by topdown-phase)
+    uint64_t id = 0;
+
+    /// start of first interval (gate_clock ticks)
+    uint64_t begin = 0;
+
+    /// end of last interval (gate_clock ticks)
+    uint64_t end = 0;
+
+    /// number of intervals
+    uint64_t intervals = 0;
+
+    /// counters summed over all intervals, i.e. the slot-weighted breakdown of the phase
+    perf_tmam_data_t total;
+};
+
+/// per-thread state of a phase_detector, owned by the thread (constant size)
+struct phase_state_t {
+    /// current phase, including intervals since its last change candidate was dismissed
+    phase_t current;
+
+    /// level 1 & 2 fractions of current.total
+    std::array<double, phase_fraction_count> mean = {};
+
+    /// Page-Hinkley statistic: accumulated distance of recent intervals from mean exceeding the drift
+    double cusum = 0;
+
+    /// intervals deviating since cusum became positive: start of the next phase if the change is confirmed
+    phase_t candidate;
+};
+
+/**
+ * online change-point detection over the level 1 & 2 breakdown of consecutive intervals
+ *
+ * Every interval is compared to the slot-weighted mean breakdown of the current phase by the largest absolute difference
+ * of its fractions. A Page-Hinkley test accumulates the distance exceeding an allowed drift,
+ * a new phase starts when the accumulated distance exceeds the threshold.
+ * The distance added per interval is bounded, so a sustained shift is detected after a few intervals (at least min_intervals),
+ * a single outlier (e.g. a short interval) is not.
+ * Deviating intervals are held as candidate, such that the new phase starts where the change started,
+ * and are folded back into the current phase if the statistic returns to 0.
+ *
+ * Constant memory & time per interval. Parameters shared by all threads (per-thread state in phase_state_t).
+ */
+class phase_detector {
+public:
+    /**
+     * constructor
+     * @param threshold accumulated distance (in fractions) which starts a new phase
+     * @param drift distance (in fractions) tolerated per interval, i.e. noise of the breakdown
+     * @param min_intervals minimum number of deviating intervals which confirm a change (bounds the distance per interval)
+     */
+    phase_detector(double threshold, double drift, uint64_t min_intervals);
+
+    /**
+     * add interval to phase detection
+     * @param state of calling thread
+     * @param delta counters of interval
+     * @param begin start of interval (gate_clock ticks)
+     * @param end end of interval (gate_clock ticks)
+     * @param ended receives the phase ended by this interval (if any)
+     * @return true if a new phase has been started, i.e. ended is set
+     */
+    bool add(phase_state_t& state, const perf_tmam_data_t& delta, uint64_t begin, uint64_t end, phase_t& ended) const;
+
+    /**
+     * end current phase of a thread (e.g. on thread exit), including its pending candidate
+     * @param state of calling thread
+     * @return current phase, 0 intervals if none
+     */
+    static phase_t finish(const phase_state_t& state);
+
+    /**
+     * level 1 & 2 fractions of counters (level 2 of P-core slots)
+     * @param tmam counters to examine
+     * @return fractions by category number
+     */
+    static std::array<double, phase_fraction_count> fractions(const perf_tmam_data_t& tmam);
+
+private:
+    double threshold;
+    double drift;
+
+    /// maximum distance added per interval: threshold / min_intervals
+    double max_step;
+};
+
+/**
+ * per-phase summary: duration, breakdown & slots of all phases of all threads
+ *
+ * Not synchronized.
+ */
+class phase_summary {
+public:
+    /**
+     * add ended phase
+     * @param tid thread the phase belongs to
+     * @param phase ended phase (ignored if without intervals)
+     */
+    void add(pid_t tid, const phase_t& phase);
+
+    /// true if no phase has been added
+    bool empty() const {
+        return phases.empty();
+    }
+
+    /**
+     * write summary as csv, phases sorted by slots (most expensive first)
+     * @param out stream to write to
+     * @param time_origin time phase begins are reported relative to (gate_clock ticks)
+     * @param ticks_per_us gate_clock ticks per microsecond
+     * @param level2 true if level 2 has been counted (otherwise no l2 bottleneck is given)
+     */
+    void write(std::ostream& out, uint64_t time_origin, double ticks_per_us, bool level2) const;
+
+private:
+    struct thread_phase_t {
+        pid_t tid;
+        phase_t phase;
+    };
+
+    std::vector<thread_phase_t> phases;
+};
@@ -1,14 +1,22 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 #include <stdexcept>
 #include <chrono>
 #include <string>
+#include <array>
+#include <atomic>
+#include <thread>
 #include <mutex>
-#include <map>
+#include <condition_variable>
+#include <fstream>
+#include <optional>
+#include <vector>
 
 extern "C" {
+    #include <sched.h>
     #include <unistd.h>
 }
 
@@ -23,13 +31,25 @@ extern "C" {
 #include <scorep/plugin/plugin.hpp>
 #pragma GCC diagnostic pop
 
+#include <backend.hpp>
+#include <env.hpp>
+#include <function_profile.hpp>
+#include <gate_clock.hpp>
 #include <metric.hpp>
 #include <perf_util.hpp>
+#include <phase_detector.hpp>
+#include <run_summary.hpp>
+#include <sample_gate.hpp>
+#include <sample_stream.hpp>
+#include <thread_registry.hpp>
 
 /// measurement state of a single thread
 struct thread_state_t {
-    /// perf handle
-    perf_tmam_handle tmam_handle;
+    /// id of thread this state belongs to
+    const pid_t tid;
+
+    /// counter source, opened on first readout (always empty in per-CPU mode)
+    std::unique_ptr<tmam_source> tmam_handle;
 
     /// latest sample
     perf_tmam_data_t sample_current;
@@ -37,18 +57,79 @@ struct thread_state_t {
     /// sample collected before latest
     perf_tmam_data_t sample_last;
 
-    /// time at which sample_current has been collected
-    std::chrono::steady_clock::time_point time_current;
+    /// time at which sample_current has been collected (gate_clock ticks)
+    uint64_t time_current = 0;
+
+    /// time at which sample_last has been collected (gate_clock ticks)
+    uint64_t time_last = 0;
+
+    /// time at which the first sample has been collected (gate_clock ticks)
+    uint64_t time_first = 0;
+
+    /// gate state (e.g. adapted interval) of this thread
+    sample_gate_state_t gate_state;
+
+    /// CPU whose counters sample_current holds (per-CPU mode only)
+    int sample_cpu = -1;
 
     /// total number of collected samples
     uint64_t sample_cnt_total = 0;
 
-    /// track when last data point for a particular metric has been recorded (metric != tmam sample)
-    std::map<tmam_metric_t, std::chrono::steady_clock::time_point> last_metric_datapoint_timepoint_by_metric;
+    /// number of times metric_values has been derived, 0 if not yet valid
+    uint64_t metric_epoch = 0;
 
-    /// constructor
-    thread_state_t() : tmam_handle(false, 0, -1) {
-        // nop, exists to initialize tmam_handle
+    /// all metrics derived from sample_current - sample_last (valid if metric_epoch > 0)
+    /// (dead band: derived from sample_current - sample_reported, i.e. including folded intervals)
+    tmam_metric_values_t metric_values;
+
+    /// dead band: sample at the end of the last reported interval (start of the intervals folded since)
+    perf_tmam_data_t sample_reported;
+
+    /// dead band: time at which sample_reported has been collected (gate_clock ticks)
+    uint64_t time_reported = 0;
+
+    /// dead band: metrics of latest interval, compared against metric_values
+    tmam_metric_values_t interval_values;
+
+    /// dead band: number of intervals folded since the last reported one
+    uint64_t intervals_pending = 0;
+
+    /// dead band: total number of intervals folded into a later one
+    uint64_t intervals_folded = 0;
+
+    /// run summary: time intervals were dominated by a category (gate_clock ticks), by category number (l1 & l2)
+    std::array<uint64_t, run_summary_category_count> bottleneck_ticks = {};
+
+    /// phase detection state (current phase & change candidate)
+    phase_state_t phase_state;
+
+    /// epoch for which a metric has been reported last, by metric index
+    std::array<uint64_t, tmam_metric_count> reported_epoch_by_metric = {};
+
+    /// number of Score-P events seen (gate checks)
+    uint64_t event_round = 0;
+
+    /// event round in which a metric has been requested last, by metric index
+    std::array<uint64_t, tmam_metric_count> event_round_by_metric = {};
+
+    /// position in sample stream (if streaming)
+    sample_stream::cursor_t stream_cursor;
+
+    /// time of last readout appended to sample stream (gate_clock ticks)
+    uint64_t stream_time = 0;
+
+    /// overflow sample consumed last (accessed by sample drainer only, hence on separate cache line)
+    alignas(64) perf_tmam_sample_t last_overflow_sample;
+
+    /// set if last_overflow_sample is valid
+    bool has_last_overflow_sample = false;
+
+    /**
+     * constructor
+     * @param tid id of calling thread
+     */
+    thread_state_t(pid_t tid) : tid(tid) {
+        // nop
     }
 };
 using thread_state_t = struct thread_state_t;
@@ -68,140 +149,798 @@ private:
         return gettid();
     }
 
-    /// mutex to access thread_state_by_thread (used for initialization only)
-    std::mutex thread_state_by_thread_mutex;
+    /// number of perf handles opened (per-thread mode)
+    std::atomic<uint64_t> handles_opened = 0;
 
-    /// thread-local state
-    std::map<tid_t, thread_state_t> thread_state_by_thread;
+    /// total time spent opening perf handles, in ns
+    std::atomic<uint64_t> handle_open_ns = 0;
 
     /// minimum time between two measurements
     uint64_t delta_t_min_us = 500;
 
+    /// clock gating measurements (TSC if available)
+    gate_clock clock{get_env_flag("TSC", true)};
+
+    /// delta_t_min_us in ticks of clock
+    uint64_t delta_t_min_ticks = 0;
+
+    /// decides on every event whether a sample is taken (default: delta_t_min_us passed)
+    sample_gate gate{sample_gate_policy::time, 0, 0, 0, 0};
+
+    /// configuration of perf handles
+    perf_tmam_config_t perf_config;
+
+    /// metrics selected by get_metric_properties() (bit mask, see tmam_metric_all_mask), only these are derived
+    uint64_t selected_metrics = 0;
+
+    /// intervals whose counters have been counting less than this fraction of their time are not reported
+    double min_coverage = 0;
+
+    /// number of intervals not reported due to min_coverage
+    std::atomic<uint64_t> intervals_rejected = 0;
+
+    /// change-only emission: report only significantly changed metric values, fold other intervals into the next one
+    std::optional<tmam_deadband_t> deadband;
+
+    /// dead band: maximum number of intervals folded into one reported value
+    uint64_t deadband_max_intervals = 100;
+
+    /// dead band: intervals folded by threads that have exited meanwhile (guarded by overflow_profile_mutex)
+    uint64_t intervals_folded_released = 0;
+
+    /// write run summary (per-thread totals, bottleneck histogram, imbalance) at the end
+    bool summary_enabled = false;
+
+    /// path of run summary
+    std::string summary_path;
+
+    /// totals of threads that have exited meanwhile (guarded by overflow_profile_mutex)
+    run_summary summary;
+
+    /// detects phases (changes of the breakdown) in the intervals of every thread
+    phase_detector phase_detection{0.5, 0.05, 4};
+
+    /// run phase detection (topdown-phase selected or per-phase summary requested)
+    bool detect_phases = false;
+
+    /// write per-phase summary at the end
+    bool phase_summary_enabled = false;
+
+    /// path of per-phase summary
+    std::string phase_summary_path;
+
+    /// ended phases of all threads (guarded by overflow_profile_mutex)
+    phase_summary phases;
+
+    /// time of plugin initialization, phase begins are reported relative to it (gate_clock ticks)
+    uint64_t time_origin = 0;
+
+    /// microarchitecture backend, opens counter sources
+    std::unique_ptr<tmam_backend> backend;
+
+    /// full-resolution stream of all readouts, nullptr if not streaming
+    std::unique_ptr<sample_stream> stream;
+
+    /// minimum time between two readouts appended to stream (gate_clock ticks), 0: every event
+    uint64_t stream_delta_ticks = 0;
+
+    /// count per CPU (one perf group per CPU, shared by all threads) instead of per thread
+    bool per_cpu = false;
+
+    /// per-CPU counter sources, indexed by CPU id, nullptr if not opened (yet)
+    std::vector<std::atomic<tmam_source*>> cpu_handles;
+
+    /// serializes opening of cpu_handles
+    std::mutex cpu_handles_mutex;
+
+    /// set when a thread could not use rdpmc (warn only once)
+    std::atomic<bool> rdpmc_fallback_reported = false;
+
+    /// path of per-function summary written at the end (if overflow sampling is enabled)
+    std::string sampling_summary_path;
+
+    /// overflow samples aggregated by code location
+    function_profile overflow_profile;
+
+    /**
+     * guards overflow_profile, summary & opening/closing of thread handles against the drainer
+     *
+     * When iterating thread_states, take it per state (i.e. after the slot guard), as release_thread_state() does.
+     */
+    std::mutex overflow_profile_mutex;
+
+    /// overflow samples lost by threads that have exited meanwhile
+    uint64_t samples_lost_released = 0;
+
+    /// thread consuming overflow samples (only running if overflow sampling is enabled)
+    std::thread sample_drainer;
+
+    /// time between two drains of overflow samples
+    std::chrono::milliseconds sample_drain_interval = std::chrono::milliseconds(20);
+
+    /// set to stop sample_drainer
+    bool sample_drainer_stop = false;
+
+    /// guards sample_drainer_stop
+    std::mutex sample_drainer_mutex;
+
+    /// wakes sample_drainer on stop
+    std::condition_variable sample_drainer_cv;
+
+    /// thread-local state, released (& recycled) on thread exit
+    /// (declared last: destroyed first, exiting threads must not find other members destroyed)
+    thread_registry<thread_state_t> thread_states{[this](thread_state_t& ts) { release_thread_state(ts); }};
+
+    /**
+     * consume overflow samples of one thread
+     *
+     * overflow_profile_mutex must be held
+     * @param ts state of thread with open handle
+     */
+    void drain_overflow_samples(thread_state_t& ts) {
+        // only perf_tmam_handle supports sampling
+        perf_tmam_handle* handle = ts.tmam_handle->perf_handle();
+        if (nullptr == handle) {
+            return;
+        }
+
+        handle->drain_samples([&](const perf_tmam_sample_t& sample) {
+            if (ts.has_last_overflow_sample) {
+                overflow_profile.add(sample, ts.last_overflow_sample);
+            }
+            ts.last_overflow_sample = sample;
+            ts.has_last_overflow_sample = true;
+        });
+    }
+
+    /// consume overflow samples of all threads
+    void drain_overflow_samples() {
+        thread_states.for_each([&](thread_state_t& ts) {
+            std::lock_guard lock(overflow_profile_mutex);
+            if (ts.tmam_handle) {
+                drain_overflow_samples(ts);
+            }
+        });
+    }
+
+    /// body of sample_drainer: drain periodically until stopped
+    void run_sample_drainer() {
+        std::unique_lock lock(sample_drainer_mutex);
+        while (!sample_drainer_cv.wait_for(lock, sample_drain_interval, [&]() { return sample_drainer_stop; })) {
+            drain_overflow_samples();
+        }
+    }
+
+    /// drain remaining overflow samples & write per-function summary
+    void write_sampling_summary() {
+        drain_overflow_samples();
+
+        uint64_t samples_lost = samples_lost_released;
+        thread_states.for_each([&](thread_state_t& ts) {
+            if (const auto* handle = ts.tmam_handle ? ts.tmam_handle->perf_handle() : nullptr) {
+                samples_lost += handle->samples_lost;
+            }
+        });
+        if (0 < samples_lost) {
+            scorep::plugin::log::logging::warn() << samples_lost << " overflow samples lost, "
+                                                 << "increase SAMPLING_BUFFER_PAGES or SAMPLING_PERIOD";
+        }
+
+        std::ofstream out(sampling_summary_path);
+        if (!out) {
+            scorep::plugin::log::logging::error() << "could not write sampling summary to " << sampling_summary_path;
+            return;
+        }
+        overflow_profile.write_summary(out);
+    }
+
+    /**
+     * retrieve state of current thread
+     *
+     * Lock-free, the state is found through a thread_local pointer (see thread_registry).
+     * @return state of current thread
+     */
+    thread_state_t& get_thread_state() {
+        thread_state_t* ts = thread_states.current();
+        if (nullptr == ts) [[unlikely]] {
+            throw std::runtime_error("no topdown measurement initialized for thread " + std::to_string(get_current_tid()));
+        }
+        return *ts;
+    }
+
     /**
      * retrieve current sample for current thread if applicable
      *
-     * Only if more than delta_t_min_us has passed since the last measurement will a sample be taken.
+     * Only if the gate opens (e.g. more than delta_t_min_us has passed since the last measurement) will a sample be taken.
+     * When a sample is taken, all metric values are derived at once (stored in ts.metric_values).
+     * Readouts are appended to the sample stream (if any) at its own interval, sharing the counter read.
      *
-     * @return if an actual update has been performed
+     * @param ts state of current thread
+     * @param now current time (gate_clock ticks)
      */
-    void update_samples_this_thread() {
-        const tid_t tid = get_current_tid();
-        thread_state_t& ts = thread_state_by_thread.at(tid);
-        
-        // default: record new sample
-        uint64_t passed_us = 1 + delta_t_min_us;
-        auto now = std::chrono::steady_clock::now();
+    void update_samples_this_thread(thread_state_t& ts, uint64_t now) {
+        if (!per_cpu && !ts.tmam_handle) [[unlikely]] {
+            open_thread_handle(ts);
+            // opening is not part of the sampling cost (adaptive gate)
+            now = clock.now();
+        }
+        if (0 == ts.sample_cnt_total) [[unlikely]] {
+            gate.init(ts.gate_state);
+        }
+
+        const bool sample_due = 0 == ts.sample_cnt_total || gate.due(ts.gate_state, now, ts.time_current, ts.tmam_handle.get());
+        const bool stream_due = stream && now - ts.stream_time >= stream_delta_ticks;
+        if (!sample_due && !stream_due) {
+            // gate closed -> skip update
+            return;
+        }
 
-        if (0 < ts.sample_cnt_total) {
-            // check if enough time passed
-            passed_us = std::chrono::duration_cast<std::chrono::microseconds>(now - ts.time_current).count();
+        int cpu = -1;
+        perf_tmam_data_t readout;
+        if (!per_cpu) {
+            readout = ts.tmam_handle->read();
+        } else {
+            // counters of CPU currently running on
+            cpu = sched_getcpu();
+            readout = get_cpu_handle(cpu).read();
         }
 
-        if (passed_us < delta_t_min_us) {
-            // not enough time passed -> skip update
+        if (stream_due) {
+            ts.stream_time = now;
+            stream->append(ts.stream_cursor, now, per_cpu ? cpu : sched_getcpu(), readout);
+        }
+        if (!sample_due) {
             return;
         }
 
-        // enough time passed, record new sample
-        // (require check if already in map, if yes acquire required mutex)
-        ts.time_current = now;
+        record_sample(ts, now, cpu, readout);
+        // first sample of a thread is not representative (cold caches)
+        gate.sampled(ts.gate_state, readout, gate.needs_cost() && 1 < ts.sample_cnt_total ? clock.now() - now : 0);
+    }
+
+    /**
+     * record new sample & derive metric values of the interval it ends
+     * @param ts state of current thread
+     * @param now time of readout (gate_clock ticks)
+     * @param cpu CPU read on (per-CPU mode only)
+     * @param readout counters
+     */
+    void record_sample(thread_state_t& ts, uint64_t now, int cpu, const perf_tmam_data_t& readout) {
         if (0 < ts.sample_cnt_total){
             ts.sample_last = ts.sample_current;
+            ts.time_last = ts.time_current;
         }
-        ts.sample_current = ts.tmam_handle.read();
+        ts.time_current = now;
         ts.sample_cnt_total++;
+        ts.sample_current = readout;
+        if (1 == ts.sample_cnt_total) {
+            ts.sample_reported = readout;
+            ts.time_reported = now;
+            ts.time_first = now;
+        }
+
+        if (per_cpu) {
+            // only comparable to previous sample if taken on the same CPU
+            if (cpu != ts.sample_cpu) {
+                ts.sample_cpu = cpu;
+                return;
+            }
+        }
+
+        if (2 <= ts.sample_cnt_total) {
+            const perf_tmam_data_t delta = ts.sample_current - ts.sample_last;
+            if (tmam_metric_t::get_coverage(delta) < min_coverage) {
+                // counters descheduled for too long: keep the previous values (already reported)
+                intervals_rejected.fetch_add(1, std::memory_order_relaxed);
+                if (deadband) {
+                    // report folded intervals before the rejected one, restart after it
+                    if (0 < ts.intervals_pending) {
+                        ts.metric_values.derive(ts.sample_last - ts.sample_reported, selected_metrics);
+                        set_plugin_values(ts, ts.time_reported, ts.time_last);
+                        ts.metric_epoch++;
+                        ts.intervals_pending = 0;
+                    }
+                    ts.sample_reported = ts.sample_current;
+                    ts.time_reported = ts.time_current;
+                }
+                return;
+            }
+
+            if (summary_enabled) {
+                const uint64_t ticks = ts.time_current - ts.time_last;
+                ts.bottleneck_ticks[static_cast<std::size_t>(tmam_metric_t::get_l1_bottleneck(delta))] += ticks;
+                ts.bottleneck_ticks[static_cast<std::size_t>(tmam_metric_t::get_l2_bottleneck(delta))] += ticks;
+            }
+
+            if (detect_phases) {
+                update_phase(ts, delta);
+            }
+
+            if (!deadband) {
+                ts.metric_values.derive(delta, selected_metrics);
+                set_plugin_values(ts, ts.time_last, ts.time_current);
+                ts.metric_epoch++;
+                return;
+            }
+
+            update_deadband(ts, delta);
+        }
     }
 
-public:
-    /// constructor
-    topdown_plugin() {
-        delta_t_min_us = std::stoull(scorep::environment_variable::get("INTERVAL_US",
-                                                                       std::to_string(delta_t_min_us)));
+    /**
+     * store values measured by the plugin itself: length of the interval the metric values describe (topdown-interval)
+     * & current phase (topdown-phase)
+     * @param ts state of current thread
+     * @param begin start of interval (gate_clock ticks)
+     * @param end end of interval (gate_clock ticks)
+     */
+    void set_plugin_values(thread_state_t& ts, uint64_t begin, uint64_t end) const {
+        ts.metric_values.by_index[tmam_metric_index(tmam_metric_category::interval)].f64 =
+            static_cast<double>(end - begin) / clock.get_ticks_per_us();
+        ts.metric_values.by_index[tmam_metric_index(tmam_metric_category::phase)].u64 = ts.phase_state.current.id;
     }
 
-    void add_metric(const tmam_metric_t&) {
-        // record given metric for *current thread*
-        // note that there is no specific procedure for an individual metric,
-        // all metrics are recorded by the same object
-        // -> init tmam measurement *only* if not done already
+    /**
+     * add latest interval to phase detection, keep ended phase for the per-phase summary
+     *
+     * A change is confirmed a few intervals after it started: topdown-phase increments late,
+     * the per-phase summary attributes the intervals to the new phase.
+     * @param ts state of current thread
+     * @param delta counters of latest interval
+     */
+    void update_phase(thread_state_t& ts, const perf_tmam_data_t& delta) {
+        phase_t ended;
+        if (phase_detection.add(ts.phase_state, delta, ts.time_last, ts.time_current, ended) && phase_summary_enabled) {
+            // phases end rarely
+            std::lock_guard lock(overflow_profile_mutex);
+            phases.add(ts.tid, ended);
+        }
+    }
+
+    /**
+     * change-only emission: report the latest interval only if it differs significantly from the values reported last
+     *
+     * Insignificant intervals are not dropped but folded into the next reported one
+     * (its values are derived from all counts since the last reported interval, matching the ABSOLUTE_LAST semantics).
+     * @param ts state of current thread
+     * @param delta counters of latest interval
+     */
+    void update_deadband(thread_state_t& ts, const perf_tmam_data_t& delta) {
+        if (0 < ts.metric_epoch && ts.intervals_pending < deadband_max_intervals) {
+            ts.interval_values.derive(delta, selected_metrics);
+            // a new phase is always reported
+            ts.interval_values.by_index[tmam_metric_index(tmam_metric_category::phase)].u64 = ts.phase_state.current.id;
+            if (!deadband->exceeded(ts.interval_values, ts.metric_values, selected_metrics)) {
+                ts.intervals_pending++;
+                ts.intervals_folded++;
+                return;
+            }
+        }
+
+        ts.metric_values.derive(ts.sample_current - ts.sample_reported, selected_metrics);
+        set_plugin_values(ts, ts.time_reported, ts.time_current);
+        ts.metric_epoch++;
+        ts.sample_reported = ts.sample_current;
+        ts.time_reported = ts.time_current;
+        ts.intervals_pending = 0;
+    }
+
+    /**
+     * open perf handle of current thread
+     *
+     * Deferred until the first readout: threads which never report do not pay for perf_event_open().
+     * @param ts state of current thread
+     */
+    void open_thread_handle(thread_state_t& ts) {
+        const auto begin = std::chrono::steady_clock::now();
+        {
+            // drainer must not observe half-constructed handle
+            std::lock_guard lock(overflow_profile_mutex);
+            ts.tmam_handle = backend->open(perf_config, 0, -1);
+        }
+        const auto end = std::chrono::steady_clock::now();
 
-        std::lock_guard lock(thread_state_by_thread_mutex);
+        handles_opened++;
+        handle_open_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
 
-        tid_t tid = get_current_tid();
-        if (thread_state_by_thread.find(tid) == thread_state_by_thread.end()) {
-            // use emplace because handler may not be moved
-            // use piecewise emplace, b/c handler has no constructor
-            thread_state_by_thread.emplace(std::piecewise_construct,
-                                           std::forward_as_tuple(tid),
-                                           std::forward_as_tuple());
+        const auto* handle = ts.tmam_handle->perf_handle();
+        if (perf_config.use_rdpmc && nullptr != handle && !handle->use_rdpmc && !rdpmc_fallback_reported.exchange(true)) {
+            scorep::plugin::log::logging::warn() << "rdpmc not available (cap_user_rdpmc unset), falling back to read()";
         }
     }
 
-    template <class Proxy>
-    bool get_optional_value(const tmam_metric_t& metric, Proxy& p) {
-        tid_t tid = get_current_tid();
-        thread_state_t& ts = thread_state_by_thread.at(tid);
+    /**
+     * release state of an exiting thread (called on that thread)
+     *
+     * Closes its perf handle, the state's slot is recycled by the registry.
+     * @param ts state of exiting thread
+     */
+    void release_thread_state(thread_state_t& ts) {
+        std::lock_guard lock(overflow_profile_mutex);
+        if (ts.tmam_handle) {
+            // keep overflow samples recorded since the last drain
+            drain_overflow_samples(ts);
+        }
+        if (const auto* handle = ts.tmam_handle ? ts.tmam_handle->perf_handle() : nullptr) {
+            samples_lost_released += handle->samples_lost;
+        }
+        intervals_folded_released += ts.intervals_folded;
+        if (summary_enabled) {
+            summary.add(summarize_thread(ts));
+        }
+        if (phase_summary_enabled) {
+            phases.add(ts.tid, phase_detector::finish(ts.phase_state));
+        }
+        ts.tmam_handle.reset();
+    }
 
-        // 1. check if minimum since last sample (of this metric!!) passed
+    /**
+     * collect totals of a thread for the run summary
+     *
+     * Counters accumulate since the handle has been opened, i.e. the latest sample holds the totals up to it.
+     * @param ts state of thread
+     * @return totals of thread
+     */
+    thread_summary_t summarize_thread(const thread_state_t& ts) const {
+        thread_summary_t thread;
+        thread.tid = ts.tid;
+        thread.time_s = static_cast<double>(ts.time_current - ts.time_first) / clock.get_ticks_per_us() / 1e6;
+        thread.total = ts.sample_current;
+        for (std::size_t category = 0; category < run_summary_category_count; category++) {
+            thread.bottleneck_time_s[category] =
+                static_cast<double>(ts.bottleneck_ticks[category]) / clock.get_ticks_per_us() / 1e6;
+        }
+        return thread;
+    }
 
-        // default: return data for metric
-        uint64_t passed_us = 1 + delta_t_min_us;
-        if (ts.last_metric_datapoint_timepoint_by_metric.find(metric)
-                != ts.last_metric_datapoint_timepoint_by_metric.end()) {
-            auto last_tp = ts.last_metric_datapoint_timepoint_by_metric[metric];
-            auto now = std::chrono::steady_clock::now();
-            passed_us = std::chrono::duration_cast<std::chrono::microseconds>(now - last_tp).count();
+    /// add totals of live threads to the run summary & write it
+    void write_run_summary() {
+        // lock order as in release_thread_state(): slot guard (for_each), then overflow_profile_mutex
+        thread_states.for_each([&](thread_state_t& ts) {
+            std::lock_guard lock(overflow_profile_mutex);
+            summary.add(summarize_thread(ts));
+        });
+
+        std::lock_guard lock(overflow_profile_mutex);
+        if (summary.empty()) {
+            scorep::plugin::log::logging::warn() << "no samples taken, run summary not written";
+            return;
         }
 
-        if (passed_us < delta_t_min_us) {
-            // not enough time passed since last metric readout, try again later
-            return false;
+        std::ofstream out(summary_path);
+        if (!out) {
+            scorep::plugin::log::logging::error() << "could not write run summary to " << summary_path;
+            return;
+        }
+        summary.write(out, backend->supports(tmam_metric_category::l2_bottleneck) && perf_config.level2);
+        scorep::plugin::log::logging::info() << "run summary written to " << summary_path;
+    }
+
+    /// add current phases of live threads to the per-phase summary & write it
+    void write_phase_summary() {
+        // lock order as in release_thread_state(): slot guard (for_each), then overflow_profile_mutex
+        thread_states.for_each([&](thread_state_t& ts) {
+            std::lock_guard lock(overflow_profile_mutex);
+            phases.add(ts.tid, phase_detector::finish(ts.phase_state));
+        });
+
+        std::lock_guard lock(overflow_profile_mutex);
+
+        std::ofstream out(phase_summary_path);
+        if (!out) {
+            scorep::plugin::log::logging::error() << "could not write phase summary to " << phase_summary_path;
+            return;
         }
+        phases.write(out, time_origin, clock.get_ticks_per_us(),
+                     backend->supports(tmam_metric_category::l2_bottleneck) && perf_config.level2);
+        scorep::plugin::log::logging::info() << "phase summary written to " << phase_summary_path;
+    }
 
-        // 2. (maybe) update samples
-        // (will skip update if not enough time passed for)
-        update_samples_this_thread();
+    /// log statistics on thread state & perf handle reuse
+    void log_handle_statistics() {
+        const uint64_t registrations = thread_states.registrations();
+        const uint64_t reuses = thread_states.reuses();
+        const uint64_t opened = handles_opened.load();
+        if (0 == registrations) {
+            return;
+        }
 
-        // 3. report value (if at least 2 samples are ready to compute deltas)
-        if (ts.sample_cnt_total >= 2) {
-            auto delta = ts.sample_current - ts.sample_last;
+        const double mean_open_us = 0 < opened ? handle_open_ns.load() / 1e3 / opened : 0.0;
+        const uint64_t never_opened = per_cpu ? 0 : registrations - opened;
+        scorep::plugin::log::logging::info()
+            << registrations << " threads registered, "
+            << reuses << " recycled states (hit rate " << 100.0 * reuses / registrations << "%), "
+            << opened << " perf handles opened (mean " << mean_open_us << " us), "
+            << never_opened << " never opened (saved ~" << never_opened * mean_open_us / 1e3 << " ms)";
+    }
 
-            uint64_t value_raw = metric.extract_tmam_field(delta);
+    /**
+     * retrieve counter source of given CPU (per-CPU mode), open it on first use
+     * @param cpu id of CPU
+     * @return counter source counting all tasks on cpu
+     */
+    tmam_source& get_cpu_handle(int cpu) {
+        if (0 > cpu || cpu_handles.size() <= static_cast<std::size_t>(cpu)) [[unlikely]] {
+            throw std::runtime_error("invalid CPU: " + std::to_string(cpu));
+        }
+
+        tmam_source* handle = cpu_handles[cpu].load(std::memory_order_acquire);
+        if (nullptr == handle) [[unlikely]] {
+            std::lock_guard lock(cpu_handles_mutex);
+            handle = cpu_handles[cpu].load(std::memory_order_relaxed);
+            if (nullptr == handle) {
+                // per CPU: no sampling, no rdpmc (shared by all threads on that CPU)
+                perf_tmam_config_t cpu_config;
+                cpu_config.pinned = perf_config.pinned;
+                cpu_config.level2 = perf_config.level2;
+                cpu_config.level3 = perf_config.level3;
+                handle = backend->open(cpu_config, -1, cpu).release();
+                cpu_handles[cpu].store(handle, std::memory_order_release);
+            }
+        }
+
+        return *handle;
+    }
+
+public:
+    /// constructor
+    topdown_plugin() {
+        delta_t_min_us = get_env_uint("INTERVAL_US", delta_t_min_us);
+        delta_t_min_ticks = clock.ticks_from_us(delta_t_min_us);
+        if (clock.uses_tsc()) {
+            scorep::plugin::log::logging::info() << "gating on TSC (" << clock.get_ticks_per_us() << " ticks/us)";
+        } else {
+            scorep::plugin::log::logging::info() << "gating on steady_clock (no invariant TSC or TSC disabled)";
+        }
+
+        backend = make_tmam_backend_from_env();
+        scorep::plugin::log::logging::info() << "using backend " << backend->name();
+
+        perf_config.use_rdpmc = get_env_flag("RDPMC", perf_config.use_rdpmc);
+        perf_config.rdpmc_resync_ratio = get_env_uint("RDPMC_RESYNC_RATIO", perf_config.rdpmc_resync_ratio);
+
+        perf_config.sample_period = get_env_uint("SAMPLING_PERIOD", perf_config.sample_period);
+        perf_config.sample_buffer_pages = get_env_uint("SAMPLING_BUFFER_PAGES", perf_config.sample_buffer_pages);
+        perf_config.pinned = get_env_flag("PINNED", perf_config.pinned);
+        min_coverage = get_env_double("MIN_COVERAGE", min_coverage);
+        sampling_summary_path = scorep::environment_variable::get("SAMPLING_SUMMARY",
+                                                                  "topdown-functions." + std::to_string(getpid()) + ".csv");
+
+        per_cpu = get_env_flag("PER_CPU", per_cpu);
+        if (per_cpu) {
+            cpu_handles = std::vector<std::atomic<tmam_source*>>(sysconf(_SC_NPROCESSORS_CONF));
+            if (perf_config.use_rdpmc || 0 != perf_config.sample_period) {
+                scorep::plugin::log::logging::warn() << "RDPMC and SAMPLING_PERIOD are not supported with PER_CPU, ignored";
+                perf_config.use_rdpmc = false;
+                perf_config.sample_period = 0;
+            }
+        }
 
-            if (tmam_metric_category::slots == metric.category ||
-                tmam_metric_category::l1_bottleneck == metric.category ||
-                tmam_metric_category::l2_bottleneck == metric.category) {
-                // slots & bottlenecks are reported as-is
-                p.write(value_raw);
+        if (!backend->supports_perf_metrics() && (perf_config.use_rdpmc || 0 != perf_config.sample_period || perf_config.pinned)) {
+            scorep::plugin::log::logging::warn() << "RDPMC, SAMPLING_PERIOD and PINNED are not supported by backend "
+                                                 << backend->name() << ", ignored";
+            perf_config.use_rdpmc = false;
+            perf_config.sample_period = 0;
+            perf_config.pinned = false;
+        }
+
+        if (perf_config.use_rdpmc && backend->supports_perf_metrics() && backend->supports(tmam_metric_category::companion_0)) {
+            // companions are only read by the group read
+            scorep::plugin::log::logging::warn() << "RDPMC is not supported with COMPANIONS, ignored";
+            perf_config.use_rdpmc = false;
+        }
+
+        if (0 != perf_config.sample_period) {
+            sample_drainer = std::thread(&topdown_plugin::run_sample_drainer, this);
+        }
+
+        const double deadband_epsilon = get_env_double("DEADBAND", 0);
+        if (0 < deadband_epsilon) {
+            if (per_cpu) {
+                // folded intervals must be counted on one CPU
+                scorep::plugin::log::logging::warn() << "DEADBAND is not supported with PER_CPU, ignored";
             } else {
-                // all other metrics are reported as fractions [0,1]
-                p.write(static_cast<double>(value_raw) / static_cast<double>(delta.slots));
+                deadband.emplace(get_env_double("DEADBAND_L1", deadband_epsilon), get_env_double("DEADBAND_L2", deadband_epsilon),
+                                 get_env_double("DEADBAND_L3", deadband_epsilon), deadband_epsilon);
+                deadband_max_intervals = get_env_uint("DEADBAND_MAX_INTERVALS", deadband_max_intervals);
             }
+        }
+
+        sample_gate_policy gate_policy = parse_sample_gate_policy(scorep::environment_variable::get("GATE", "time"));
+        if (sample_gate_policy::slots == gate_policy && per_cpu) {
+            // CPU counters include other tasks
+            scorep::plugin::log::logging::warn() << "GATE=slots is not supported with PER_CPU, using GATE=time";
+            gate_policy = sample_gate_policy::time;
+        }
+        if (sample_gate_policy::slots == gate_policy && !backend->reads_slots_without_syscall(perf_config)) {
+            // every event after INTERVAL_US would read all counters through the kernel
+            scorep::plugin::log::logging::warn() << "GATE=slots requires RDPMC on a non-hybrid CPU with backend " << backend->name()
+                                                 << " (slots can not be checked without a syscall), using GATE=time";
+            gate_policy = sample_gate_policy::time;
+        }
+        gate = sample_gate(gate_policy, delta_t_min_ticks, clock.ticks_from_us(get_env_uint("ADAPTIVE_MAX_US", 100000)),
+                           get_env_uint("GATE_SLOTS", 10000000), get_env_double("OVERHEAD_PERCENT", 1) / 100);
+        if (sample_gate_policy::time != gate_policy) {
+            scorep::plugin::log::logging::info() << "gate: " << gate.name();
+        }
 
-            // 4. update last recorded time
-            // note: it is critical that we update the time *after* update_samples_this_read()
-            // when using this order, if the last metric recording is >= delta_t_min_us away,
-            // the last readout of the perf handler will be too
-            // (when assigning the other way around, this must not necessarily be true)
-            ts.last_metric_datapoint_timepoint_by_metric[metric] = std::chrono::steady_clock::now();
-            return true;
+        summary_enabled = get_env_flag("SUMMARY", summary_enabled);
+        summary_path = scorep::environment_variable::get("SUMMARY_PATH", "topdown-summary." + std::to_string(getpid()) + ".csv");
+        if (summary_enabled && per_cpu) {
+            // CPU counters are shared by all threads on a CPU
+            scorep::plugin::log::logging::warn() << "SUMMARY is not supported with PER_CPU, ignored";
+            summary_enabled = false;
         }
 
-        // not all values ready -> no value to be reported
-        return false;
+        phase_detection = phase_detector(get_env_double("PHASE_THRESHOLD", 0.5), get_env_double("PHASE_DRIFT", 0.05),
+                                         get_env_uint("PHASE_MIN_INTERVALS", 4));
+        phase_summary_enabled = get_env_flag("PHASE_SUMMARY", phase_summary_enabled);
+        phase_summary_path = scorep::environment_variable::get("PHASE_SUMMARY_PATH",
+                                                               "topdown-phases." + std::to_string(getpid()) + ".csv");
+        if (phase_summary_enabled && per_cpu) {
+            // CPU counters include other tasks
+            scorep::plugin::log::logging::warn() << "PHASE_SUMMARY is not supported with PER_CPU, ignored";
+            phase_summary_enabled = false;
+        }
+        detect_phases = phase_summary_enabled;
+        time_origin = clock.now();
+
+        const std::string stream_prefix = scorep::environment_variable::get("STREAM", "");
+        if (!stream_prefix.empty()) {
+            stream_delta_ticks = clock.ticks_from_us(get_env_uint("STREAM_INTERVAL_US", 0));
+            stream = std::make_unique<sample_stream>(stream_prefix + "." + std::to_string(getpid()) + ".tmams",
+                                                     backend->name(), per_cpu, clock,
+                                                     get_env_uint("STREAM_REGION_RECORDS", 65536),
+                                                     get_env_uint("STREAM_MAX_MB", 4096) << 20);
+            scorep::plugin::log::logging::info() << "streaming all readouts to " << stream->get_path();
+        }
     }
 
-    std::vector<scorep::plugin::metric_property> get_metric_properties(const std::string& pattern) {
-        if ("*" != pattern) {
-            throw std::runtime_error("pattern must be '*'");
+    /// destructor
+    ~topdown_plugin() {
+        if (sample_drainer.joinable()) {
+            {
+                std::lock_guard lock(sample_drainer_mutex);
+                sample_drainer_stop = true;
+            }
+            sample_drainer_cv.notify_all();
+            sample_drainer.join();
+
+            write_sampling_summary();
+        }
+
+        for (auto& handle : cpu_handles) {
+            delete handle.load();
+        }
+
+        log_handle_statistics();
+
+        if (summary_enabled) {
+            write_run_summary();
+        }
+
+        if (phase_summary_enabled) {
+            write_phase_summary();
+        }
+
+        if (stream) {
+            scorep::plugin::log::logging::info() << stream->written() << " readouts streamed to " << stream->get_path();
+            if (0 < stream->dropped()) {
+                scorep::plugin::log::logging::warn() << stream->dropped() << " readouts not streamed, "
+                                                     << "STREAM_MAX_MB reached";
+            }
+        }
+
+        if (sample_gate_policy::adaptive == gate.get_policy()) {
+            // intervals of live threads, exited threads are not tracked
+            uint64_t min_interval = UINT64_MAX, max_interval = 0;
+            thread_states.for_each([&](thread_state_t& ts) {
+                if (0 < ts.sample_cnt_total) {
+                    min_interval = std::min(min_interval, ts.gate_state.interval_ticks);
+                    max_interval = std::max(max_interval, ts.gate_state.interval_ticks);
+                }
+            });
+            if (min_interval <= max_interval) {
+                scorep::plugin::log::logging::info() << "adaptive gate: final intervals " << min_interval / clock.get_ticks_per_us()
+                                                     << " to " << max_interval / clock.get_ticks_per_us() << " us";
+            }
+        }
+
+        if (deadband) {
+            uint64_t intervals_folded = intervals_folded_released;
+            thread_states.for_each([&](thread_state_t& ts) { intervals_folded += ts.intervals_folded; });
+            scorep::plugin::log::logging::info() << intervals_folded << " intervals folded into later ones (see DEADBAND)";
         }
 
+        if (0 < intervals_rejected.load()) {
+            scorep::plugin::log::logging::info() << intervals_rejected.load() << " intervals not reported, coverage below "
+                                                 << min_coverage << " (see MIN_COVERAGE)";
+        }
+    }
+
+    void add_metric(const tmam_metric_t&) {
+        // record given metric for *current thread*
+        // note that there is no specific procedure for an individual metric,
+        // all metrics are recorded by the same object
+        // -> init tmam measurement *only* if not done already (handled by registry)
+        // (perf handle is opened on first readout)
+        thread_states.register_current(get_current_tid());
+    }
+
+    template <class Proxy>
+    bool get_optional_value(const tmam_metric_t& metric, Proxy& p) {
+        thread_state_t& ts = get_thread_state();
+
+        // 1. (maybe) update samples, once per event:
+        //    all metrics are requested once per event, so a metric requested again in the same round marks the next event
+        //    (one timestamp per event, shared by all its metrics; will skip update if not enough time passed)
+        if (ts.event_round == ts.event_round_by_metric[metric.index]) {
+            ts.event_round++;
+            update_samples_this_thread(ts, clock.now());
+        }
+        ts.event_round_by_metric[metric.index] = ts.event_round;
+
+        // 2. report value, if:
+        //    - values have been derived (at least 2 comparable samples)
+        //    - this metric has not been reported for the latest values yet
+        if (0 == ts.metric_epoch || ts.metric_epoch == ts.reported_epoch_by_metric[metric.index]) {
+            return false;
+        }
+
+        ts.reported_epoch_by_metric[metric.index] = ts.metric_epoch;
+        const tmam_metric_value_t value = ts.metric_values.by_index[metric.index];
+        if (metric.is_integral()) {
+            // slots & bottlenecks are reported as-is
+            p.write(value.u64);
+        } else {
+            // all other metrics are reported as fractions [0,1]
+            p.write(value.f64);
+        }
+
+        return true;
+    }
+
+    std::vector<scorep::plugin::metric_property> get_metric_properties(const std::string& pattern) {
         std::vector<scorep::plugin::metric_property> result;
+        bool matched = false;
         for (const auto& metric : tmam_metric_t::all) {
+            // e.g. level 2 on Ice Lake, core type on non-hybrid CPUs
+            // (topdown-packed only if named explicitly, topdown-interval measured by the plugin itself)
+            if (!(metric.is_plugin_only() || backend->supports(metric.category)) ||
+                !tmam_metric_matches(pattern, metric.get_name(), metric.requires_explicit_selection())) {
+                continue;
+            }
+            matched = true;
+
+            if (per_cpu && tmam_metric_category::phase == metric.category) {
+                // CPU counters include other tasks, phases would not be those of a thread
+                scorep::plugin::log::logging::warn() << "topdown-phase is not supported with PER_CPU, not recorded";
+                continue;
+            }
+
+            // already selected by an earlier pattern
+            const uint64_t bit = 1ull << metric.index;
+            if (0 != (selected_metrics & bit)) {
+                continue;
+            }
+            selected_metrics |= bit;
+
             make_handle(metric.get_name(), metric);
             result.push_back(metric.get_metric_property());
         }
 
+        if (!matched) {
+            throw std::runtime_error("no metric matches " + pattern);
+        }
+
+        // open only the events the selected metrics are derived from (called before the first readout)
+        perf_config.level2 = true;
+        perf_config.level3 = true;
+        tmam_restrict_config(perf_config, selected_metrics);
+
+        const uint64_t phase_bit = 1ull << tmam_metric_index(tmam_metric_category::phase);
+        detect_phases = phase_summary_enabled || 0 != (selected_metrics & phase_bit);
+
         return result;
     }
 };
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * perf PMUs relevant for TMAM, as discovered from sysfs
+ *
+ * On hybrid CPUs (e.g. Alder/Raptor Lake) there is no single "cpu" PMU:
+ * P-cores are driven by "cpu_core" (supporting the Golden Cove topdown events),
+ * E-cores by "cpu_atom" (supporting only the Gracemont level 1 topdown events).
+ */
+struct tmam_pmus_t {
+    /// perf type of P-core PMU (PERF_TYPE_RAW if not hybrid)
+    uint32_t core_type;
+
+    /// perf type of E-core PMU, empty if not hybrid
+    std::optional<uint32_t> atom_type;
+
+    /// CPUs driven by the E-core PMU
+    std::vector<int> atom_cpus;
+
+    /// true if P- and E-cores are present
+    bool is_hybrid() const {
+        return atom_type.has_value();
+    }
+
+    /// true if given cpu is an E-core
+    bool is_atom_cpu(int cpu) const;
+
+    /**
+     * discover PMUs from /sys/bus/event_source/devices
+     *
+     * result is cached
+     * @return discovered PMUs
+     */
+    static const tmam_pmus_t& discover();
+};
+
+/**
+ * read perf type of a PMU
+ * @param pmu_name name of PMU, i.e. directory in /sys/bus/event_source/devices
+ * @return perf type, empty if PMU does not exist
+ */
+std::optional<uint32_t> read_pmu_type(const std::string& pmu_name);
+
+/**
+ * parse CPU list as used by sysfs (e.g. "0-3,8,10-11")
+ * @param list cpu list
+ * @return contained CPU ids
+ */
+std::vector<int> parse_cpu_list(const std::string& list);
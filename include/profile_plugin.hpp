@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include <unistd.h>
+}
+
+#if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
+#include <sys/syscall.h>
+#define gettid() syscall(SYS_gettid)
+#endif
+
+#include <scorep/SCOREP_MetricTypes.h>
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wvolatile"
+#include <scorep/plugin/plugin.hpp>
+#pragma GCC diagnostic pop
+
+#include <backend.hpp>
+#include <env.hpp>
+#include <metric.hpp>
+#include <perf_util.hpp>
+#include <thread_registry.hpp>
+
+/// measurement state of a single thread (profile mode)
+struct profile_thread_state_t {
+    /// id of thread this state belongs to
+    const pid_t tid;
+
+    /// counter source, opened on first readout
+    std::unique_ptr<tmam_source> tmam_handle;
+
+    /// latest readout (accumulated counters), reported by all metrics of the current event
+    perf_tmam_data_t sample_current;
+
+    /// number of readouts taken
+    uint64_t readout_epoch = 0;
+
+    /// epoch for which a metric has been reported last, by metric index
+    std::array<uint64_t, tmam_metric_count> reported_epoch_by_metric = {};
+
+    /// value reported last, by metric index
+    std::array<uint64_t, tmam_metric_count> reported_value_by_metric = {};
+
+    /**
+     * constructor
+     * @param tid id of calling thread
+     */
+    profile_thread_state_t(pid_t tid) : tid(tid) {
+        // nop
+    }
+};
+
+/**
+ * profile-compatible variant of topdown_plugin
+ *
+ * Reports the raw accumulated slot counts of slots and all level 1/2 categories (ACCUMULATED_START),
+ * read strictly synchronously on every event (no gating).
+ * Score-P computes the difference between region enter & exit itself, i.e. exact inclusive/exclusive slots per call path;
+ * fractions are derived in post-processing (e.g. CUBE derived metrics).
+ */
+class topdown_profile_plugin :
+    public scorep::plugin::base<topdown_profile_plugin,
+                                scorep::plugin::policy::sync_strict,
+                                scorep::plugin::policy::per_thread,
+                                scorep::plugin::policy::scorep_clock,
+                                tmam_metric_t_policy> {
+private:
+    /// configuration of perf handles (rdpmc by default: one readout per event)
+    perf_tmam_config_t perf_config;
+
+    /// metrics selected by get_metric_properties() (bit mask, see tmam_metric_all_mask)
+    uint64_t selected_metrics = 0;
+
+    /// microarchitecture backend, opens counter sources
+    std::unique_ptr<tmam_backend> backend;
+
+    /// set when a thread could not use rdpmc (warn only once)
+    std::atomic<bool> rdpmc_fallback_reported = false;
+
+    /// thread-local state, released (& recycled) on thread exit
+    /// (declared last: destroyed first, exiting threads must not find other members destroyed)
+    thread_registry<profile_thread_state_t> thread_states{[](profile_thread_state_t& ts) { ts.tmam_handle.reset(); }};
+
+    /**
+     * retrieve state of current thread
+     * @return state of current thread
+     */
+    profile_thread_state_t& get_thread_state() {
+        profile_thread_state_t* ts = thread_states.current();
+        if (nullptr == ts) [[unlikely]] {
+            throw std::runtime_error("no topdown measurement initialized for thread " + std::to_string(gettid()));
+        }
+        return *ts;
+    }
+
+    /**
+     * open counter source of current thread (on first readout)
+     * @param ts state of current thread
+     */
+    void open_thread_handle(profile_thread_state_t& ts) {
+        ts.tmam_handle = backend->open(perf_config, 0, -1);
+
+        const auto* handle = ts.tmam_handle->perf_handle();
+        if (perf_config.use_rdpmc && nullptr != handle && !handle->use_rdpmc && !rdpmc_fallback_reported.exchange(true)) {
+            scorep::plugin::log::logging::warn() << "rdpmc not available (cap_user_rdpmc unset), falling back to read(): "
+                                                 << "every event costs one syscall";
+        }
+    }
+
+public:
+    /// constructor
+    topdown_profile_plugin() {
+        backend = make_tmam_backend_from_env();
+        scorep::plugin::log::logging::info() << "using backend " << backend->name();
+
+        perf_config.use_rdpmc = get_env_flag("RDPMC", true);
+        perf_config.rdpmc_resync_ratio = get_env_uint("RDPMC_RESYNC_RATIO", perf_config.rdpmc_resync_ratio);
+        perf_config.pinned = get_env_flag("PINNED", perf_config.pinned);
+
+        if (!backend->supports_perf_metrics() && (perf_config.use_rdpmc || perf_config.pinned)) {
+            scorep::plugin::log::logging::warn() << "RDPMC and PINNED are not supported by backend "
+                                                 << backend->name() << ", ignored";
+            perf_config.use_rdpmc = false;
+            perf_config.pinned = false;
+        }
+
+        if (perf_config.use_rdpmc && backend->supports_perf_metrics() && backend->supports(tmam_metric_category::companion_0)) {
+            // companions are only read by the group read
+            scorep::plugin::log::logging::warn() << "RDPMC is not supported with COMPANIONS, ignored: every event costs one syscall";
+            perf_config.use_rdpmc = false;
+        }
+    }
+
+    void add_metric(const tmam_metric_t&) {
+        // see topdown_plugin::add_metric(): one state for all metrics of a thread
+        thread_states.register_current(gettid());
+    }
+
+    template <class Proxy>
+    void get_current_value(const tmam_metric_t& metric, Proxy& p) {
+        profile_thread_state_t& ts = get_thread_state();
+
+        // one readout per event: all metrics are requested once per event,
+        // so a metric requested again for the same readout marks the next event
+        if (0 == ts.readout_epoch || ts.readout_epoch == ts.reported_epoch_by_metric[metric.index]) {
+            if (!ts.tmam_handle) [[unlikely]] {
+                open_thread_handle(ts);
+            }
+            ts.sample_current = ts.tmam_handle->read();
+            ts.readout_epoch++;
+        }
+        ts.reported_epoch_by_metric[metric.index] = ts.readout_epoch;
+
+        // every field accumulates, but categories computed as differences of fields (e.g. light ops) may decrease slightly
+        // due to rounding -> clamp, Score-P computes unsigned differences
+        uint64_t& value = ts.reported_value_by_metric[metric.index];
+        value = std::max(value, metric.extract_tmam_field(ts.sample_current));
+        p.write(value);
+    }
+
+    std::vector<scorep::plugin::metric_property> get_metric_properties(const std::string& pattern) {
+        std::vector<scorep::plugin::metric_property> result;
+        bool matched = false;
+        for (const auto& metric : tmam_metric_t::all) {
+            // fractions, bottlenecks etc. are derived in post-processing
+            if (!metric.is_accumulable() || !backend->supports(metric.category) || !tmam_metric_matches(pattern, metric.get_accumulated_name())) {
+                continue;
+            }
+            matched = true;
+
+            // see topdown_plugin::get_metric_properties()
+            const uint64_t bit = 1ull << metric.index;
+            if (0 != (selected_metrics & bit)) {
+                continue;
+            }
+            selected_metrics |= bit;
+
+            make_handle(metric.get_accumulated_name(), metric);
+            result.push_back(metric.get_accumulated_metric_property());
+        }
+
+        if (!matched) {
+            throw std::runtime_error("no metric matches " + pattern);
+        }
+
+        perf_config.level2 = true;
+        perf_config.level3 = true;
+        tmam_restrict_config(perf_config, selected_metrics);
+
+        return result;
+    }
+};
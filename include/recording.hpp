@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <perf_util.hpp>
+
+/// number of uint64_t members of perf_tmam_data_t, all of them are recorded
+constexpr std::size_t perf_tmam_field_count = sizeof(perf_tmam_data_t) / sizeof(uint64_t);
+
+/// metadata at start of a recorded stream
+struct tmam_recording_header_t {
+    /// name of backend that recorded the stream
+    std::string backend;
+
+    /// metrics supported by that backend, bit i set if metric with tmam_metric_index() i is supported
+    uint64_t supported_mask = 0;
+
+    /// number of fields per record (perf_tmam_field_count at recording time)
+    uint32_t field_count = perf_tmam_field_count;
+};
+
+/**
+ * writes a stream of timestamped readouts (accumulating counters) to a binary file
+ *
+ * Format: magic "TMAMREC1", u32 field count, u32 length of backend name, backend name, u64 supported mask,
+ * then one record per readout: time and all fields of perf_tmam_data_t,
+ * each encoded as difference to the previous record (LEB128 varint).
+ * As counters accumulate, most records take only a few bytes per field.
+ */
+class tmam_recording_writer {
+public:
+    /**
+     * constructor, creates file & writes header
+     * @param path of file, overwritten if it exists
+     * @param header metadata to write
+     */
+    tmam_recording_writer(const std::string& path, const tmam_recording_header_t& header);
+
+    /**
+     * append one record
+     * @param time_ns timestamp of readout (steady clock, ns)
+     * @param data readout
+     */
+    void append(uint64_t time_ns, const perf_tmam_data_t& data);
+
+private:
+    std::ofstream out;
+
+    /// previous record, records are relative to it
+    uint64_t last_time_ns = 0;
+    perf_tmam_data_t last_data;
+};
+
+/// reads a stream written by tmam_recording_writer
+class tmam_recording_reader {
+public:
+    /**
+     * constructor, opens file & reads header
+     * @param path of file
+     */
+    explicit tmam_recording_reader(const std::string& path);
+
+    /// metadata of stream
+    const tmam_recording_header_t& header() const {
+        return stream_header;
+    }
+
+    /**
+     * read next record
+     * @param time_ns receives timestamp
+     * @param data receives readout (fields not contained in the stream are zero)
+     * @return false at end of stream
+     */
+    bool next(uint64_t& time_ns, perf_tmam_data_t& data);
+
+private:
+    std::ifstream in;
+    tmam_recording_header_t stream_header;
+
+    uint64_t last_time_ns = 0;
+    perf_tmam_data_t last_data;
+};
+
+/// decorates a source s.t. all its readouts are recorded
+class recording_source : public tmam_source {
+public:
+    /**
+     * constructor
+     * @param inner source to record
+     * @param path of file to record to
+     * @param header metadata to write
+     */
+    recording_source(std::unique_ptr<tmam_source> inner, const std::string& path, const tmam_recording_header_t& header);
+
+    perf_tmam_data_t read() override;
+
+    /// not recorded (gating only, see replay_source::read_slots())
+    uint64_t read_slots() override;
+
+    /// handle of recorded source: rdpmc & overflow sampling work as without recording (samples are not recorded)
+    perf_tmam_handle* perf_handle() override {
+        return inner->perf_handle();
+    }
+
+private:
+    std::unique_ptr<tmam_source> inner;
+    tmam_recording_writer writer;
+};
+
+/**
+ * replays a recorded stream, one record per readout
+ *
+ * At the end of the stream it starts over, shifted s.t. counters keep accumulating.
+ */
+class replay_source : public tmam_source {
+public:
+    /**
+     * constructor
+     * @param path of recorded stream, must hold at least two records
+     */
+    explicit replay_source(const std::string& path);
+
+    perf_tmam_data_t read() override;
+
+    /// slots of the record returned by the next read() (not consumed)
+    uint64_t read_slots() override;
+
+private:
+    std::string path;
+    std::unique_ptr<tmam_recording_reader> reader;
+
+    /// next record, already read by read_slots()
+    std::optional<perf_tmam_data_t> pending;
+
+    /// returned values are offset + (record - base)
+    perf_tmam_data_t offset;
+    perf_tmam_data_t base;
+
+    /// last returned value
+    perf_tmam_data_t last;
+
+    /// number of records returned
+    uint64_t records_returned = 0;
+};
+
+/**
+ * generates plausible, deterministic readouts without any hardware access
+ *
+ * Every readout adds a fixed number of slots, split into all level 1/2 categories by a seeded pseudo-random generator.
+ */
+class synthetic_source : public tmam_source {
+public:
+    /// slots per readout
+    static constexpr uint64_t slots_per_read = 1000000;
+
+    /**
+     * constructor
+     * @param seed of pseudo-random generator, same seed yields same readouts
+     * @param companions number of companion counters to generate (at most perf_tmam_companion_max)
+     */
+    explicit synthetic_source(uint64_t seed, std::size_t companions = 0);
+
+    perf_tmam_data_t read() override;
+
+private:
+    /// xorshift64 state
+    uint64_t state;
+
+    /// number of companion counters generated
+    std::size_t companions;
+
+    /// accumulated result
+    perf_tmam_data_t accumulated;
+
+    /// next pseudo-random fraction of n
+    uint64_t next_part(uint64_t n);
+};
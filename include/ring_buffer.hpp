@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * fixed-capacity ring buffer
+ *
+ * Storage grows with the elements pushed (amortized, as std::vector) up to the capacity,
+ * i.e. memory is only taken for elements actually held. Once full, pushing never allocates
+ * and the oldest element is overwritten.
+ *
+ * Not synchronized.
+ */
+template <typename T>
+class ring_buffer {
+private:
+    std::vector<T> storage;
+
+    /// maximum number of elements held
+    std::size_t capacity;
+
+    /// total number of elements ever pushed
+    uint64_t pushed = 0;
+
+public:
+    /// @param capacity maximum number of elements held (at least 1)
+    explicit ring_buffer(std::size_t capacity) : capacity(std::max<std::size_t>(1, capacity)) {
+        // nop
+    }
+
+    /// append element, overwrite oldest if full
+    void push(const T& element) {
+        // until full, element i is stored at index i, i.e. at i % capacity as after wrapping around
+        if (storage.size() < capacity) {
+            storage.push_back(element);
+        } else {
+            storage[pushed % capacity] = element;
+        }
+        pushed++;
+    }
+
+    /// number of elements held
+    std::size_t size() const {
+        return std::min<uint64_t>(pushed, storage.size());
+    }
+
+    /// total number of elements ever pushed, i.e. changes with every push
+    uint64_t pushed_total() const {
+        return pushed;
+    }
+
+    /// number of elements lost by overwriting
+    uint64_t overwritten() const {
+        return pushed - size();
+    }
+
+    /**
+     * call fn for every held element, oldest first
+     * @param fn callable, receives const T&
+     */
+    template <typename F>
+    void for_each(F&& fn) const {
+        const uint64_t first = pushed - size();
+        for (uint64_t i = first; i < pushed; i++) {
+            fn(storage[i % storage.size()]);
+        }
+    }
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+extern "C" {
+#include <sys/types.h>
+}
+
+#include <perf_util.hpp>
+
+/// number of l1/l2 categories, i.e. of possible bottlenecks (indexed by category number)
+constexpr std::size_t run_summary_category_count = 12;
+
+/// lifetime totals of one thread
+struct thread_summary_t {
+    /// OS thread id
+    pid_t tid = 0;
+
+    /// time between first and last sample (s)
+    double time_s = 0;
+
+    /// counters accumulated over the lifetime of the thread
+    perf_tmam_data_t total;
+
+    /// time the sampled intervals were dominated by a category (s), by category number (l1 & l2 bottlenecks)
+    std::array<double, run_summary_category_count> bottleneck_time_s = {};
+};
+
+/**
+ * end-of-run summary: per-thread totals, process-wide breakdown, bottleneck histogram & cross-thread imbalance
+ *
+ * Collects the totals of threads at their exit (or at the end of the run), i.e. no per-event cost.
+ * Not synchronized.
+ */
+class run_summary {
+public:
+    /// add totals of a thread (threads without slots are skipped)
+    void add(const thread_summary_t& thread);
+
+    /// true if no thread has been added
+    bool empty() const {
+        return threads.empty();
+    }
+
+    /**
+     * write summary as sections of csv tables
+     * @param out stream to write to
+     * @param level2 true if level 2 has been counted (otherwise only level 1 is summarized)
+     */
+    void write(std::ostream& out, bool level2) const;
+
+private:
+    std::vector<thread_summary_t> threads;
+};
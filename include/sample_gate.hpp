@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include <perf_util.hpp>
+
+/**
+ * gating policies of the synchronous plugin: decide on every event whether a sample is taken
+ *
+ * - time: fixed minimum time between two samples (INTERVAL_US)
+ * - slots: additionally require a minimum number of slots consumed since the last sample (work-based)
+ * - adaptive: per-thread minimum time, tuned such that the time spent sampling stays below a share of the runtime
+ */
+enum class sample_gate_policy {
+    time,
+    slots,
+    adaptive,
+};
+
+/**
+ * parse name of gating policy
+ * @param name "time", "slots" or "adaptive"
+ * @return policy
+ */
+inline sample_gate_policy parse_sample_gate_policy(const std::string& name) {
+    if ("time" == name) {
+        return sample_gate_policy::time;
+    } else if ("slots" == name) {
+        return sample_gate_policy::slots;
+    } else if ("adaptive" == name) {
+        return sample_gate_policy::adaptive;
+    }
+    throw std::invalid_argument("unknown gate: " + name + " (expected time, slots or adaptive)");
+}
+
+/// per-thread state of a sample_gate, owned by the thread
+struct sample_gate_state_t {
+    /// minimum time between two samples (gate_clock ticks), adapted by the adaptive policy
+    uint64_t interval_ticks = 0;
+
+    /// slots at the last sample (slots policy)
+    uint64_t slots_last = 0;
+
+    /// smoothed time spent on one sample (gate_clock ticks, adaptive policy), 0 before the first sample
+    double sample_cost_ticks = 0;
+};
+
+/**
+ * sample gate: policy & its parameters, shared by all threads (per-thread state in sample_gate_state_t)
+ *
+ * Not virtual: checked on every event, the policy is selected by a predictable branch.
+ */
+class sample_gate {
+public:
+    /**
+     * constructor
+     * @param policy gating policy
+     * @param min_ticks minimum time between two samples (ticks), lower bound of the adaptive policy
+     * @param max_ticks upper bound of the adaptive policy (ticks)
+     * @param slots_period minimum number of slots between two samples (slots policy)
+     * @param overhead_budget share of runtime the adaptive policy may spend sampling (e.g. 0.01)
+     */
+    sample_gate(sample_gate_policy policy, uint64_t min_ticks, uint64_t max_ticks, uint64_t slots_period, double overhead_budget)
+        : policy(policy), min_ticks(min_ticks), max_ticks(std::max(min_ticks, max_ticks)), slots_period(slots_period),
+          overhead_budget(overhead_budget) {
+        if (sample_gate_policy::slots == policy && 0 == slots_period) {
+            throw std::invalid_argument("slots gate requires a positive GATE_SLOTS");
+        }
+        if (sample_gate_policy::adaptive == policy && !(0 < overhead_budget && overhead_budget < 1)) {
+            throw std::invalid_argument("adaptive gate requires OVERHEAD_PERCENT in (0, 100)");
+        }
+    }
+
+    /// initialize state of a new thread
+    void init(sample_gate_state_t& state) const {
+        state = sample_gate_state_t{};
+        state.interval_ticks = min_ticks;
+    }
+
+    /**
+     * check whether a sample is due
+     *
+     * Time is checked first, counters (slots policy) are only read once enough time has passed.
+     * @param state of calling thread
+     * @param now current time (ticks)
+     * @param last time of last sample (ticks)
+     * @param source counters of calling thread (slots policy only, nullptr otherwise)
+     * @return true if a sample is due
+     */
+    bool due(const sample_gate_state_t& state, uint64_t now, uint64_t last, tmam_source* source) const {
+        if (now - last < state.interval_ticks) {
+            return false;
+        }
+        if (sample_gate_policy::slots == policy) [[unlikely]] {
+            return source->read_slots() - state.slots_last >= slots_period;
+        }
+        return true;
+    }
+
+    /**
+     * account for a sample taken
+     * @param state of calling thread
+     * @param readout counters of sample
+     * @param cost time spent taking (& deriving) the sample (ticks), 0 if not to be accounted
+     */
+    void sampled(sample_gate_state_t& state, const perf_tmam_data_t& readout, uint64_t cost) const {
+        state.slots_last = readout.slots;
+        if (sample_gate_policy::adaptive != policy || 0 == cost) {
+            return;
+        }
+
+        // exponential moving average of the cost (weight 1/8), then the interval which spends the budget:
+        //     cost / interval = budget
+        state.sample_cost_ticks = 0 == state.sample_cost_ticks ? static_cast<double>(cost) :
+            state.sample_cost_ticks + (static_cast<double>(cost) - state.sample_cost_ticks) / 8;
+        const double interval = state.sample_cost_ticks / overhead_budget;
+        state.interval_ticks = std::clamp(static_cast<uint64_t>(interval), min_ticks, max_ticks);
+    }
+
+    /// true if taken samples must be accounted by sampled() with their cost
+    bool needs_cost() const {
+        return sample_gate_policy::adaptive == policy;
+    }
+
+    sample_gate_policy get_policy() const {
+        return policy;
+    }
+
+    /// name of policy, as accepted by parse_sample_gate_policy()
+    std::string name() const {
+        switch (policy) {
+        case sample_gate_policy::slots:
+            return "slots";
+        case sample_gate_policy::adaptive:
+            return "adaptive";
+        default:
+            return "time";
+        }
+    }
+
+private:
+    sample_gate_policy policy;
+    uint64_t min_ticks;
+    uint64_t max_ticks;
+    uint64_t slots_period;
+    double overhead_budget;
+};
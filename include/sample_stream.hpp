@@ -0,0 +1,290 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include <gate_clock.hpp>
+#include <perf_util.hpp>
+
+/**
+ * full-resolution sample stream: every counter readout as fixed-size binary record in a memory-mapped file
+ *
+ * Layout: sample_stream_header_t, followed by regions of region_size bytes.
+ * Every region (sample_stream_region_header_t + region_records records) is owned by one thread,
+ * a thread claims further regions when its region is full.
+ * All structures are in native byte order.
+ */
+
+/// number of counters per record: slots, level 1, level 2 & E-core shares of slots & level 1 (hybrid CPUs)
+constexpr std::size_t sample_stream_counter_count = 14;
+
+/// header at start of stream
+struct sample_stream_header_t {
+    /// "TMAMSTR1"
+    char magic[8];
+
+    /// offset of first region (bytes)
+    uint32_t header_size;
+
+    /// size of one sample_stream_record_t (bytes)
+    uint32_t record_size;
+
+    /// number of counters per record
+    uint32_t counter_count;
+
+    /// 1 if counters are per CPU (deltas only valid between records of the same CPU), 0 if per thread
+    uint32_t per_cpu;
+
+    /// size of one region incl. its header (bytes)
+    uint64_t region_size;
+
+    /// number of records per region
+    uint64_t region_records;
+
+    /// number of regions claimed (any thread), updated while writing
+    std::atomic<uint64_t> regions_used;
+
+    /// record time is in ticks of this many per microsecond
+    double ticks_per_us;
+
+    /// record time (ticks) at CLOCK_MONOTONIC time ref_ns
+    uint64_t ref_ticks;
+
+    /// CLOCK_MONOTONIC time (ns) at record time ref_ticks
+    uint64_t ref_ns;
+
+    /// names of counters, in the order of sample_stream_record_t::counters (nul-terminated)
+    char counter_names[sample_stream_counter_count][16];
+
+    /// backend counters were read with (nul-terminated)
+    char backend[64];
+};
+
+/// header of one region (one cache line)
+struct alignas(64) sample_stream_region_header_t {
+    /// number of thread, unique within stream (regions of one thread share it)
+    uint64_t thread;
+
+    /// OS thread id of thread
+    uint64_t tid;
+
+    /// number of region within the regions of its thread, starting at 0
+    uint64_t sequence;
+
+    /// number of valid records, updated after every record
+    std::atomic<uint64_t> records;
+};
+
+/// one counter readout
+struct sample_stream_record_t {
+    /// time of readout (ticks, see sample_stream_header_t::ticks_per_us)
+    uint64_t time;
+
+    /// CPU read on
+    uint32_t cpu;
+
+    uint32_t reserved;
+
+    /// accumulated counters, see sample_stream_header_t::counter_names
+    uint64_t counters[sample_stream_counter_count];
+
+    /// store counters of a readout
+    void set_counters(const perf_tmam_data_t& data) {
+        counters[0] = data.slots;
+        counters[1] = data.retiring;
+        counters[2] = data.bad_spec;
+        counters[3] = data.fe_bound;
+        counters[4] = data.be_bound;
+        counters[5] = data.heavy_ops;
+        counters[6] = data.br_mispredict;
+        counters[7] = data.fetch_lat;
+        counters[8] = data.mem_bound;
+        counters[9] = data.ecore_slots;
+        counters[10] = data.ecore_retiring;
+        counters[11] = data.ecore_bad_spec;
+        counters[12] = data.ecore_fe_bound;
+        counters[13] = data.ecore_be_bound;
+    }
+
+    /// accumulated counters of record (all other members zero)
+    perf_tmam_data_t get_counters() const {
+        perf_tmam_data_t data;
+        data.slots = counters[0];
+        data.retiring = counters[1];
+        data.bad_spec = counters[2];
+        data.fe_bound = counters[3];
+        data.be_bound = counters[4];
+        data.heavy_ops = counters[5];
+        data.br_mispredict = counters[6];
+        data.fetch_lat = counters[7];
+        data.mem_bound = counters[8];
+        data.ecore_slots = counters[9];
+        data.ecore_retiring = counters[10];
+        data.ecore_bad_spec = counters[11];
+        data.ecore_fe_bound = counters[12];
+        data.ecore_be_bound = counters[13];
+        return data;
+    }
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "stream headers are shared through a file mapping");
+
+/**
+ * writer of a sample stream
+ *
+ * Appending is lock-free and does not format: one record is copied into the file mapping of the calling thread's region.
+ * Only claiming a region (first readout of a thread, region full) takes a lock & extends the file.
+ * Pages are written back by the kernel, not held by the plugin (or Score-P).
+ */
+class sample_stream {
+public:
+    /// per-thread position in the stream, owned by the writing thread
+    struct cursor_t {
+        /// region written to, nullptr before first record
+        sample_stream_region_header_t* region = nullptr;
+
+        /// records of region
+        sample_stream_record_t* records = nullptr;
+
+        /// number of records written to region
+        uint64_t count = 0;
+
+        /// number of thread within stream, 0 if not yet assigned
+        uint64_t thread = 0;
+
+        /// number of regions claimed by thread
+        uint64_t sequence = 0;
+    };
+
+    /**
+     * constructor, creates the file & writes the header
+     * @param path of file to create
+     * @param backend name of backend, stored in header
+     * @param per_cpu true if counters are read per CPU
+     * @param clock clock of record timestamps
+     * @param region_records number of records per region
+     * @param max_bytes maximum size of file, later records are dropped
+     */
+    sample_stream(const std::string& path, const std::string& backend, bool per_cpu, const gate_clock& clock,
+                  uint64_t region_records, uint64_t max_bytes);
+
+    sample_stream(const sample_stream&) = delete;
+    sample_stream& operator=(const sample_stream&) = delete;
+
+    /// destructor, unmaps & closes the file
+    ~sample_stream();
+
+    /**
+     * append readout of calling thread
+     * @param cursor of calling thread
+     * @param time of readout (ticks of clock given on construction)
+     * @param cpu CPU read on
+     * @param data counters
+     */
+    void append(cursor_t& cursor, uint64_t time, int cpu, const perf_tmam_data_t& data) {
+        if (nullptr == cursor.region || header->region_records == cursor.count) [[unlikely]] {
+            if (!claim_region(cursor)) {
+                records_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+
+        sample_stream_record_t& record = cursor.records[cursor.count];
+        record.time = time;
+        record.cpu = static_cast<uint32_t>(cpu);
+        record.reserved = 0;
+        record.set_counters(data);
+        cursor.count++;
+        cursor.region->records.store(cursor.count, std::memory_order_release);
+    }
+
+    /// number of records dropped because max_bytes was reached
+    uint64_t dropped() const {
+        return records_dropped.load();
+    }
+
+    /// number of records written
+    uint64_t written() const;
+
+    /// path of file
+    const std::string& get_path() const {
+        return path;
+    }
+
+private:
+    std::string path;
+    int fd = -1;
+
+    /// mapping of whole file (up to max_bytes)
+    void* mapping = nullptr;
+    std::size_t mapping_size = 0;
+
+    sample_stream_header_t* header = nullptr;
+
+    /// maximum number of regions
+    uint64_t max_regions;
+
+    /// threads which appended so far
+    std::atomic<uint64_t> threads = 0;
+
+    std::atomic<uint64_t> records_dropped = 0;
+
+    /// set once max_bytes is reached (no further claims)
+    std::atomic<bool> full = false;
+
+    /// serializes claiming regions (extending the file)
+    std::mutex claim_mutex;
+
+    /**
+     * claim next region for a thread, extends the file
+     * @param cursor of calling thread, set to new region
+     * @return false if max_bytes is reached
+     */
+    bool claim_region(cursor_t& cursor);
+};
+
+/**
+ * read-only view of a sample stream (e.g. for conversion)
+ *
+ * Maps the whole file, may be read while it is being written (regions & records published so far).
+ */
+class sample_stream_reader {
+public:
+    /**
+     * constructor, validates the header
+     * @param path of stream
+     */
+    explicit sample_stream_reader(const std::string& path);
+
+    sample_stream_reader(const sample_stream_reader&) = delete;
+    sample_stream_reader& operator=(const sample_stream_reader&) = delete;
+
+    ~sample_stream_reader();
+
+    const sample_stream_header_t& header() const {
+        return *stream_header;
+    }
+
+    /**
+     * call fn for every region, in file order (regions of one thread are in order of their sequence)
+     * @param fn receives region header, pointer to first record, number of records
+     */
+    void for_each_region(const std::function<void(const sample_stream_region_header_t&,
+                                                  const sample_stream_record_t*, uint64_t)>& fn) const;
+
+    /**
+     * convert record time to CLOCK_MONOTONIC
+     * @param time record time (ticks)
+     * @return CLOCK_MONOTONIC time (ns)
+     */
+    uint64_t to_monotonic_ns(uint64_t time) const;
+
+private:
+    const void* mapping = nullptr;
+    std::size_t mapping_size = 0;
+    const sample_stream_header_t* stream_header = nullptr;
+};
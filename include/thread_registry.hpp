@@ -0,0 +1,240 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <pthread.h>
+}
+
+/**
+ * registry of per-thread state objects
+ *
+ * Every thread owns exactly one state object, which is constructed in place inside a cache-line-aligned slot.
+ * Slots are carved from fixed-size slabs, which are neither moved nor freed before the registry itself is destroyed:
+ * Pointers to states stay valid for the lifetime of the registry (or until released, see below).
+ *
+ * The state of the calling thread is found through a thread_local pointer,
+ * so the hot path (current()) requires no search, no lock and no syscall.
+ * As every state occupies its own cache lines, threads do not share cache lines when updating their states.
+ *
+ * Registration (rare) is serialized by a mutex.
+ * Iterating all states (for_each()) may happen concurrently to registration, states are published only after being constructed.
+ *
+ * Optionally, states are released when their thread exits (pthread key destructor, i.e. not for the main thread):
+ * A given callback is invoked on the exiting thread, then the state is destroyed and its slot is recycled for the next thread to register.
+ *
+ * @tparam T state type, may be neither copyable nor movable
+ */
+template <typename T>
+class thread_registry {
+public:
+    /// assumed size of one cache line (x86)
+    static constexpr std::size_t cache_line_size = 64;
+
+    /// number of slots allocated at once
+    static constexpr std::size_t slots_per_slab = 64;
+
+    /// maximum number of slabs, caps the number of threads at slots_per_slab * max_slabs
+    static constexpr std::size_t max_slabs = 1024;
+
+private:
+    /// one state, padded to a multiple of the cache line size
+    struct alignas(cache_line_size) slot_t {
+        std::optional<T> state;
+
+        /// guards (re-)construction & destruction of state against for_each()
+        std::mutex guard;
+
+        /// registry this slot belongs to (for thread exit handler)
+        thread_registry* owner = nullptr;
+    };
+
+    /// thread-local association thread -> state, owner guards against stale pointers from previous registries
+    struct current_t {
+        const thread_registry* owner = nullptr;
+        T* state = nullptr;
+    };
+
+    static inline thread_local current_t current_state;
+
+    /// serializes registration
+    std::mutex registration_mutex;
+
+    /// slabs allocated so far, unused entries are nullptr
+    std::array<std::atomic<slot_t*>, max_slabs> slabs = {};
+
+    /// number of constructed (published) states
+    std::atomic<std::size_t> state_count = 0;
+
+    /// called on exiting thread before its state is destroyed, empty if states are never released
+    std::function<void(T&)> on_exit;
+
+    /// pthread key whose destructor detects thread exit (only if on_exit is set)
+    pthread_key_t exit_key;
+
+    /// slots of exited threads, ready to be reused (guarded by registration_mutex)
+    std::vector<slot_t*> free_slots;
+
+    /// total number of registrations
+    std::atomic<uint64_t> registered_total = 0;
+
+    /// number of registrations that reused a slot
+    std::atomic<uint64_t> reused_total = 0;
+
+    /// pthread key destructor, see on_exit
+    static void on_thread_exit(void* slot_ptr) {
+        slot_t* slot = static_cast<slot_t*>(slot_ptr);
+        slot->owner->release(*slot);
+    }
+
+    /// release state of slot (called on its exiting thread), make it available for reuse
+    void release(slot_t& slot) {
+        {
+            std::lock_guard slot_lock(slot.guard);
+            on_exit(*slot.state);
+            slot.state.reset();
+        }
+
+        // called on the exiting thread: later calls of it must not reach the destroyed (or recycled) state
+        current_state = {};
+
+        std::lock_guard lock(registration_mutex);
+        free_slots.push_back(&slot);
+    }
+
+public:
+    /**
+     * constructor
+     * @param on_exit if set, states are released when their thread exits, after calling on_exit on the exiting thread
+     */
+    explicit thread_registry(std::function<void(T&)> on_exit = {}) : on_exit(std::move(on_exit)) {
+        if (this->on_exit && 0 != pthread_key_create(&exit_key, &thread_registry::on_thread_exit)) {
+            throw std::runtime_error("could not create pthread key");
+        }
+    }
+
+    // states are referenced by pointers -> never copy/move
+    thread_registry(const thread_registry&) = delete;
+    thread_registry& operator=(const thread_registry&) = delete;
+
+    ~thread_registry() {
+        if (on_exit) {
+            // exiting threads must not touch this registry anymore
+            pthread_key_delete(exit_key);
+        }
+
+        for (auto& slab : slabs) {
+            delete[] slab.load(std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * retrieve state of the calling thread
+     * @return state of calling thread, nullptr if it has not been registered
+     */
+    T* current() const noexcept {
+        const current_t& cur = current_state;
+        if (this != cur.owner) [[unlikely]] {
+            return nullptr;
+        }
+        return cur.state;
+    }
+
+    /**
+     * register the calling thread, i.e. construct its state
+     *
+     * noop if the calling thread has already been registered.
+     * @param args passed to the constructor of T
+     * @return state of the calling thread
+     */
+    template <typename... Args>
+    T& register_current(Args&&... args) {
+        if (T* existing = current(); nullptr != existing) {
+            return *existing;
+        }
+
+        std::lock_guard lock(registration_mutex);
+        registered_total++;
+
+        slot_t* slot = nullptr;
+        if (!free_slots.empty()) {
+            // recycle slot of exited thread
+            slot = free_slots.back();
+            free_slots.pop_back();
+            reused_total++;
+
+            std::lock_guard slot_lock(slot->guard);
+            slot->state.emplace(std::forward<Args>(args)...);
+        } else {
+            const std::size_t idx = state_count.load(std::memory_order_relaxed);
+            const std::size_t slab_idx = idx / slots_per_slab;
+            if (slab_idx >= max_slabs) {
+                throw std::runtime_error("too many threads, registry capacity exhausted");
+            }
+
+            slot_t* slab = slabs[slab_idx].load(std::memory_order_relaxed);
+            if (nullptr == slab) {
+                slab = new slot_t[slots_per_slab];
+                slabs[slab_idx].store(slab, std::memory_order_release);
+            }
+
+            slot = &slab[idx % slots_per_slab];
+            slot->owner = this;
+            slot->state.emplace(std::forward<Args>(args)...);
+
+            // publish only after state is fully constructed
+            state_count.store(idx + 1, std::memory_order_release);
+        }
+
+        if (on_exit) {
+            pthread_setspecific(exit_key, slot);
+        }
+
+        current_state = {this, &*slot->state};
+        return *slot->state;
+    }
+
+    /// number of slots in use or recyclable (i.e. maximum number of concurrently registered threads so far)
+    std::size_t size() const noexcept {
+        return state_count.load(std::memory_order_acquire);
+    }
+
+    /// total number of registrations (including recycled slots)
+    uint64_t registrations() const noexcept {
+        return registered_total.load(std::memory_order_relaxed);
+    }
+
+    /// number of registrations served by a recycled slot
+    uint64_t reuses() const noexcept {
+        return reused_total.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * call fn for every registered state
+     *
+     * Safe to be called concurrently to register_current(), then states registered meanwhile might be skipped.
+     * While fn is running on a state, it will not be released.
+     * @param fn callable, receives T&
+     */
+    template <typename F>
+    void for_each(F&& fn) {
+        const std::size_t count = size();
+        for (std::size_t i = 0; i < count; i++) {
+            slot_t& slot = slabs[i / slots_per_slab].load(std::memory_order_acquire)[i % slots_per_slab];
+            std::lock_guard slot_lock(slot.guard);
+            if (slot.state) {
+                fn(*slot.state);
+            }
+        }
+    }
+};
@@ -0,0 +1,3 @@
+#include <async_plugin.hpp>
+
+SCOREP_METRIC_PLUGIN_CLASS(topdown_async_plugin, "topdown_async")
@@ -0,0 +1,575 @@
+#include <backend.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+extern "C" {
+#include <cpuid.h>
+}
+
+#include <pmu.hpp>
+
+/**
+ * encode raw event for Intel core PMU
+ * @param event event select
+ * @param umask unit mask
+ * @param cmask counter mask (count cycles with at least cmask occurrences), 0 to count occurrences
+ * @return perf config for the core PMU
+ */
+static constexpr uint64_t intel_raw_event(uint64_t event, uint64_t umask, uint64_t cmask = 0) {
+    return event | (umask << 8) | (cmask << 24);
+}
+
+/**
+ * Golden Cove level 3 events below core bound & memory bound
+ *
+ * Two groups, each with its own cycles: ratios within a group are consistent even if multiplexed.
+ * Derivation as in the TMA metrics of Golden Cove (Ports_Utilization approximated by the cycles with 0..2 ports utilized).
+ * @param type perf type of core PMU
+ */
+static multiplexed_event_set_t make_golden_cove_level3_events(uint32_t type) {
+    return {
+        .events = {
+            // memory group
+            {"cpu_clk_unhalted.thread_p", type, intel_raw_event(0x3c, 0x00)},
+            {"exe_activity.bound_on_loads", type, intel_raw_event(0xa6, 0x21, 5), true},
+            {"memory_activity.stalls_l1d_miss", type, intel_raw_event(0x47, 0x03, 3), true},
+            {"memory_activity.stalls_l2_miss", type, intel_raw_event(0x47, 0x05, 5), true},
+            {"memory_activity.stalls_l3_miss", type, intel_raw_event(0x47, 0x09, 9), true},
+            {"exe_activity.bound_on_stores", type, intel_raw_event(0xa6, 0x40, 2), true},
+
+            // core group
+            {"cpu_clk_unhalted.thread_p", type, intel_raw_event(0x3c, 0x00)},
+            {"arith.div_active", type, intel_raw_event(0xb0, 0x09, 1), true},
+            {"exe_activity.exe_bound_0_ports", type, intel_raw_event(0xa6, 0x80), true},
+            {"exe_activity.1_ports_util", type, intel_raw_event(0xa6, 0x02), true},
+            {"exe_activity.2_ports_util", type, intel_raw_event(0xa6, 0x04), true},
+        },
+        .derive_interval = [](const uint64_t* counts, perf_tmam_data_t& interval) {
+            const uint64_t bound_on_loads = counts[1];
+            const uint64_t stalls_l1d_miss = counts[2];
+            const uint64_t stalls_l2_miss = counts[3];
+            const uint64_t stalls_l3_miss = counts[4];
+
+            // stall counts nest (L3 miss implies L2 miss etc.), scaling may break that slightly -> clamp
+            interval.l3_mem_cycles = counts[0];
+            interval.l1_bound = bound_on_loads > stalls_l1d_miss ? bound_on_loads - stalls_l1d_miss : 0;
+            interval.l2_bound = stalls_l1d_miss > stalls_l2_miss ? stalls_l1d_miss - stalls_l2_miss : 0;
+            interval.l3_bound = stalls_l2_miss > stalls_l3_miss ? stalls_l2_miss - stalls_l3_miss : 0;
+            interval.dram_bound = stalls_l3_miss;
+            interval.store_bound = counts[5];
+
+            interval.l3_core_cycles = counts[6];
+            interval.divider = counts[7];
+            interval.ports_util = counts[8] + counts[9] + counts[10];
+        },
+    };
+}
+
+perf_metrics_backend::perf_metrics_backend(bool level2, bool level3, const std::vector<std::string>& companions)
+    : level2(level2) {
+    const tmam_pmus_t& pmus = tmam_pmus_t::discover();
+    if (level2 && level3) {
+        level3_events = std::make_unique<multiplexed_event_set_t>(make_golden_cove_level3_events(pmus.core_type));
+    }
+
+    for (const auto& spec : companions) {
+        companion_events.push_back(parse_companion_event(spec, pmus.is_hybrid() ? "cpu_core" : "cpu", pmus.core_type));
+    }
+    // fail now rather than with a group that is never scheduled
+    check_companion_budget(companion_events);
+}
+
+std::string perf_metrics_backend::name() const {
+    return level2 ? "golden_cove" : "ice_lake";
+}
+
+bool perf_metrics_backend::reads_slots_without_syscall(const perf_tmam_config_t& config) const {
+    // see perf_tmam_handle::read_slots(): hybrid CPUs always read the atom group
+    return config.use_rdpmc && !tmam_pmus_t::discover().is_hybrid();
+}
+
+bool perf_metrics_backend::supports(tmam_metric_category category) const {
+    if (tmam_metric_t(category).is_plugin_only()) {
+        return false;
+    }
+
+    if (tmam_metric_t(category).is_hybrid_only()) {
+        return level2 && tmam_pmus_t::discover().is_hybrid();
+    }
+
+    if (tmam_metric_t(category).is_level3()) {
+        return nullptr != level3_events;
+    }
+
+    if (tmam_metric_t(category).is_companion()) {
+        return tmam_metric_t(category).get_companion_number() < companion_events.size();
+    }
+
+    if (level2) {
+        return true;
+    }
+
+    switch (category) {
+    case tmam_metric_category::slots:
+    case tmam_metric_category::l1_bottleneck:
+    case tmam_metric_category::l1_retiring:
+    case tmam_metric_category::l1_bad_speculation:
+    case tmam_metric_category::l1_frontend_bound:
+    case tmam_metric_category::l1_backend_bound:
+    case tmam_metric_category::coverage:
+    case tmam_metric_category::packed:
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::unique_ptr<tmam_source> perf_metrics_backend::open(const perf_tmam_config_t& config, pid_t pid, int cpu) const {
+    perf_tmam_config_t handle_config = config;
+    // level 2/3 events only if available and requested (see tmam_restrict_config())
+    handle_config.level2 = level2 && config.level2;
+    handle_config.core_pmu_type = PERF_TYPE_RAW;
+    handle_config.atom_pmu_type = std::nullopt;
+    handle_config.level3_events = config.level3 ? level3_events.get() : nullptr;
+    handle_config.companion_events = companion_events.empty() ? nullptr : &companion_events;
+
+    if (level2) {
+        // hybrid CPUs: count on both P- and E-cores, thread may migrate
+        const tmam_pmus_t& pmus = tmam_pmus_t::discover();
+        handle_config.core_pmu_type = pmus.core_type;
+        handle_config.atom_pmu_type = pmus.atom_type;
+
+        // single CPU: only the PMU driving that CPU can count
+        if (-1 != cpu && pmus.is_hybrid()) {
+            if (pmus.is_atom_cpu(cpu)) {
+                handle_config.core_pmu_type = std::nullopt;
+            } else {
+                handle_config.atom_pmu_type = std::nullopt;
+            }
+        }
+    }
+
+    return std::make_unique<perf_tmam_handle>(handle_config, pid, cpu);
+}
+
+multiplexed_backend::multiplexed_backend(std::string name,
+                                         multiplexed_event_set_t event_set,
+                                         std::vector<tmam_metric_category> categories)
+    : backend_name(std::move(name)), event_set(std::move(event_set)), categories(std::move(categories)) {
+    // nop
+}
+
+std::string multiplexed_backend::name() const {
+    return backend_name;
+}
+
+bool multiplexed_backend::supports(tmam_metric_category category) const {
+    return std::find(categories.begin(), categories.end(), category) != categories.end();
+}
+
+std::unique_ptr<tmam_source> multiplexed_backend::open(const perf_tmam_config_t& config, pid_t pid, int cpu) const {
+    return std::make_unique<multiplexed_source>(event_set, pid, cpu, config.inherit);
+}
+
+recording_backend::recording_backend(std::unique_ptr<tmam_backend> inner, std::string path_prefix)
+    : inner(std::move(inner)), path_prefix(std::move(path_prefix)) {
+    // nop
+}
+
+std::string recording_backend::name() const {
+    return inner->name();
+}
+
+bool recording_backend::supports(tmam_metric_category category) const {
+    return inner->supports(category);
+}
+
+bool recording_backend::supports_perf_metrics() const {
+    return inner->supports_perf_metrics();
+}
+
+bool recording_backend::reads_slots_without_syscall(const perf_tmam_config_t& config) const {
+    return inner->reads_slots_without_syscall(config);
+}
+
+std::unique_ptr<tmam_source> recording_backend::open(const perf_tmam_config_t& config, pid_t pid, int cpu) const {
+    const tmam_recording_header_t header = {
+        .backend = inner->name(),
+        .supported_mask = get_supported_mask(*inner),
+    };
+    const std::string path = path_prefix + "." + std::to_string(opened++) + ".tmam";
+    return std::make_unique<recording_source>(inner->open(config, pid, cpu), path, header);
+}
+
+replay_backend::replay_backend(std::string path_prefix) : path_prefix(std::move(path_prefix)) {
+    header = tmam_recording_reader(this->path_prefix + ".0.tmam").header();
+}
+
+std::string replay_backend::name() const {
+    return "replay (recorded with " + header.backend + ")";
+}
+
+bool replay_backend::supports(tmam_metric_category category) const {
+    return 0 != (header.supported_mask & (1ull << tmam_metric_index(category)));
+}
+
+std::unique_ptr<tmam_source> replay_backend::open(const perf_tmam_config_t&, pid_t, int) const {
+    return std::make_unique<replay_source>(path_prefix + "." + std::to_string(opened++) + ".tmam");
+}
+
+synthetic_backend::synthetic_backend(std::size_t companions) : companions(companions) {
+    // nop
+}
+
+std::string synthetic_backend::name() const {
+    return "synthetic";
+}
+
+bool synthetic_backend::supports(tmam_metric_category category) const {
+    if (tmam_metric_t(category).is_plugin_only()) {
+        return false;
+    }
+    if (tmam_metric_t(category).is_companion()) {
+        return tmam_metric_t(category).get_companion_number() < companions;
+    }
+    return !tmam_metric_t(category).is_hybrid_only() && !tmam_metric_t(category).is_level3();
+}
+
+std::unique_ptr<tmam_source> synthetic_backend::open(const perf_tmam_config_t&, pid_t, int) const {
+    return std::make_unique<synthetic_source>(1 + opened++, companions);
+}
+
+uint64_t get_supported_mask(const tmam_backend& backend) {
+    static_assert(tmam_metric_count <= 64, "supported metrics are stored as 64 bit mask");
+
+    uint64_t mask = 0;
+    for (const auto& metric : tmam_metric_t::all) {
+        if (backend.supports(metric.category)) {
+            mask |= 1ull << metric.index;
+        }
+    }
+    return mask;
+}
+
+/**
+ * encode raw event for AMD core PMU
+ * @param event event select (12 bit)
+ * @param umask unit mask
+ * @param cmask counter mask (count cycles with at least cmask occurrences), 0 to count occurrences
+ * @return perf config for PERF_TYPE_RAW
+ */
+static constexpr uint64_t amd_raw_event(uint64_t event, uint64_t umask, uint64_t cmask = 0) {
+    return (event & 0xff) | (umask << 8) | (cmask << 24) | ((event >> 8) << 32);
+}
+
+/// dispatch width of Zen 4
+static constexpr uint64_t zen4_dispatch_width = 6;
+
+/**
+ * Zen 4 pipeline utilization events
+ *
+ * see AMD PPR for family 19h, and the derivation used by Linux perf (tools/perf/pmu-events/arch/x86/amdzen4/pipeline.json)
+ */
+static multiplexed_backend make_zen4_backend() {
+    multiplexed_event_set_t event_set = {
+        .events = {
+            {"ls_not_halted_cyc", PERF_TYPE_RAW, amd_raw_event(0x076, 0x00)},
+            {"de_no_dispatch_per_slot.no_ops_from_frontend", PERF_TYPE_RAW, amd_raw_event(0x1a0, 0x01)},
+            {"de_no_dispatch_per_slot.no_ops_from_frontend:cmask=6", PERF_TYPE_RAW, amd_raw_event(0x1a0, 0x01, zen4_dispatch_width)},
+            {"de_no_dispatch_per_slot.backend_stalls", PERF_TYPE_RAW, amd_raw_event(0x1a0, 0x1e)},
+            {"de_src_op_disp.all", PERF_TYPE_RAW, amd_raw_event(0x0aa, 0x07)},
+            {"ex_ret_ops", PERF_TYPE_RAW, amd_raw_event(0x0c1, 0x00)},
+            {"ex_ret_ucode_ops", PERF_TYPE_RAW, amd_raw_event(0x1c1, 0x00)},
+            {"ex_ret_brn_misp", PERF_TYPE_RAW, amd_raw_event(0x0c3, 0x00)},
+            {"resyncs_or_nc_redirects", PERF_TYPE_RAW, amd_raw_event(0x096, 0x00)},
+            {"ex_no_retire.not_complete", PERF_TYPE_RAW, amd_raw_event(0x0d6, 0x02)},
+            {"ex_no_retire.load_not_complete", PERF_TYPE_RAW, amd_raw_event(0x0d6, 0xa2)},
+        },
+        .derive_interval = [](const uint64_t* counts, perf_tmam_data_t& interval) {
+            const uint64_t cycles = counts[0];
+            const uint64_t fe_bound = counts[1];
+            const uint64_t fe_latency_cycles = counts[2];
+            const uint64_t be_bound = counts[3];
+            const uint64_t dispatched = counts[4];
+            const uint64_t retired = counts[5];
+            const uint64_t retired_ucode = counts[6];
+            const uint64_t mispredicts = counts[7];
+            const uint64_t resyncs = counts[8];
+            const uint64_t not_complete = counts[9];
+            const uint64_t load_not_complete = counts[10];
+
+            // note: slots lost to SMT contention are not assigned to any category
+            interval.slots = zen4_dispatch_width * cycles;
+            interval.retiring = retired;
+            interval.bad_spec = dispatched > retired ? dispatched - retired : 0;
+            interval.fe_bound = fe_bound;
+            interval.be_bound = be_bound;
+
+            // level 2: as fraction of parent category (scaling may yield slightly inconsistent counts -> clamp)
+            interval.heavy_ops = std::min(retired_ucode, interval.retiring);
+            if (0 != mispredicts + resyncs) {
+                interval.br_mispredict = interval.bad_spec * mispredicts / (mispredicts + resyncs);
+            }
+            interval.fetch_lat = std::min(zen4_dispatch_width * fe_latency_cycles, interval.fe_bound);
+            if (0 != not_complete) {
+                interval.mem_bound = interval.be_bound * std::min(load_not_complete, not_complete) / not_complete;
+            }
+        },
+    };
+
+    return multiplexed_backend("zen4", std::move(event_set), {
+        tmam_metric_category::slots,
+        tmam_metric_category::l1_bottleneck,
+        tmam_metric_category::l2_bottleneck,
+        tmam_metric_category::l1_retiring,
+        tmam_metric_category::l1_bad_speculation,
+        tmam_metric_category::l1_frontend_bound,
+        tmam_metric_category::l1_backend_bound,
+        tmam_metric_category::l2_light_ops,
+        tmam_metric_category::l2_heavy_ops,
+        tmam_metric_category::l2_branch_misprediction,
+        tmam_metric_category::l2_machine_clear,
+        tmam_metric_category::l2_fetch_latency,
+        tmam_metric_category::l2_fetch_bandwidth,
+        tmam_metric_category::l2_core_bound,
+        tmam_metric_category::l2_memory_bound,
+        tmam_metric_category::coverage,
+        tmam_metric_category::packed,
+    });
+}
+
+/// vendor, family & model of the executing CPU (CPUID)
+struct cpu_id_t {
+    /// vendor string, e.g. "GenuineIntel" or "AuthenticAMD", empty if CPUID is not available
+    std::string vendor;
+
+    /// family (incl. extended family)
+    unsigned int family = 0;
+
+    /// model (incl. extended model)
+    unsigned int model = 0;
+};
+
+/// read vendor, family & model of the executing CPU
+static cpu_id_t read_cpu_id() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx)) {
+        return {};
+    }
+
+    char vendor[13] = {};
+    std::memcpy(vendor, &ebx, 4);
+    std::memcpy(vendor + 4, &edx, 4);
+    std::memcpy(vendor + 8, &ecx, 4);
+
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    cpu_id_t id = {
+        .vendor = vendor,
+        .family = (eax >> 8) & 0xf,
+        .model = (eax >> 4) & 0xf,
+    };
+    if (0x6 == id.family || 0xf == id.family) {
+        id.model += ((eax >> 16) & 0xf) << 4;
+    }
+    if (0xf == id.family) {
+        id.family += (eax >> 20) & 0xff;
+    }
+    return id;
+}
+
+/// Intel family 6 cores with the Skylake encoding of INT_MISC.RECOVERY_CYCLES (Skylake to Comet Lake, Cascade/Cooper Lake)
+static bool is_intel_skylake_model(unsigned int model) {
+    static constexpr std::array<unsigned int, 7> models = {0x4e, 0x5e, 0x55, 0x8e, 0x9e, 0xa5, 0xa6};
+    return std::find(models.begin(), models.end(), model) != models.end();
+}
+
+/// Intel family 6 cores before Skylake with the level 1 events (Sandy Bridge to Broadwell)
+static bool is_intel_pre_skylake_model(unsigned int model) {
+    static constexpr std::array<unsigned int, 12> models = {
+        0x2a, 0x2d, 0x3a, 0x3e, 0x3c, 0x3f, 0x45, 0x46, 0x3d, 0x47, 0x4f, 0x56,
+    };
+    return std::find(models.begin(), models.end(), model) != models.end();
+}
+
+/// issue width of Sandy Bridge to Skylake-era cores
+static constexpr uint64_t skylake_issue_width = 4;
+
+/**
+ * Sandy Bridge to Skylake-era Intel cores (no PERF_METRICS): level 1 from the classic 4-wide TMAM events
+ *
+ * As the TMA metrics of these cores: slots = 4 * cycles, frontend bound = uops not delivered by the IDQ,
+ * bad speculation = uops issued but not retired + 4 * recovery cycles, retiring = retire slots, backend bound = the rest.
+ * Counted per logical thread: with SMT enabled the slots of a core are shared, so the fractions are approximate.
+ * @param model CPUID model, selects the encoding of INT_MISC.RECOVERY_CYCLES
+ */
+static multiplexed_backend make_skylake_backend(unsigned int model) {
+    const uint64_t recovery_cycles = is_intel_skylake_model(model) ? intel_raw_event(0x0d, 0x01) : intel_raw_event(0x0d, 0x03, 1);
+    multiplexed_event_set_t event_set = {
+        .events = {
+            {"cpu_clk_unhalted.thread", PERF_TYPE_RAW, intel_raw_event(0x3c, 0x00)},
+            {"idq_uops_not_delivered.core", PERF_TYPE_RAW, intel_raw_event(0x9c, 0x01)},
+            {"uops_issued.any", PERF_TYPE_RAW, intel_raw_event(0x0e, 0x01)},
+            {"uops_retired.retire_slots", PERF_TYPE_RAW, intel_raw_event(0xc2, 0x02)},
+            {"int_misc.recovery_cycles", PERF_TYPE_RAW, recovery_cycles},
+        },
+        .derive_interval = [](const uint64_t* counts, perf_tmam_data_t& interval) {
+            const uint64_t issued = counts[2];
+            const uint64_t retired = counts[3];
+
+            // scaling may yield slightly inconsistent counts -> clamp, backend bound gets the rest
+            interval.slots = skylake_issue_width * counts[0];
+            interval.fe_bound = std::min(counts[1], interval.slots);
+            interval.retiring = std::min(retired, interval.slots - interval.fe_bound);
+            interval.bad_spec = std::min((issued > retired ? issued - retired : 0) + skylake_issue_width * counts[4],
+                                         interval.slots - interval.fe_bound - interval.retiring);
+            interval.be_bound = interval.slots - interval.fe_bound - interval.retiring - interval.bad_spec;
+        },
+    };
+
+    return multiplexed_backend("skylake", std::move(event_set), {
+        tmam_metric_category::slots,
+        tmam_metric_category::l1_bottleneck,
+        tmam_metric_category::l1_retiring,
+        tmam_metric_category::l1_bad_speculation,
+        tmam_metric_category::l1_frontend_bound,
+        tmam_metric_category::l1_backend_bound,
+        tmam_metric_category::coverage,
+        tmam_metric_category::packed,
+    });
+}
+
+/**
+ * generic fallback: approximate level 1 from perf's generic stall events
+ *
+ * Assumes one slot per cycle: cycles are either frontend stalled, backend stalled or "retiring".
+ * Limitations: every cycle without a stall counts as retiring, i.e. bad speculation can not be distinguished
+ * (always 0, wasted work is part of retiring), and issue width is ignored.
+ * Only available where the kernel maps the generic stall events (e.g. older AMD cores),
+ * not on Intel cores (see make_skylake_backend()).
+ */
+static multiplexed_backend make_generic_backend() {
+    multiplexed_event_set_t event_set = {
+        .events = {
+            {"cpu-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {"stalled-cycles-frontend", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND},
+            {"stalled-cycles-backend", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+        },
+        .derive_interval = [](const uint64_t* counts, perf_tmam_data_t& interval) {
+            interval.slots = counts[0];
+            interval.fe_bound = std::min(counts[1], interval.slots);
+            interval.be_bound = std::min(counts[2], interval.slots - interval.fe_bound);
+            interval.retiring = interval.slots - interval.fe_bound - interval.be_bound;
+        },
+    };
+
+    return multiplexed_backend("generic", std::move(event_set), {
+        tmam_metric_category::slots,
+        tmam_metric_category::l1_bottleneck,
+        tmam_metric_category::l1_retiring,
+        tmam_metric_category::l1_frontend_bound,
+        tmam_metric_category::l1_backend_bound,
+        tmam_metric_category::coverage,
+        tmam_metric_category::packed,
+    });
+}
+
+/**
+ * check if the core PMU exports an event
+ * @param event name of event in sysfs
+ * @return true if exported by cpu (or cpu_core on hybrid CPUs)
+ */
+static bool core_pmu_has_event(const std::string& event) {
+    const std::filesystem::path devices = "/sys/bus/event_source/devices";
+    std::error_code ec;
+    return std::filesystem::exists(devices / "cpu" / "events" / event, ec) ||
+        std::filesystem::exists(devices / "cpu_core" / "events" / event, ec);
+}
+
+/**
+ * check that a backend can count on this system, by opening a source for the calling thread
+ * @param name of backend
+ * @param error receives reason if not
+ * @return true if a source could be opened
+ */
+static bool probe_tmam_backend(const std::string& name, std::string& error) {
+    try {
+        make_tmam_backend(name)->open(perf_tmam_config_t{}, 0, -1);
+        return true;
+    } catch (const std::exception& e) {
+        error = name + ": " + e.what();
+        return false;
+    }
+}
+
+std::string detect_tmam_backend() {
+    const cpu_id_t cpu = read_cpu_id();
+
+    // candidates, most detailed first
+    std::vector<std::string> candidates;
+    if ("GenuineIntel" == cpu.vendor) {
+        // the kernel exports the topdown events that PERF_METRICS supports on this CPU
+        // (more robust than listing models)
+        if (core_pmu_has_event("topdown-heavy-ops")) {
+            candidates.push_back("golden_cove");
+        } else if (core_pmu_has_event("topdown-retiring")) {
+            candidates.push_back("ice_lake");
+        } else if (0x6 == cpu.family && (is_intel_skylake_model(cpu.model) || is_intel_pre_skylake_model(cpu.model))) {
+            candidates.push_back("skylake");
+        }
+    } else if ("AuthenticAMD" == cpu.vendor) {
+        // Zen 4: Genoa (10h-1Fh), Raphael/Phoenix (60h-7Fh), Bergamo (A0h-AFh)
+        if (0x19 == cpu.family &&
+            ((0x10 <= cpu.model && cpu.model <= 0x1f) || (0x60 <= cpu.model && cpu.model <= 0x7f) ||
+             (0xa0 <= cpu.model && cpu.model <= 0xaf))) {
+            candidates.push_back("zen4");
+        }
+    }
+    candidates.push_back("generic");
+
+    // events may be unavailable (e.g. in VMs, or generic stall events not mapped by the PMU driver)
+    std::string errors;
+    for (const auto& candidate : candidates) {
+        std::string error;
+        if (probe_tmam_backend(candidate, error)) {
+            return candidate;
+        }
+        errors += (errors.empty() ? "" : "; ") + error;
+    }
+    throw std::runtime_error("no supported topdown backend on this CPU (" + errors + "), "
+                             "check perf_event_paranoid or select one with BACKEND");
+}
+
+std::unique_ptr<tmam_backend> make_tmam_backend(const std::string& name, const tmam_backend_options_t& options) {
+    const std::string selected = name.empty() ? detect_tmam_backend() : name;
+    tmam_metric_t::set_companion_names(options.companions);
+
+    std::unique_ptr<tmam_backend> backend;
+    if ("golden_cove" == selected) {
+        backend = std::make_unique<perf_metrics_backend>(true, options.level3, options.companions);
+    } else if ("ice_lake" == selected) {
+        backend = std::make_unique<perf_metrics_backend>(false, false, options.companions);
+    } else if ("zen4" == selected) {
+        backend = std::make_unique<multiplexed_backend>(make_zen4_backend());
+    } else if ("skylake" == selected) {
+        backend = std::make_unique<multiplexed_backend>(make_skylake_backend(read_cpu_id().model));
+    } else if ("generic" == selected) {
+        backend = std::make_unique<multiplexed_backend>(make_generic_backend());
+    } else if ("replay" == selected) {
+        backend = std::make_unique<replay_backend>(options.replay_path);
+    } else if ("synthetic" == selected) {
+        backend = std::make_unique<synthetic_backend>(options.companions.size());
+    } else {
+        throw std::invalid_argument("unknown backend: " + selected +
+                                    " (expected golden_cove, ice_lake, zen4, skylake, generic, replay or synthetic)");
+    }
+
+    if (!options.record_path.empty()) {
+        backend = std::make_unique<recording_backend>(std::move(backend), options.record_path);
+    }
+
+    return backend;
+}
@@ -0,0 +1,212 @@
+#include <companion.hpp>
+
+#include <array>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+extern "C" {
+#include <cpuid.h>
+#include <linux/perf_event.h>
+}
+
+/// sysfs directory listing all perf PMUs
+static const std::string pmu_sysfs_path = "/sys/bus/event_source/devices/";
+
+/// bit offset of the PMU type in the config of generic events (extended type, hybrid CPUs)
+static constexpr uint64_t perf_pmu_type_shift = 32;
+
+/**
+ * set value of a format term in perf config
+ * @param format format as in sysfs, e.g. "config:0-7" or "config1:0-15" or "config:0-7,32-35"
+ * @param value to set, distributed over the bit ranges (lowest bits first)
+ * @param event receives value
+ */
+static void apply_format(const std::string& format, uint64_t value, companion_event_t& event) {
+    const auto colon = format.find(':');
+    const std::string field = format.substr(0, colon);
+    uint64_t* target = nullptr;
+    if ("config" == field) {
+        target = &event.config;
+    } else if ("config1" == field) {
+        target = &event.config1;
+    } else {
+        throw std::invalid_argument("companion counter " + event.name + ": unsupported format " + format);
+    }
+
+    std::stringstream ranges(format.substr(colon + 1));
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        const auto dash = range.find('-');
+        const unsigned first = std::stoul(range.substr(0, dash));
+        const unsigned last = std::string::npos == dash ? first : std::stoul(range.substr(dash + 1));
+        const unsigned width = last - first + 1;
+        const uint64_t mask = 64 <= width ? ~0ull : (1ull << width) - 1;
+        *target |= (value & mask) << first;
+        value = 64 <= width ? 0 : value >> width;
+    }
+}
+
+/**
+ * resolve event exported by a PMU in sysfs (terms such as "event=0xc0,umask=0x01")
+ * @param spec name of event
+ * @param pmu_name PMU exporting the event
+ * @param event receives config, unchanged if not exported
+ * @return true if exported
+ */
+static bool parse_sysfs_event(const std::string& spec, const std::string& pmu_name, companion_event_t& event) {
+    std::ifstream event_file(pmu_sysfs_path + pmu_name + "/events/" + spec);
+    std::string terms;
+    if (!std::getline(event_file, terms)) {
+        return false;
+    }
+
+    std::stringstream ss(terms);
+    std::string term;
+    while (std::getline(ss, term, ',')) {
+        const auto equals = term.find('=');
+        const std::string key = term.substr(0, equals);
+        const uint64_t value = std::string::npos == equals ? 1 : std::stoull(term.substr(equals + 1), nullptr, 0);
+
+        std::ifstream format_file(pmu_sysfs_path + pmu_name + "/format/" + key);
+        std::string format;
+        if (!std::getline(format_file, format)) {
+            throw std::invalid_argument("companion counter " + spec + ": unknown term " + key);
+        }
+        apply_format(format, value, event);
+    }
+
+    return true;
+}
+
+companion_event_t parse_companion_event(const std::string& spec, const std::string& pmu_name, uint32_t pmu_type) {
+    companion_event_t event = {
+        .name = spec,
+        .type = pmu_type,
+    };
+
+    if (parse_sysfs_event(spec, pmu_name, event)) {
+        return event;
+    }
+
+    // raw code, as accepted by perf
+    if (2 <= spec.size() && 'r' == spec[0] && std::string::npos == spec.find_first_not_of("0123456789abcdefABCDEF", 1)) {
+        event.config = std::stoull(spec.substr(1), nullptr, 16);
+        return event;
+    }
+
+    // generic events (as perf), if not exported in sysfs
+    // (hybrid CPUs: extended type selects the PMU, see PERF_PMU_TYPE_SHIFT)
+    static const std::array<std::pair<const char*, uint64_t>, 8> hardware_events = {{
+        {"cycles", PERF_COUNT_HW_CPU_CYCLES},
+        {"cpu-cycles", PERF_COUNT_HW_CPU_CYCLES},
+        {"instructions", PERF_COUNT_HW_INSTRUCTIONS},
+        {"ref-cycles", PERF_COUNT_HW_REF_CPU_CYCLES},
+        {"branches", PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+        {"branch-misses", PERF_COUNT_HW_BRANCH_MISSES},
+        {"cache-references", PERF_COUNT_HW_CACHE_REFERENCES},
+        {"cache-misses", PERF_COUNT_HW_CACHE_MISSES},
+    }};
+    const uint64_t extended_type = PERF_TYPE_RAW == pmu_type ? 0 : static_cast<uint64_t>(pmu_type) << perf_pmu_type_shift;
+    for (const auto& [name, config] : hardware_events) {
+        if (name == spec) {
+            event.type = PERF_TYPE_HARDWARE;
+            event.config = extended_type | config;
+            return event;
+        }
+    }
+
+    const uint64_t llc = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8);
+    if ("LLC-loads" == spec) {
+        event.type = PERF_TYPE_HW_CACHE;
+        event.config = extended_type | llc | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16);
+    } else if ("LLC-misses" == spec) {
+        event.type = PERF_TYPE_HW_CACHE;
+        event.config = extended_type | llc | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    } else {
+        throw std::invalid_argument("unknown companion counter: " + spec +
+                                    " (expected event of " + pmu_sysfs_path + pmu_name + "/events, r<hex> or generic event as perf)");
+    }
+
+    return event;
+}
+
+/**
+ * fixed counter an event is counted on (Intel)
+ * @param event to examine
+ * @return index of fixed counter (0: instructions, 1: cycles, 2: reference cycles), -1 if general-purpose counter
+ */
+static int fixed_counter_of(const companion_event_t& event) {
+    if (PERF_TYPE_HARDWARE == event.type) {
+        switch (event.config & 0xffffffffull) {
+        case PERF_COUNT_HW_INSTRUCTIONS:
+            return 0;
+        case PERF_COUNT_HW_CPU_CYCLES:
+            return 1;
+        case PERF_COUNT_HW_REF_CPU_CYCLES:
+            return 2;
+        default:
+            return -1;
+        }
+    }
+    if (PERF_TYPE_HW_CACHE == event.type || 0 != event.config1) {
+        return -1;
+    }
+
+    // event codes the kernel assigns to fixed counters
+    switch (event.config) {
+    case 0x00c0: // INST_RETIRED.ANY
+        return 0;
+    case 0x003c: // CPU_CLK_UNHALTED.THREAD
+        return 1;
+    case 0x0300: // CPU_CLK_UNHALTED.REF_TSC
+        return 2;
+    default:
+        return -1;
+    }
+}
+
+std::size_t count_companion_gp_counters(const std::vector<companion_event_t>& events, bool fixed_cycles_available) {
+    std::array<bool, 3> fixed_used = {false, !fixed_cycles_available, false};
+    std::size_t gp_counters = 0;
+    for (const auto& event : events) {
+        const int fixed = fixed_counter_of(event);
+        if (0 <= fixed && !fixed_used[fixed]) {
+            fixed_used[fixed] = true;
+        } else {
+            gp_counters++;
+        }
+    }
+    return gp_counters;
+}
+
+unsigned read_gp_counter_count() {
+    unsigned int eax, ebx, ecx, edx;
+    if (0xa > __get_cpuid_max(0, nullptr) || !__get_cpuid(0xa, &eax, &ebx, &ecx, &edx) || 0 == (eax & 0xff)) {
+        // no architectural performance monitoring (e.g. AMD, some VMs)
+        return 0;
+    }
+    return (eax >> 8) & 0xff;
+}
+
+bool nmi_watchdog_enabled() {
+    std::ifstream watchdog_file("/proc/sys/kernel/nmi_watchdog");
+    int enabled = 0;
+    return (watchdog_file >> enabled) && 0 != enabled;
+}
+
+void check_companion_budget(const std::vector<companion_event_t>& events) {
+    const unsigned gp_counters = read_gp_counter_count();
+    if (0 == gp_counters) {
+        return;
+    }
+
+    const bool watchdog = nmi_watchdog_enabled();
+    const std::size_t needed = count_companion_gp_counters(events, !watchdog);
+    if (needed > gp_counters) {
+        throw std::runtime_error("companion counters need " + std::to_string(needed) + " general-purpose counters, only " +
+                                 std::to_string(gp_counters) + " available" +
+                                 (watchdog ? " (NMI watchdog takes the cycles counter)" : ""));
+    }
+}
@@ -0,0 +1,86 @@
+#include <function_profile.hpp>
+#include <metric.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <vector>
+
+extern "C" {
+#include <dlfcn.h>
+}
+
+#include <cxxabi.h>
+
+void function_profile::add(const perf_tmam_sample_t& sample, const perf_tmam_sample_t& previous) {
+    location_t& location = location_by_ip[sample.ip];
+    location.samples++;
+    location.time_ns += sample.time - previous.time;
+    location.tmam = location.tmam + (sample.data - previous.data);
+}
+
+std::string function_profile::resolve_function(uint64_t ip) {
+    // kernel addresses can not be resolved from user space
+    if (ip >= 0xffff800000000000ull) {
+        return "[kernel]";
+    }
+
+    Dl_info info;
+    if (0 == dladdr(reinterpret_cast<void*>(ip), &info)) {
+        std::stringstream ss;
+        ss << "0x" << std::hex << ip;
+        return ss.str();
+    }
+
+    if (nullptr != info.dli_sname) {
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        if (0 == status && nullptr != demangled) {
+            std::string name = demangled;
+            std::free(demangled);
+            return name;
+        }
+        return info.dli_sname;
+    }
+
+    // no (exported) symbol: object file + offset
+    std::stringstream ss;
+    ss << (nullptr != info.dli_fname ? info.dli_fname : "?")
+       << "+0x" << std::hex << (ip - reinterpret_cast<uint64_t>(info.dli_fbase));
+    return ss.str();
+}
+
+void function_profile::write_summary(std::ostream& out) const {
+    // merge locations into functions
+    std::map<std::string, location_t> location_by_function;
+    for (const auto& [ip, location] : location_by_ip) {
+        location_t& function = location_by_function[resolve_function(ip)];
+        function.samples += location.samples;
+        function.time_ns += location.time_ns;
+        function.tmam = function.tmam + location.tmam;
+    }
+
+    std::vector<std::pair<std::string, location_t>> functions(location_by_function.begin(), location_by_function.end());
+    std::sort(functions.begin(), functions.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.second.tmam.slots > rhs.second.tmam.slots;
+    });
+
+    // note: function names may contain ';' -> quote
+    out << "function;samples;time_s;" << perf_tmam_data_t::csv_header() << "l1_bottleneck;l2_bottleneck" << std::endl;
+    for (const auto& [name, function] : functions) {
+        std::string quoted = name;
+        for (std::size_t pos = 0; (pos = quoted.find('"', pos)) != std::string::npos; pos += 2) {
+            quoted.insert(pos, 1, '"');
+        }
+
+        out << '"' << quoted << '"' << ";"
+            << function.samples << ";"
+            << std::setprecision(6) << std::fixed << function.time_ns / 1e9 << ";"
+            << function.tmam.csv()
+            << tmam_metric_t(tmam_metric_t::get_l1_bottleneck(function.tmam)).get_name() << ";"
+            << tmam_metric_t(tmam_metric_t::get_l2_bottleneck(function.tmam)).get_name()
+            << std::endl;
+    }
+}
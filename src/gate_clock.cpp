@@ -0,0 +1,65 @@
+#include <gate_clock.hpp>
+
+#include <thread>
+
+extern "C" {
+#include <cpuid.h>
+}
+
+/// time spent calibrating the TSC against steady_clock, if its frequency is not enumerated
+static constexpr auto tsc_calibration_time = std::chrono::milliseconds(10);
+
+bool has_invariant_tsc() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return 0 != (edx & (1u << 8));
+}
+
+/**
+ * TSC frequency as enumerated by CPUID leaf 0x15 (Intel, Skylake & newer)
+ * @return ticks per microsecond, 0 if not enumerated (e.g. AMD, many VMs)
+ */
+static double tsc_ticks_per_us_from_cpuid() {
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0, nullptr) < 0x15 || !__get_cpuid(0x15, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+
+    // TSC = crystal clock (ECX, Hz) * EBX / EAX, any may be 0 if not enumerated
+    if (0 == eax || 0 == ebx || 0 == ecx) {
+        return 0;
+    }
+    return static_cast<double>(ecx) * ebx / eax / 1e6;
+}
+
+/**
+ * measure TSC frequency against steady_clock
+ * @return ticks per microsecond
+ */
+static double tsc_ticks_per_us_calibrated() {
+    const auto time_begin = std::chrono::steady_clock::now();
+    const uint64_t tsc_begin = __rdtsc();
+    std::this_thread::sleep_for(tsc_calibration_time);
+    const auto time_end = std::chrono::steady_clock::now();
+    const uint64_t tsc_end = __rdtsc();
+
+    const double passed_us = std::chrono::duration<double, std::micro>(time_end - time_begin).count();
+    return (tsc_end - tsc_begin) / passed_us;
+}
+
+gate_clock::gate_clock(bool use_tsc) {
+    if (!use_tsc || !has_invariant_tsc()) {
+        return;
+    }
+
+    double tsc_ticks_per_us = tsc_ticks_per_us_from_cpuid();
+    if (0 == tsc_ticks_per_us) {
+        tsc_ticks_per_us = tsc_ticks_per_us_calibrated();
+    }
+    if (0 < tsc_ticks_per_us) {
+        tsc = true;
+        ticks_per_us = tsc_ticks_per_us;
+    }
+}
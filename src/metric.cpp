@@ -1,9 +1,18 @@
 #include <metric.hpp>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
 #include <string>
 #include <map>
+#include <sstream>
 #include <stdexcept>
 
+extern "C" {
+#include <fnmatch.h>
+}
+
 const std::vector<tmam_metric_t> tmam_metric_t::all = {
     tmam_metric_t(tmam_metric_category::slots),
     tmam_metric_t(tmam_metric_category::l1_bottleneck),
@@ -20,9 +29,43 @@ const std::vector<tmam_metric_t> tmam_metric_t::all = {
     tmam_metric_t(tmam_metric_category::l2_fetch_bandwidth),
     tmam_metric_t(tmam_metric_category::l2_core_bound),
     tmam_metric_t(tmam_metric_category::l2_memory_bound),
+    tmam_metric_t(tmam_metric_category::core_type),
+    tmam_metric_t(tmam_metric_category::ecore_residency),
+    tmam_metric_t(tmam_metric_category::l3_divider),
+    tmam_metric_t(tmam_metric_category::l3_ports_utilization),
+    tmam_metric_t(tmam_metric_category::l3_l1_bound),
+    tmam_metric_t(tmam_metric_category::l3_l2_bound),
+    tmam_metric_t(tmam_metric_category::l3_l3_bound),
+    tmam_metric_t(tmam_metric_category::l3_dram_bound),
+    tmam_metric_t(tmam_metric_category::l3_store_bound),
+    tmam_metric_t(tmam_metric_category::coverage),
+    tmam_metric_t(tmam_metric_category::companion_0),
+    tmam_metric_t(tmam_metric_category::companion_1),
+    tmam_metric_t(tmam_metric_category::companion_2),
+    tmam_metric_t(tmam_metric_category::companion_3),
+    tmam_metric_t(tmam_metric_category::packed),
+    tmam_metric_t(tmam_metric_category::interval),
+    tmam_metric_t(tmam_metric_category::phase),
 };
 
+/// names of companion counters, see tmam_metric_t::set_companion_names()
+static std::array<std::string, perf_tmam_companion_max> companion_names;
+
+void tmam_metric_t::set_companion_names(const std::vector<std::string>& names) {
+    if (perf_tmam_companion_max < names.size()) {
+        throw std::invalid_argument("at most " + std::to_string(perf_tmam_companion_max) + " companion counters supported");
+    }
+    for (std::size_t i = 0; i < perf_tmam_companion_max; i++) {
+        companion_names[i] = i < names.size() ? names[i] : std::to_string(i);
+    }
+}
+
 std::string tmam_metric_t::get_name() const {
+    if (is_companion()) {
+        const std::string& name = companion_names[get_companion_number()];
+        return "topdown-companion-" + (name.empty() ? std::to_string(get_companion_number()) : name);
+    }
+
     const std::map<tmam_metric_category, std::string> name_by_metric = {
         {tmam_metric_category::slots, "slots"},
         {tmam_metric_category::l1_bottleneck, "l1-bottleneck"},
@@ -39,12 +82,31 @@ std::string tmam_metric_t::get_name() const {
         {tmam_metric_category::l2_fetch_bandwidth, "l2-fetch-bandwidth"},
         {tmam_metric_category::l2_core_bound, "l2-core-bound"},
         {tmam_metric_category::l2_memory_bound, "l2-memory-bound"},
+        {tmam_metric_category::core_type, "core-type"},
+        {tmam_metric_category::ecore_residency, "ecore-residency"},
+        {tmam_metric_category::l3_divider, "l3-divider"},
+        {tmam_metric_category::l3_ports_utilization, "l3-ports-utilization"},
+        {tmam_metric_category::l3_l1_bound, "l3-l1-bound"},
+        {tmam_metric_category::l3_l2_bound, "l3-l2-bound"},
+        {tmam_metric_category::l3_l3_bound, "l3-l3-bound"},
+        {tmam_metric_category::l3_dram_bound, "l3-dram-bound"},
+        {tmam_metric_category::l3_store_bound, "l3-store-bound"},
+        {tmam_metric_category::coverage, "coverage"},
+        {tmam_metric_category::packed, "packed"},
+        {tmam_metric_category::interval, "interval"},
+        {tmam_metric_category::phase, "phase"},
     };
 
     return "topdown-" + name_by_metric.at(category);
 }
 
 std::string tmam_metric_t::get_description() const {
+    if (is_companion()) {
+        const std::string& name = companion_names[get_companion_number()];
+        return "companion counter " + (name.empty() ? std::to_string(get_companion_number()) : name) +
+            " (events, same interval as all other metrics)";
+    }
+
     const std::map<tmam_metric_category, std::string> description_by_metric = {
         {
             tmam_metric_category::slots,
@@ -106,6 +168,58 @@ std::string tmam_metric_t::get_description() const {
             tmam_metric_category::l2_memory_bound,
             "bound by memory (includes caches, external mem etc.)"
         },
+        {
+            tmam_metric_category::core_type,
+            "core type executed on (0: P-core, 1: E-core, 2: both)"
+        },
+        {
+            tmam_metric_category::ecore_residency,
+            "fraction of time executed on E-cores"
+        },
+        {
+            tmam_metric_category::l3_divider,
+            "cycles the divider unit was active (fraction of cycles)"
+        },
+        {
+            tmam_metric_category::l3_ports_utilization,
+            "cycles with few execution ports utilized (fraction of cycles)"
+        },
+        {
+            tmam_metric_category::l3_l1_bound,
+            "cycles stalled on loads hitting the L1 cache (fraction of cycles)"
+        },
+        {
+            tmam_metric_category::l3_l2_bound,
+            "cycles stalled on loads hitting the L2 cache (fraction of cycles)"
+        },
+        {
+            tmam_metric_category::l3_l3_bound,
+            "cycles stalled on loads hitting the L3 cache (fraction of cycles)"
+        },
+        {
+            tmam_metric_category::l3_dram_bound,
+            "cycles stalled on loads missing all caches (fraction of cycles)"
+        },
+        {
+            tmam_metric_category::l3_store_bound,
+            "cycles stalled on stores (fraction of cycles)"
+        },
+        {
+            tmam_metric_category::coverage,
+            "fraction of time the counters have been counting (less than 1 if multiplexed)"
+        },
+        {
+            tmam_metric_category::packed,
+            "level 1 & 2 breakdown, 8 bit fraction of slots per category (see README)"
+        },
+        {
+            tmam_metric_category::interval,
+            "length of the interval the values describe (effective sampling interval)"
+        },
+        {
+            tmam_metric_category::phase,
+            "id of the phase (stable breakdown) the interval belongs to, incremented on every detected change"
+        },
     };
 
     return description_by_metric.at(category);
@@ -117,9 +231,7 @@ scorep::plugin::metric_property tmam_metric_t::get_metric_property() const {
     mp.mode = SCOREP_METRIC_MODE_ABSOLUTE_LAST;
 
     // type: all are fractions (of 1), except slots (#) and bottleneck (category enum)
-    if (tmam_metric_category::l1_bottleneck == category ||
-        tmam_metric_category::l2_bottleneck == category ||
-        tmam_metric_category::slots == category) {
+    if (is_integral()) {
         mp.type = SCOREP_METRIC_VALUE_UINT64;
     } else {
         mp.type = SCOREP_METRIC_VALUE_DOUBLE;
@@ -129,19 +241,82 @@ scorep::plugin::metric_property tmam_metric_t::get_metric_property() const {
     if (tmam_metric_category::l1_bottleneck == category ||
         tmam_metric_category::l2_bottleneck == category) {
         mp.unit = "TMAM category";
-    } else if (tmam_metric_category::slots == category) {
+    } else if (tmam_metric_category::slots == category || is_companion()) {
         mp.unit = "#";
+    } else if (tmam_metric_category::core_type == category) {
+        mp.unit = "core type";
+    } else if (tmam_metric_category::packed == category) {
+        mp.unit = "packed TMAM fractions";
+    } else if (tmam_metric_category::interval == category) {
+        mp.unit = "us";
+    } else if (tmam_metric_category::phase == category) {
+        mp.unit = "phase id";
     }
 
     return mp;
 }
 
+std::string tmam_metric_t::get_accumulated_name() const {
+    // topdown-<name> -> topdown-acc-<name>
+    return "topdown-acc-" + get_name().substr(std::string("topdown-").size());
+}
+
+scorep::plugin::metric_property tmam_metric_t::get_accumulated_metric_property() const {
+    scorep::plugin::metric_property mp(get_accumulated_name(), get_description() + " (accumulated)", "#");
+
+    // Score-P computes the difference between enter & exit, i.e. inclusive/exclusive slots per region
+    mp.mode = SCOREP_METRIC_MODE_ACCUMULATED_START;
+    mp.type = SCOREP_METRIC_VALUE_UINT64;
+
+    return mp;
+}
+
 bool operator<(const tmam_metric_t& lhs, const tmam_metric_t& rhs) {
     return lhs.category < rhs.category;
 }
 
+bool tmam_metric_matches(const std::string& pattern, const std::string& name, bool explicit_only) {
+    static const std::string prefix = "topdown-";
+    const std::string short_name = 0 == name.rfind(prefix, 0) ? name.substr(prefix.size()) : name;
+
+    std::stringstream ss(pattern);
+    std::string token;
+    while (std::getline(ss, token, ',')) {
+        const auto first = token.find_first_not_of(" \t");
+        if (std::string::npos == first) {
+            continue;
+        }
+        token = token.substr(first, token.find_last_not_of(" \t") - first + 1);
+        if (explicit_only) {
+            if (token == name || token == short_name) {
+                return true;
+            }
+        } else if (0 == fnmatch(token.c_str(), name.c_str(), 0) || 0 == fnmatch(token.c_str(), short_name.c_str(), 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void tmam_restrict_config(perf_tmam_config_t& config, uint64_t mask) {
+    bool level2 = false;
+    bool level3 = false;
+    for (const auto& metric : tmam_metric_t::all) {
+        if (0 != (mask & (1ull << metric.index))) {
+            level2 |= metric.needs_level2();
+            level3 |= metric.is_level3();
+        }
+    }
+    config.level2 = config.level2 && level2;
+    config.level3 = config.level3 && level3;
+}
+
 
 uint64_t tmam_metric_t::extract_tmam_field(const perf_tmam_data_t& tmam) const {
+    return extract_tmam_field(category, tmam);
+}
+
+uint64_t tmam_metric_t::extract_tmam_field(tmam_metric_category category, const perf_tmam_data_t& tmam) {
     switch(category) {
     case tmam_metric_category::slots:
         return tmam.slots;
@@ -149,6 +324,10 @@ uint64_t tmam_metric_t::extract_tmam_field(const perf_tmam_data_t& tmam) const {
         return static_cast<uint64_t>(get_l1_bottleneck(tmam));
     case tmam_metric_category::l2_bottleneck:
         return static_cast<uint64_t>(get_l2_bottleneck(tmam));
+    case tmam_metric_category::core_type:
+        return static_cast<uint64_t>(get_core_type(tmam));
+    case tmam_metric_category::ecore_residency:
+        return tmam.time_ecore;
     case tmam_metric_category::l1_retiring:
         return tmam.retiring;
     case tmam_metric_category::l1_bad_speculation:
@@ -158,28 +337,56 @@ uint64_t tmam_metric_t::extract_tmam_field(const perf_tmam_data_t& tmam) const {
     case tmam_metric_category::l1_backend_bound:
         return tmam.be_bound;
     case tmam_metric_category::l2_light_ops:
-        return tmam.retiring - tmam.heavy_ops;
+        return tmam.retiring - tmam.ecore_retiring - tmam.heavy_ops;
     case tmam_metric_category::l2_heavy_ops:
         return tmam.heavy_ops;
     case tmam_metric_category::l2_branch_misprediction:
         return tmam.br_mispredict;
     case tmam_metric_category::l2_machine_clear:
-        return tmam.bad_spec - tmam.br_mispredict;
+        return tmam.bad_spec - tmam.ecore_bad_spec - tmam.br_mispredict;
     case tmam_metric_category::l2_fetch_latency:
         return tmam.fetch_lat;
     case tmam_metric_category::l2_fetch_bandwidth:
-        return tmam.fe_bound - tmam.fetch_lat;
+        return tmam.fe_bound - tmam.ecore_fe_bound - tmam.fetch_lat;
     case tmam_metric_category::l2_core_bound:
-        return tmam.be_bound - tmam.mem_bound;
+        return tmam.be_bound - tmam.ecore_be_bound - tmam.mem_bound;
     case tmam_metric_category::l2_memory_bound:
         return tmam.mem_bound;
+    case tmam_metric_category::l3_divider:
+        return tmam.divider;
+    case tmam_metric_category::l3_ports_utilization:
+        return tmam.ports_util;
+    case tmam_metric_category::l3_l1_bound:
+        return tmam.l1_bound;
+    case tmam_metric_category::l3_l2_bound:
+        return tmam.l2_bound;
+    case tmam_metric_category::l3_l3_bound:
+        return tmam.l3_bound;
+    case tmam_metric_category::l3_dram_bound:
+        return tmam.dram_bound;
+    case tmam_metric_category::l3_store_bound:
+        return tmam.store_bound;
+    case tmam_metric_category::coverage:
+        return tmam.time_running;
+    case tmam_metric_category::companion_0:
+    case tmam_metric_category::companion_1:
+    case tmam_metric_category::companion_2:
+    case tmam_metric_category::companion_3:
+        return tmam.companion[tmam_metric_t(category).get_companion_number()];
+    case tmam_metric_category::packed:
+        return tmam_pack_breakdown(tmam);
+    case tmam_metric_category::interval:
+    case tmam_metric_category::phase:
+        // not a counter
+        return 0;
     }
 
     throw std::runtime_error("unkown tmam category encountered: " + std::to_string(static_cast<uint64_t>(category)));
 }
 
 tmam_metric_category tmam_metric_t::get_l2_bottleneck(const perf_tmam_data_t& tmam) {
-    const std::vector<tmam_metric_category> lvl2_categories = {
+    // static array: called per sample, must not allocate
+    static constexpr std::array lvl2_categories = {
         // ignore retiring, this is not a bottleneck!
         // (to be fair it can be when not using vector instructions etc., but it is typically not)
         tmam_metric_category::l2_branch_misprediction,
@@ -194,7 +401,7 @@ tmam_metric_category tmam_metric_t::get_l2_bottleneck(const perf_tmam_data_t& tm
     tmam_metric_category top_category = tmam_metric_category::l2_light_ops;
 
     for (const auto category : lvl2_categories) {
-        uint64_t slots = tmam_metric_t(category).extract_tmam_field(tmam);
+        uint64_t slots = extract_tmam_field(category, tmam);
         if (slots > top_slots) {
             top_slots = slots;
             top_category = category;
@@ -205,7 +412,8 @@ tmam_metric_category tmam_metric_t::get_l2_bottleneck(const perf_tmam_data_t& tm
 }
 
 tmam_metric_category tmam_metric_t::get_l1_bottleneck(const perf_tmam_data_t& tmam) {
-    const std::vector<tmam_metric_category> lvl2_categories = {
+    // static array: called per sample, must not allocate
+    static constexpr std::array lvl1_categories = {
         // ignore retiring, this is not a bottleneck!
         // (to be fair it can be when not using vector instructions etc., but it is typically not)
         tmam_metric_category::l1_bad_speculation,
@@ -216,8 +424,8 @@ tmam_metric_category tmam_metric_t::get_l1_bottleneck(const perf_tmam_data_t& tm
     uint64_t top_slots = 0;
     tmam_metric_category top_category = tmam_metric_category::l1_retiring;
 
-    for (const auto category : lvl2_categories) {
-        uint64_t slots = tmam_metric_t(category).extract_tmam_field(tmam);
+    for (const auto category : lvl1_categories) {
+        uint64_t slots = extract_tmam_field(category, tmam);
         if (slots > top_slots) {
             top_slots = slots;
             top_category = category;
@@ -227,6 +435,204 @@ tmam_metric_category tmam_metric_t::get_l1_bottleneck(const perf_tmam_data_t& tm
     return top_category;
 }
 
-tmam_metric_t::tmam_metric_t (tmam_metric_category category) : category(category){
+tmam_core_type tmam_metric_t::get_core_type(const perf_tmam_data_t& tmam) {
+    if (0 == tmam.ecore_slots) {
+        return tmam_core_type::p_core;
+    } else if (tmam.slots == tmam.ecore_slots) {
+        return tmam_core_type::e_core;
+    }
+    return tmam_core_type::mixed;
+}
+
+double tmam_metric_t::get_coverage(const perf_tmam_data_t& tmam) {
+    if (0 == tmam.time_enabled) {
+        return 1.0;
+    }
+    // hybrid CPUs: times of both groups are not read atomically -> clamp
+    return std::min(1.0, static_cast<double>(tmam.time_running) / static_cast<double>(tmam.time_enabled));
+}
+
+void tmam_metric_values_t::derive(const perf_tmam_data_t& delta, uint64_t mask) {
+    const auto selected = [mask](tmam_metric_category category) {
+        return 0 != (mask & (1ull << tmam_metric_index(category)));
+    };
+
+    // all l1/l2 categories: reported as fraction of slots
+    // (on hybrid CPUs: l1 of all slots, l2 of P-core slots, E-cores do not provide l2)
+    static constexpr std::array l1_categories = {
+        tmam_metric_category::l1_retiring,
+        tmam_metric_category::l1_bad_speculation,
+        tmam_metric_category::l1_frontend_bound,
+        tmam_metric_category::l1_backend_bound,
+    };
+    static constexpr std::array l2_categories = {
+        tmam_metric_category::l2_light_ops,
+        tmam_metric_category::l2_heavy_ops,
+        tmam_metric_category::l2_branch_misprediction,
+        tmam_metric_category::l2_machine_clear,
+        tmam_metric_category::l2_fetch_latency,
+        tmam_metric_category::l2_fetch_bandwidth,
+        tmam_metric_category::l2_core_bound,
+        tmam_metric_category::l2_memory_bound,
+    };
+
+    const double slots = static_cast<double>(delta.slots);
+    for (const auto category : l1_categories) {
+        if (selected(category)) {
+            by_index[tmam_metric_index(category)].f64 =
+                static_cast<double>(tmam_metric_t::extract_tmam_field(category, delta)) / slots;
+        }
+    }
+
+    // interval spent on E-cores only: no l2 available, report 0 instead of NaN
+    const uint64_t core_slots = delta.slots - delta.ecore_slots;
+    for (const auto category : l2_categories) {
+        if (selected(category)) {
+            by_index[tmam_metric_index(category)].f64 = 0 == core_slots && 0 != delta.ecore_slots ? 0.0 :
+                static_cast<double>(tmam_metric_t::extract_tmam_field(category, delta)) / static_cast<double>(core_slots);
+        }
+    }
+
+    // l3: stall cycles as fraction of the cycles counted by the same (multiplexed) group
+    static constexpr std::array l3_core_categories = {
+        tmam_metric_category::l3_divider,
+        tmam_metric_category::l3_ports_utilization,
+    };
+    static constexpr std::array l3_mem_categories = {
+        tmam_metric_category::l3_l1_bound,
+        tmam_metric_category::l3_l2_bound,
+        tmam_metric_category::l3_l3_bound,
+        tmam_metric_category::l3_dram_bound,
+        tmam_metric_category::l3_store_bound,
+    };
+    for (const auto category : l3_core_categories) {
+        if (selected(category)) {
+            by_index[tmam_metric_index(category)].f64 = 0 == delta.l3_core_cycles ? 0.0 :
+                static_cast<double>(tmam_metric_t::extract_tmam_field(category, delta)) / static_cast<double>(delta.l3_core_cycles);
+        }
+    }
+    for (const auto category : l3_mem_categories) {
+        if (selected(category)) {
+            by_index[tmam_metric_index(category)].f64 = 0 == delta.l3_mem_cycles ? 0.0 :
+                static_cast<double>(tmam_metric_t::extract_tmam_field(category, delta)) / static_cast<double>(delta.l3_mem_cycles);
+        }
+    }
+
+    if (selected(tmam_metric_category::coverage)) {
+        by_index[tmam_metric_index(tmam_metric_category::coverage)].f64 = tmam_metric_t::get_coverage(delta);
+    }
+
+    if (selected(tmam_metric_category::core_type)) {
+        by_index[tmam_metric_index(tmam_metric_category::core_type)].u64 =
+            static_cast<uint64_t>(tmam_metric_t::get_core_type(delta));
+    }
+    if (selected(tmam_metric_category::ecore_residency)) {
+        by_index[tmam_metric_index(tmam_metric_category::ecore_residency)].f64 = 0 == delta.time_enabled ? 0.0 :
+            static_cast<double>(delta.time_ecore) / static_cast<double>(delta.time_enabled);
+    }
+
+    // slots & companions are reported as-is (cheap, no selection check)
+    by_index[tmam_metric_index(tmam_metric_category::slots)].u64 = delta.slots;
+    for (std::size_t i = 0; i < perf_tmam_companion_max; i++) {
+        by_index[tmam_metric_index(tmam_metric_category::companion_0) + i].u64 = delta.companion[i];
+    }
+
+    if (selected(tmam_metric_category::packed)) {
+        by_index[tmam_metric_index(tmam_metric_category::packed)].u64 = tmam_pack_breakdown(delta);
+    }
+
+    // bottlenecks compare all fractions of their level
+    if (selected(tmam_metric_category::l1_bottleneck)) {
+        by_index[tmam_metric_index(tmam_metric_category::l1_bottleneck)].u64 =
+            static_cast<uint64_t>(tmam_metric_t::get_l1_bottleneck(delta));
+    }
+    if (selected(tmam_metric_category::l2_bottleneck)) {
+        by_index[tmam_metric_index(tmam_metric_category::l2_bottleneck)].u64 =
+            static_cast<uint64_t>(tmam_metric_t::get_l2_bottleneck(delta));
+    }
+}
+
+/// bit offsets of the counts in a packed breakdown, in order of perf_tmam_data_t (retiring..mem_bound)
+static constexpr std::array<int, 8> packed_offsets = {0, 8, 16, 24, 32, 40, 48, 56};
+
+uint64_t tmam_pack_breakdown(const perf_tmam_data_t& delta) {
+    const std::array<uint64_t, 8> counts = {
+        delta.retiring, delta.bad_spec, delta.fe_bound, delta.be_bound,
+        delta.heavy_ops, delta.br_mispredict, delta.fetch_lat, delta.mem_bound,
+    };
+    const uint64_t core_slots = delta.slots - delta.ecore_slots;
+
+    uint64_t packed = 0;
+    for (std::size_t i = 0; i < counts.size(); i++) {
+        // level 1 of all slots, level 2 of P-core slots
+        const uint64_t slots = 4 > i ? delta.slots : core_slots;
+        if (0 == slots) {
+            continue;
+        }
+        const uint64_t fraction = std::min<uint64_t>(0xff, (counts[i] * 0xff + slots / 2) / slots);
+        packed |= fraction << packed_offsets[i];
+    }
+    return packed;
+}
+
+perf_tmam_data_t tmam_unpack_breakdown(uint64_t packed, uint64_t slots) {
+    // same scaling as the rdpmc readout of PERF_METRICS
+    const auto unpack = [&](std::size_t i) { return ((packed >> packed_offsets[i]) & 0xff) * slots / 0xff; };
+
+    perf_tmam_data_t tmam;
+    tmam.slots = slots;
+    tmam.retiring = unpack(0);
+    tmam.bad_spec = unpack(1);
+    tmam.fe_bound = unpack(2);
+    tmam.be_bound = unpack(3);
+    // level 2 parts never exceed their parent (rounding), derived categories must not wrap around
+    tmam.heavy_ops = std::min(unpack(4), tmam.retiring);
+    tmam.br_mispredict = std::min(unpack(5), tmam.bad_spec);
+    tmam.fetch_lat = std::min(unpack(6), tmam.fe_bound);
+    tmam.mem_bound = std::min(unpack(7), tmam.be_bound);
+    return tmam;
+}
+
+tmam_deadband_t::tmam_deadband_t(double l1, double l2, double l3, double other) {
+    for (const auto& metric : tmam_metric_t::all) {
+        double& epsilon = epsilon_by_metric[metric.index];
+        if (tmam_metric_category::slots == metric.category || tmam_metric_category::packed == metric.category ||
+            metric.is_companion() || (metric.is_plugin_only() && !metric.is_integral())) {
+            epsilon = std::numeric_limits<double>::infinity();
+        } else if (metric.is_integral()) {
+            epsilon = 0;
+        } else if (metric.is_level3()) {
+            epsilon = l3;
+        } else if (metric.needs_level2()) {
+            epsilon = l2;
+        } else if (metric.category <= tmam_metric_category::l1_backend_bound) {
+            epsilon = l1;
+        } else {
+            epsilon = other;
+        }
+    }
+}
+
+bool tmam_deadband_t::exceeded(const tmam_metric_values_t& latest, const tmam_metric_values_t& reported, uint64_t mask) const {
+    for (const auto& metric : tmam_metric_t::all) {
+        const double epsilon = epsilon_by_metric[metric.index];
+        if (0 == (mask & (1ull << metric.index)) || std::isinf(epsilon)) {
+            continue;
+        }
+
+        const tmam_metric_value_t a = latest.by_index[metric.index];
+        const tmam_metric_value_t b = reported.by_index[metric.index];
+        if (metric.is_integral()) {
+            if (a.u64 != b.u64) {
+                return true;
+            }
+        } else if (std::isnan(a.f64) != std::isnan(b.f64) || std::abs(a.f64 - b.f64) > epsilon) {
+            return true;
+        }
+    }
+    return false;
+}
+
+tmam_metric_t::tmam_metric_t (tmam_metric_category category) : category(category), index(tmam_metric_index(category)) {
     // nop
 }
@@ -0,0 +1,401 @@
+#include <metric_batch.hpp>
+
+#include <stdexcept>
+
+extern "C" {
+#include <immintrin.h>
+}
+
+void tmam_sample_batch_t::reserve(std::size_t samples) {
+    for (auto* field : {&slots, &retiring, &bad_spec, &fe_bound, &be_bound, &heavy_ops, &br_mispredict, &fetch_lat,
+                        &mem_bound, &ecore_slots, &ecore_retiring, &ecore_bad_spec, &ecore_fe_bound, &ecore_be_bound}) {
+        field->reserve(samples);
+    }
+}
+
+void tmam_sample_batch_t::push_back(const perf_tmam_data_t& sample) {
+    slots.push_back(sample.slots);
+    retiring.push_back(sample.retiring);
+    bad_spec.push_back(sample.bad_spec);
+    fe_bound.push_back(sample.fe_bound);
+    be_bound.push_back(sample.be_bound);
+    heavy_ops.push_back(sample.heavy_ops);
+    br_mispredict.push_back(sample.br_mispredict);
+    fetch_lat.push_back(sample.fetch_lat);
+    mem_bound.push_back(sample.mem_bound);
+    ecore_slots.push_back(sample.ecore_slots);
+    ecore_retiring.push_back(sample.ecore_retiring);
+    ecore_bad_spec.push_back(sample.ecore_bad_spec);
+    ecore_fe_bound.push_back(sample.ecore_fe_bound);
+    ecore_be_bound.push_back(sample.ecore_be_bound);
+}
+
+void tmam_sample_batch_t::clear() {
+    for (auto* field : {&slots, &retiring, &bad_spec, &fe_bound, &be_bound, &heavy_ops, &br_mispredict, &fetch_lat,
+                        &mem_bound, &ecore_slots, &ecore_retiring, &ecore_bad_spec, &ecore_fe_bound, &ecore_be_bound}) {
+        field->clear();
+    }
+}
+
+void tmam_batch_values_t::resize(std::size_t intervals) {
+    for (auto& fraction : fractions) {
+        fraction.resize(intervals);
+    }
+    slots.resize(intervals);
+    l1_bottleneck.resize(intervals);
+    l2_bottleneck.resize(intervals);
+}
+
+tmam_metric_value_t tmam_batch_values_t::get(tmam_metric_category category, std::size_t interval) const {
+    tmam_metric_value_t value;
+    switch (category) {
+    case tmam_metric_category::slots:
+        value.u64 = slots[interval];
+        break;
+    case tmam_metric_category::l1_bottleneck:
+        value.u64 = l1_bottleneck[interval];
+        break;
+    case tmam_metric_category::l2_bottleneck:
+        value.u64 = l2_bottleneck[interval];
+        break;
+    default:
+        if (!covers(category)) {
+            throw std::runtime_error("category not derived by derive_batch(): " +
+                                     std::to_string(static_cast<uint64_t>(category)));
+        }
+        value.f64 = fractions[tmam_metric_index(category)][interval];
+    }
+    return value;
+}
+
+tmam_batch_isa detect_tmam_batch_isa() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) {
+        return tmam_batch_isa::avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return tmam_batch_isa::avx2;
+    }
+    return tmam_batch_isa::scalar;
+}
+
+std::string to_string(tmam_batch_isa isa) {
+    switch (isa) {
+    case tmam_batch_isa::scalar:
+        return "scalar";
+    case tmam_batch_isa::avx2:
+        return "avx2";
+    case tmam_batch_isa::avx512:
+        return "avx512";
+    }
+    return "unknown";
+}
+
+namespace {
+
+/// raw arrays of a batch and its (already resized) values, as accessed by the kernels
+struct batch_arrays_t {
+    const uint64_t* slots;
+    const uint64_t* retiring;
+    const uint64_t* bad_spec;
+    const uint64_t* fe_bound;
+    const uint64_t* be_bound;
+    const uint64_t* heavy_ops;
+    const uint64_t* br_mispredict;
+    const uint64_t* fetch_lat;
+    const uint64_t* mem_bound;
+    const uint64_t* ecore_slots;
+    const uint64_t* ecore_retiring;
+    const uint64_t* ecore_bad_spec;
+    const uint64_t* ecore_fe_bound;
+    const uint64_t* ecore_be_bound;
+
+    /// output fractions, indexed by category number
+    std::array<double*, tmam_batch_fraction_count> fractions;
+    uint64_t* out_slots;
+    uint64_t* l1_bottleneck;
+    uint64_t* l2_bottleneck;
+};
+
+constexpr uint64_t category_number(tmam_metric_category category) {
+    return static_cast<uint64_t>(category);
+}
+
+/**
+ * scalar kernel, reference for the vectorized ones
+ *
+ * Same arithmetic as tmam_metric_t::extract_tmam_field() & tmam_metric_values_t::derive()
+ * (incl. wrap-around of l2 categories computed as differences & bottleneck tie-breaking).
+ * @param a arrays of batch
+ * @param begin first interval
+ * @param end last interval (exclusive)
+ */
+void derive_scalar(const batch_arrays_t& a, std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; i++) {
+        const auto delta = [i](const uint64_t* field) { return field[i + 1] - field[i]; };
+
+        const uint64_t slots = delta(a.slots);
+        const uint64_t retiring = delta(a.retiring);
+        const uint64_t bad_spec = delta(a.bad_spec);
+        const uint64_t fe_bound = delta(a.fe_bound);
+        const uint64_t be_bound = delta(a.be_bound);
+        const uint64_t heavy_ops = delta(a.heavy_ops);
+        const uint64_t br_mispredict = delta(a.br_mispredict);
+        const uint64_t fetch_lat = delta(a.fetch_lat);
+        const uint64_t mem_bound = delta(a.mem_bound);
+        const uint64_t ecore_slots = delta(a.ecore_slots);
+
+        const std::array<uint64_t, tmam_batch_fraction_count> categories = {
+            retiring,
+            bad_spec,
+            fe_bound,
+            be_bound,
+            retiring - delta(a.ecore_retiring) - heavy_ops,
+            heavy_ops,
+            br_mispredict,
+            bad_spec - delta(a.ecore_bad_spec) - br_mispredict,
+            fetch_lat,
+            fe_bound - delta(a.ecore_fe_bound) - fetch_lat,
+            be_bound - delta(a.ecore_be_bound) - mem_bound,
+            mem_bound,
+        };
+
+        // level 1 of all slots, level 2 of P-core slots (0 if spent on E-cores only)
+        const uint64_t core_slots = slots - ecore_slots;
+        const bool no_l2 = 0 == core_slots && 0 != ecore_slots;
+        for (std::size_t c = 0; c < 4; c++) {
+            a.fractions[c][i] = static_cast<double>(categories[c]) / static_cast<double>(slots);
+        }
+        for (std::size_t c = 4; c < tmam_batch_fraction_count; c++) {
+            a.fractions[c][i] = no_l2 ? 0.0 : static_cast<double>(categories[c]) / static_cast<double>(core_slots);
+        }
+
+        a.out_slots[i] = slots;
+
+        // retiring (light/heavy ops) if all others are 0, first wins on ties
+        uint64_t top = 0;
+        uint64_t top_category = category_number(tmam_metric_category::l1_retiring);
+        for (std::size_t c = 1; c < 4; c++) {
+            if (categories[c] > top) {
+                top = categories[c];
+                top_category = c;
+            }
+        }
+        a.l1_bottleneck[i] = top_category;
+
+        top = 0;
+        top_category = category_number(tmam_metric_category::l2_light_ops);
+        for (std::size_t c = 6; c < tmam_batch_fraction_count; c++) {
+            if (categories[c] > top) {
+                top = categories[c];
+                top_category = c;
+            }
+        }
+        a.l2_bottleneck[i] = top_category;
+    }
+}
+
+/// exact conversion of 4 uint64 to double (AVX2 only converts signed 32 bit integers)
+__attribute__((target("avx2")))
+inline __m256d avx2_to_double(__m256i x) {
+    // high & low 32 bit halves into the mantissa of 2^84 and 2^52, respectively:
+    // (2^84 + hi * 2^32) - (2^84 + 2^52) + (2^52 + lo), the only rounding is in the final addition
+    const __m256i hi = _mm256_or_si256(_mm256_srli_epi64(x, 32), _mm256_castpd_si256(_mm256_set1_pd(0x1p84)));
+    const __m256i lo = _mm256_blend_epi32(x, _mm256_castpd_si256(_mm256_set1_pd(0x1p52)), 0xaa);
+    const __m256d hi_minus_offset = _mm256_sub_pd(_mm256_castsi256_pd(hi), _mm256_set1_pd(0x1p84 + 0x1p52));
+    return _mm256_add_pd(hi_minus_offset, _mm256_castsi256_pd(lo));
+}
+
+/// delta of 4 consecutive intervals of a field, starting at interval i
+__attribute__((target("avx2")))
+inline __m256i avx2_delta(const uint64_t* field, std::size_t i) {
+    return _mm256_sub_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(field + i + 1)),
+                            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(field + i)));
+}
+
+/// update running unsigned maximum (top, stored sign-flipped) & its category with 4 candidates
+__attribute__((target("avx2")))
+inline void avx2_argmax_step(__m256i value, uint64_t category, __m256i& top, __m256i& top_category) {
+    // AVX2 only compares signed: flip sign bit
+    const __m256i flipped = _mm256_xor_si256(value, _mm256_set1_epi64x(INT64_MIN));
+    const __m256i greater = _mm256_cmpgt_epi64(flipped, top);
+    top = _mm256_blendv_epi8(top, flipped, greater);
+    top_category = _mm256_blendv_epi8(top_category, _mm256_set1_epi64x(category), greater);
+}
+
+/// AVX2 kernel, 4 intervals per iteration, (end - begin) must be a multiple of 4
+__attribute__((target("avx2")))
+void derive_avx2(const batch_arrays_t& a, std::size_t begin, std::size_t end) {
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (std::size_t i = begin; i < end; i += 4) {
+
+        const __m256i slots = avx2_delta(a.slots, i);
+        const __m256i retiring = avx2_delta(a.retiring, i);
+        const __m256i bad_spec = avx2_delta(a.bad_spec, i);
+        const __m256i fe_bound = avx2_delta(a.fe_bound, i);
+        const __m256i be_bound = avx2_delta(a.be_bound, i);
+        const __m256i heavy_ops = avx2_delta(a.heavy_ops, i);
+        const __m256i br_mispredict = avx2_delta(a.br_mispredict, i);
+        const __m256i fetch_lat = avx2_delta(a.fetch_lat, i);
+        const __m256i mem_bound = avx2_delta(a.mem_bound, i);
+        const __m256i ecore_slots = avx2_delta(a.ecore_slots, i);
+
+        const __m256i categories[tmam_batch_fraction_count] = {
+            retiring,
+            bad_spec,
+            fe_bound,
+            be_bound,
+            _mm256_sub_epi64(_mm256_sub_epi64(retiring, avx2_delta(a.ecore_retiring, i)), heavy_ops),
+            heavy_ops,
+            br_mispredict,
+            _mm256_sub_epi64(_mm256_sub_epi64(bad_spec, avx2_delta(a.ecore_bad_spec, i)), br_mispredict),
+            fetch_lat,
+            _mm256_sub_epi64(_mm256_sub_epi64(fe_bound, avx2_delta(a.ecore_fe_bound, i)), fetch_lat),
+            _mm256_sub_epi64(_mm256_sub_epi64(be_bound, avx2_delta(a.ecore_be_bound, i)), mem_bound),
+            mem_bound,
+        };
+
+        const __m256i core_slots = _mm256_sub_epi64(slots, ecore_slots);
+        const __m256d no_l2 = _mm256_castsi256_pd(
+            _mm256_andnot_si256(_mm256_cmpeq_epi64(ecore_slots, zero), _mm256_cmpeq_epi64(core_slots, zero)));
+        const __m256d slots_f64 = avx2_to_double(slots);
+        const __m256d core_slots_f64 = avx2_to_double(core_slots);
+        for (std::size_t c = 0; c < 4; c++) {
+            _mm256_storeu_pd(a.fractions[c] + i, _mm256_div_pd(avx2_to_double(categories[c]), slots_f64));
+        }
+        for (std::size_t c = 4; c < tmam_batch_fraction_count; c++) {
+            const __m256d fraction = _mm256_div_pd(avx2_to_double(categories[c]), core_slots_f64);
+            _mm256_storeu_pd(a.fractions[c] + i, _mm256_andnot_pd(no_l2, fraction));
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(a.out_slots + i), slots);
+
+        __m256i top = _mm256_set1_epi64x(INT64_MIN);
+        __m256i top_category = _mm256_set1_epi64x(category_number(tmam_metric_category::l1_retiring));
+        for (std::size_t c = 1; c < 4; c++) {
+            avx2_argmax_step(categories[c], c, top, top_category);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(a.l1_bottleneck + i), top_category);
+
+        top = _mm256_set1_epi64x(INT64_MIN);
+        top_category = _mm256_set1_epi64x(category_number(tmam_metric_category::l2_light_ops));
+        for (std::size_t c = 6; c < tmam_batch_fraction_count; c++) {
+            avx2_argmax_step(categories[c], c, top, top_category);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(a.l2_bottleneck + i), top_category);
+    }
+}
+
+/// delta of 8 consecutive intervals of a field, starting at interval i
+__attribute__((target("avx512f")))
+inline __m512i avx512_delta(const uint64_t* field, std::size_t i) {
+    return _mm512_sub_epi64(_mm512_loadu_si512(field + i + 1), _mm512_loadu_si512(field + i));
+}
+
+/// AVX-512 kernel, 8 intervals per iteration, (end - begin) must be a multiple of 8
+__attribute__((target("avx512f,avx512dq")))
+void derive_avx512(const batch_arrays_t& a, std::size_t begin, std::size_t end) {
+    const __m512i zero = _mm512_setzero_si512();
+
+    for (std::size_t i = begin; i < end; i += 8) {
+        const __m512i slots = avx512_delta(a.slots, i);
+        const __m512i retiring = avx512_delta(a.retiring, i);
+        const __m512i bad_spec = avx512_delta(a.bad_spec, i);
+        const __m512i fe_bound = avx512_delta(a.fe_bound, i);
+        const __m512i be_bound = avx512_delta(a.be_bound, i);
+        const __m512i heavy_ops = avx512_delta(a.heavy_ops, i);
+        const __m512i br_mispredict = avx512_delta(a.br_mispredict, i);
+        const __m512i fetch_lat = avx512_delta(a.fetch_lat, i);
+        const __m512i mem_bound = avx512_delta(a.mem_bound, i);
+        const __m512i ecore_slots = avx512_delta(a.ecore_slots, i);
+
+        const __m512i categories[tmam_batch_fraction_count] = {
+            retiring,
+            bad_spec,
+            fe_bound,
+            be_bound,
+            _mm512_sub_epi64(_mm512_sub_epi64(retiring, avx512_delta(a.ecore_retiring, i)), heavy_ops),
+            heavy_ops,
+            br_mispredict,
+            _mm512_sub_epi64(_mm512_sub_epi64(bad_spec, avx512_delta(a.ecore_bad_spec, i)), br_mispredict),
+            fetch_lat,
+            _mm512_sub_epi64(_mm512_sub_epi64(fe_bound, avx512_delta(a.ecore_fe_bound, i)), fetch_lat),
+            _mm512_sub_epi64(_mm512_sub_epi64(be_bound, avx512_delta(a.ecore_be_bound, i)), mem_bound),
+            mem_bound,
+        };
+
+        const __m512i core_slots = _mm512_sub_epi64(slots, ecore_slots);
+        const __mmask8 has_l2 = _mm512_cmpneq_epu64_mask(core_slots, zero) | _mm512_cmpeq_epu64_mask(ecore_slots, zero);
+        const __m512d slots_f64 = _mm512_cvtepu64_pd(slots);
+        const __m512d core_slots_f64 = _mm512_cvtepu64_pd(core_slots);
+        for (std::size_t c = 0; c < 4; c++) {
+            _mm512_storeu_pd(a.fractions[c] + i, _mm512_div_pd(_mm512_cvtepu64_pd(categories[c]), slots_f64));
+        }
+        for (std::size_t c = 4; c < tmam_batch_fraction_count; c++) {
+            _mm512_storeu_pd(a.fractions[c] + i, _mm512_maskz_div_pd(has_l2, _mm512_cvtepu64_pd(categories[c]), core_slots_f64));
+        }
+
+        _mm512_storeu_si512(a.out_slots + i, slots);
+
+        __m512i top = zero;
+        __m512i top_category = _mm512_set1_epi64(category_number(tmam_metric_category::l1_retiring));
+        for (std::size_t c = 1; c < 4; c++) {
+            const __mmask8 greater = _mm512_cmpgt_epu64_mask(categories[c], top);
+            top = _mm512_mask_mov_epi64(top, greater, categories[c]);
+            top_category = _mm512_mask_mov_epi64(top_category, greater, _mm512_set1_epi64(c));
+        }
+        _mm512_storeu_si512(a.l1_bottleneck + i, top_category);
+
+        top = zero;
+        top_category = _mm512_set1_epi64(category_number(tmam_metric_category::l2_light_ops));
+        for (std::size_t c = 6; c < tmam_batch_fraction_count; c++) {
+            const __mmask8 greater = _mm512_cmpgt_epu64_mask(categories[c], top);
+            top = _mm512_mask_mov_epi64(top, greater, categories[c]);
+            top_category = _mm512_mask_mov_epi64(top_category, greater, _mm512_set1_epi64(c));
+        }
+        _mm512_storeu_si512(a.l2_bottleneck + i, top_category);
+    }
+}
+
+} // namespace
+
+void derive_batch(const tmam_sample_batch_t& samples, tmam_batch_values_t& values, tmam_batch_isa isa) {
+    const std::size_t intervals = 1 < samples.size() ? samples.size() - 1 : 0;
+    values.resize(intervals);
+
+    batch_arrays_t a = {
+        .slots = samples.slots.data(),
+        .retiring = samples.retiring.data(),
+        .bad_spec = samples.bad_spec.data(),
+        .fe_bound = samples.fe_bound.data(),
+        .be_bound = samples.be_bound.data(),
+        .heavy_ops = samples.heavy_ops.data(),
+        .br_mispredict = samples.br_mispredict.data(),
+        .fetch_lat = samples.fetch_lat.data(),
+        .mem_bound = samples.mem_bound.data(),
+        .ecore_slots = samples.ecore_slots.data(),
+        .ecore_retiring = samples.ecore_retiring.data(),
+        .ecore_bad_spec = samples.ecore_bad_spec.data(),
+        .ecore_fe_bound = samples.ecore_fe_bound.data(),
+        .ecore_be_bound = samples.ecore_be_bound.data(),
+        .fractions = {},
+        .out_slots = values.slots.data(),
+        .l1_bottleneck = values.l1_bottleneck.data(),
+        .l2_bottleneck = values.l2_bottleneck.data(),
+    };
+    for (std::size_t c = 0; c < tmam_batch_fraction_count; c++) {
+        a.fractions[c] = values.fractions[c].data();
+    }
+
+    // full vectors first, remainder scalar
+    std::size_t vectorized = 0;
+    if (tmam_batch_isa::avx512 == isa) {
+        vectorized = intervals - intervals % 8;
+        derive_avx512(a, 0, vectorized);
+    } else if (tmam_batch_isa::avx2 == isa) {
+        vectorized = intervals - intervals % 4;
+        derive_avx2(a, 0, vectorized);
+    }
+    derive_scalar(a, vectorized, intervals);
+}
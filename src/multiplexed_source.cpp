@@ -0,0 +1,94 @@
+#include <multiplexed_source.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+extern "C" {
+#include <sys/ioctl.h>
+#include <unistd.h>
+}
+
+multiplexed_source::multiplexed_source(const multiplexed_event_set_t& event_set, pid_t pid, int cpu, bool inherit)
+    : event_set(event_set),
+      counts_last(event_set.events.size(), 0),
+      counts_interval(event_set.events.size(), 0),
+      times_last(event_set.events.size(), {0, 0}) {
+    fds.reserve(event_set.events.size());
+
+    try {
+        int group_leader = -1;
+        for (const auto& event : event_set.events) {
+            // see perf_tmam_handle for the pragma
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+            struct perf_event_attr perf_attr = {
+                .type = event.type,
+                .size = sizeof(struct perf_event_attr),
+                .config = event.config,
+                .read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+                .disabled = 1,
+                .inherit = inherit,
+            };
+#pragma GCC diagnostic pop
+
+            // let the kernel multiplex every event (or group) on its own
+            // (members of a group report their own value, but the times of the group)
+            const int fd = checked_perf_open(&perf_attr, pid, cpu, event.grouped ? group_leader : -1, 0ul);
+            if (!event.grouped) {
+                group_leader = fd;
+            }
+            fds.push_back(fd);
+        }
+    } catch (const std::exception& e) {
+        for (const int fd : fds) {
+            close(fd);
+        }
+        throw std::runtime_error("could not open event " + event_set.events[fds.size()].name + ": " + e.what());
+    }
+
+    for (const int fd : fds) {
+        ioctl(fd, PERF_EVENT_IOC_ENABLE);
+    }
+}
+
+multiplexed_source::~multiplexed_source() {
+    for (const int fd : fds) {
+        close(fd);
+    }
+}
+
+perf_tmam_data_t multiplexed_source::read() {
+    uint64_t time_enabled = 0;
+    uint64_t time_running = 0;
+    for (std::size_t i = 0; i < fds.size(); i++) {
+        // layout: value, time_enabled, time_running
+        uint64_t values[3];
+        if (sizeof(values) != ::read(fds[i], values, sizeof(values))) {
+            throw std::runtime_error("perf read failed (" + event_set.events[i].name + ")");
+        }
+
+        // extrapolate to full time enabled, never decrease (extrapolation may overshoot)
+        uint64_t scaled = 0;
+        if (0 != values[2]) {
+            scaled = static_cast<uint64_t>(static_cast<unsigned __int128>(values[0]) * values[1] / values[2]);
+        }
+        scaled = std::max(scaled, counts_last[i]);
+
+        counts_interval[i] = scaled - counts_last[i];
+        counts_last[i] = scaled;
+
+        time_enabled += values[1] - times_last[i].first;
+        time_running += values[2] - times_last[i].second;
+        times_last[i] = {values[1], values[2]};
+    }
+
+    perf_tmam_data_t interval;
+    event_set.derive_interval(counts_interval.data(), interval);
+
+    // summed over all events: coverage is the mean fraction of time an event has been counted
+    interval.time_enabled = time_enabled;
+    interval.time_running = time_running;
+    accumulated = accumulated + interval;
+
+    return accumulated;
+}
@@ -1,4 +1,5 @@
 #include <perf_util.hpp>
+#include <multiplexed_source.hpp>
 
 #include <iostream>
 #include <iomanip>
@@ -6,6 +7,7 @@
 #include <string>
 #include <fstream>
 #include <vector>
+#include <algorithm>
 
 extern "C" {
 #include <linux/perf_event.h>
@@ -30,6 +32,26 @@ perf_tmam_data_t operator-(const perf_tmam_data_t& lhs, const perf_tmam_data_t&
     result.br_mispredict = lhs.br_mispredict - rhs.br_mispredict;
     result.fetch_lat = lhs.fetch_lat - rhs.fetch_lat;
     result.mem_bound = lhs.mem_bound - rhs.mem_bound;
+    result.ecore_slots = lhs.ecore_slots - rhs.ecore_slots;
+    result.ecore_retiring = lhs.ecore_retiring - rhs.ecore_retiring;
+    result.ecore_bad_spec = lhs.ecore_bad_spec - rhs.ecore_bad_spec;
+    result.ecore_fe_bound = lhs.ecore_fe_bound - rhs.ecore_fe_bound;
+    result.ecore_be_bound = lhs.ecore_be_bound - rhs.ecore_be_bound;
+    result.time_enabled = lhs.time_enabled - rhs.time_enabled;
+    result.time_ecore = lhs.time_ecore - rhs.time_ecore;
+    result.l3_mem_cycles = lhs.l3_mem_cycles - rhs.l3_mem_cycles;
+    result.l1_bound = lhs.l1_bound - rhs.l1_bound;
+    result.l2_bound = lhs.l2_bound - rhs.l2_bound;
+    result.l3_bound = lhs.l3_bound - rhs.l3_bound;
+    result.dram_bound = lhs.dram_bound - rhs.dram_bound;
+    result.store_bound = lhs.store_bound - rhs.store_bound;
+    result.l3_core_cycles = lhs.l3_core_cycles - rhs.l3_core_cycles;
+    result.divider = lhs.divider - rhs.divider;
+    result.ports_util = lhs.ports_util - rhs.ports_util;
+    result.time_running = lhs.time_running - rhs.time_running;
+    for (std::size_t i = 0; i < perf_tmam_companion_max; i++) {
+        result.companion[i] = lhs.companion[i] - rhs.companion[i];
+    }
 
     return result;
 }
@@ -46,6 +68,26 @@ perf_tmam_data_t operator+(const perf_tmam_data_t& lhs, const perf_tmam_data_t&
     result.br_mispredict = lhs.br_mispredict + rhs.br_mispredict;
     result.fetch_lat = lhs.fetch_lat + rhs.fetch_lat;
     result.mem_bound = lhs.mem_bound + rhs.mem_bound;
+    result.ecore_slots = lhs.ecore_slots + rhs.ecore_slots;
+    result.ecore_retiring = lhs.ecore_retiring + rhs.ecore_retiring;
+    result.ecore_bad_spec = lhs.ecore_bad_spec + rhs.ecore_bad_spec;
+    result.ecore_fe_bound = lhs.ecore_fe_bound + rhs.ecore_fe_bound;
+    result.ecore_be_bound = lhs.ecore_be_bound + rhs.ecore_be_bound;
+    result.time_enabled = lhs.time_enabled + rhs.time_enabled;
+    result.time_ecore = lhs.time_ecore + rhs.time_ecore;
+    result.l3_mem_cycles = lhs.l3_mem_cycles + rhs.l3_mem_cycles;
+    result.l1_bound = lhs.l1_bound + rhs.l1_bound;
+    result.l2_bound = lhs.l2_bound + rhs.l2_bound;
+    result.l3_bound = lhs.l3_bound + rhs.l3_bound;
+    result.dram_bound = lhs.dram_bound + rhs.dram_bound;
+    result.store_bound = lhs.store_bound + rhs.store_bound;
+    result.l3_core_cycles = lhs.l3_core_cycles + rhs.l3_core_cycles;
+    result.divider = lhs.divider + rhs.divider;
+    result.ports_util = lhs.ports_util + rhs.ports_util;
+    result.time_running = lhs.time_running + rhs.time_running;
+    for (std::size_t i = 0; i < perf_tmam_companion_max; i++) {
+        result.companion[i] = lhs.companion[i] + rhs.companion[i];
+    }
 
     return result;
 }
@@ -62,35 +104,38 @@ void perf_tmam_data_t::dump() const{
          << "%         " << std::setw(2) << 100.0 * fe_bound / slots
          << "%          " << std::setw(2) << 100.0 * be_bound / slots
          << "%" << endl;
+    // level 2: P-cores only
+    const uint64_t core_slots = slots - ecore_slots;
     cerr << "  LIGHT HEAVY   MISPR CLEAR   LAT BANDW   CORE MEM" << endl;
     cerr << std::setprecision(0) << std::fixed
-         << "   " << std::setw(2) << 100.0 * (retiring - heavy_ops) / slots
-         << "%    " << std::setw(2) << 100.0 * heavy_ops / slots
-         << "%     " << std::setw(2) << 100.0 * br_mispredict / slots
-         << "%   " << std::setw(2) << 100.0 * (bad_spec - br_mispredict) / slots
-         << "%   " << std::setw(2) << 100.0 * fetch_lat / slots
-         << "%  " << std::setw(2) << 100.0 * (fe_bound - fetch_lat) / slots
-         << "%     " << std::setw(2) << 100.0 * (be_bound - mem_bound) / slots
-         << "% " << std::setw(2) << 100.0 * mem_bound / slots
+         << "   " << std::setw(2) << 100.0 * (retiring - ecore_retiring - heavy_ops) / core_slots
+         << "%    " << std::setw(2) << 100.0 * heavy_ops / core_slots
+         << "%     " << std::setw(2) << 100.0 * br_mispredict / core_slots
+         << "%   " << std::setw(2) << 100.0 * (bad_spec - ecore_bad_spec - br_mispredict) / core_slots
+         << "%   " << std::setw(2) << 100.0 * fetch_lat / core_slots
+         << "%  " << std::setw(2) << 100.0 * (fe_bound - ecore_fe_bound - fetch_lat) / core_slots
+         << "%     " << std::setw(2) << 100.0 * (be_bound - ecore_be_bound - mem_bound) / core_slots
+         << "% " << std::setw(2) << 100.0 * mem_bound / core_slots
          << "%" << endl;
 }
 
 std::string perf_tmam_data_t::csv() const {
-    std::vector<uint64_t> output_unscaled = {
-        // l1
+    std::vector<uint64_t> output_l1_unscaled = {
         retiring,
         bad_spec,
         fe_bound,
         be_bound,
+    };
 
-        // l2
-        retiring - heavy_ops,
+    // l2: P-cores only
+    std::vector<uint64_t> output_l2_unscaled = {
+        retiring - ecore_retiring - heavy_ops,
         heavy_ops,
         br_mispredict,
-        bad_spec - br_mispredict,
+        bad_spec - ecore_bad_spec - br_mispredict,
         fetch_lat,
-        fe_bound - fetch_lat,
-        be_bound - mem_bound,
+        fe_bound - ecore_fe_bound - fetch_lat,
+        be_bound - ecore_be_bound - mem_bound,
         mem_bound,
     };
 
@@ -100,9 +145,12 @@ std::string perf_tmam_data_t::csv() const {
     csv = std::to_string(slots) + ";";
 
     // then all categories (scaled)
-    for (const auto unscaled : output_unscaled) {
+    for (const auto unscaled : output_l1_unscaled) {
         csv += std::to_string(static_cast<double>(unscaled) / static_cast<double>(slots)) + ";";
     }
+    for (const auto unscaled : output_l2_unscaled) {
+        csv += std::to_string(static_cast<double>(unscaled) / static_cast<double>(slots - ecore_slots)) + ";";
+    }
 
     return csv;
 }
@@ -126,19 +174,125 @@ int checked_perf_open(struct perf_event_attr* attr_ptr, pid_t pid, int cpu, int
     return perf_fd;
 }
 
-perf_tmam_data_t perf_tmam_data_t::read_from_perf(int perf_leader_fd) {
-    perf_tmam_data_t data;
-    if (sizeof(perf_tmam_data_t) != read(perf_leader_fd, &data, sizeof(perf_tmam_data_t))) {
+/**
+ * copy group read (read_format GROUP | TOTAL_TIME_ENABLED | TOTAL_TIME_RUNNING) into tmam data
+ * @param buffer layout: nr, time_enabled, time_running, values[nr]
+ * @param size number of bytes of nr & TMAM values
+ * @param companions number of companion counters following the TMAM values
+ * @param data receives nr, values & times
+ */
+static void copy_group_read(const char* buffer, std::size_t size, std::size_t companions, perf_tmam_data_t& data) {
+    std::memcpy(&data.nr, buffer, sizeof(uint64_t));
+    std::memcpy(&data.time_enabled, buffer + sizeof(uint64_t), sizeof(uint64_t));
+    std::memcpy(&data.time_running, buffer + 2 * sizeof(uint64_t), sizeof(uint64_t));
+    // values: same layout as perf_tmam_data_t, starting at slots
+    std::memcpy(&data.slots, buffer + 3 * sizeof(uint64_t), size - sizeof(uint64_t));
+    std::memcpy(data.companion, buffer + 2 * sizeof(uint64_t) + size, companions * sizeof(uint64_t));
+}
+
+perf_tmam_data_t perf_tmam_data_t::read_from_perf(int perf_leader_fd, std::size_t size, std::size_t companions) {
+    alignas(8) char buffer[perf_tmam_group_read_size + (2 + perf_tmam_companion_max) * sizeof(uint64_t)];
+    const std::size_t read_size = size + (2 + companions) * sizeof(uint64_t);
+    const ssize_t result = read(perf_leader_fd, buffer, read_size);
+    if (0 == result) {
+        // pinned group could not be scheduled, it stays in error state
+        throw std::runtime_error("perf read failed: pinned TMAM group lost its counters (other perf user?), unset PINNED");
+    }
+    if (static_cast<ssize_t>(read_size) != result) {
         throw std::runtime_error("perf read failed");
     }
+
+    perf_tmam_data_t data;
+    copy_group_read(buffer, size, companions, data);
     return data;
 }
 
 
-perf_tmam_handle::perf_tmam_handle(bool use_rdpmc, pid_t pid, int cpu) : use_rdpmc(use_rdpmc) {
-    // phase 1: open leader
+perf_tmam_handle::perf_tmam_handle(const perf_tmam_config_t& config, pid_t pid, int cpu)
+    : use_rdpmc(config.use_rdpmc), rdpmc_resync_ratio(config.rdpmc_resync_ratio) {
+    // rdpmc reads counters of the calling thread only
+    if (0 != pid && syscall(SYS_gettid) != pid) {
+        use_rdpmc = false;
+    }
 
+    if ((0 != config.sample_period || use_rdpmc) && !config.core_pmu_type) {
+        throw std::invalid_argument("sampling & rdpmc require the TMAM group");
+    }
+
+    if (config.inherit && (0 != config.sample_period || use_rdpmc)) {
+        throw std::invalid_argument("sampling & rdpmc are not supported with inherit");
+    }
 
+    if (nullptr != config.companion_events) {
+        if (use_rdpmc) {
+            throw std::invalid_argument("rdpmc is not supported with companion counters");
+        }
+        if (perf_tmam_companion_max < config.companion_events->size()) {
+            throw std::invalid_argument("at most " + std::to_string(perf_tmam_companion_max) + " companion counters supported");
+        }
+    }
+
+    if (0 != config.sample_period &&
+        (0 == config.sample_buffer_pages || 0 != (config.sample_buffer_pages & (config.sample_buffer_pages - 1)))) {
+        throw std::invalid_argument("sample buffer size must be a power of 2 pages");
+    }
+
+    if (config.core_pmu_type) {
+        open_core_group(*config.core_pmu_type, config, pid, cpu);
+    }
+
+    if (config.atom_pmu_type) {
+        open_atom_group(*config.atom_pmu_type, config, pid, cpu);
+    }
+
+    // level 3 events exist on P-cores only
+    if (nullptr != config.level3_events && config.core_pmu_type) {
+        level3_source = std::make_unique<multiplexed_source>(*config.level3_events, pid, cpu, config.inherit);
+    }
+
+    // map perf pages, which hold the rdpmc index & seqlock, and the ring buffer for samples
+    const auto map_pages = [](int fd, uint64_t pages, int prot) {
+        void* mapping = mmap(0, // no pre-defined code region
+                             pages * getpagesize(), // size of requested pages
+                             prot, // read-only, or read-write for ring buffer (required to update data_tail)
+                             MAP_SHARED, // share among all processes of the underlying file
+                             fd, // file to map (perf events)
+                             0); // no offset
+        if (MAP_FAILED == mapping) {
+            throw std::system_error(errno, std::generic_category(), "memory mapping of perf events failed");
+        }
+        return static_cast<perf_event_mmap_page*>(mapping);
+    };
+
+    if (0 != config.sample_period) {
+        // one metadata page + data pages
+        // (metadata page doubles as rdpmc page: the leader may only be mapped once)
+        sample_ring = map_pages(fd_leader, 1 + config.sample_buffer_pages, PROT_READ | PROT_WRITE);
+        sample_ring_data_size = sample_ring->data_size;
+    }
+
+    if (use_rdpmc) {
+        // one page for slots, one for any metric: all metrics share PERF_METRICS
+        rdpmc_page_slots = nullptr != sample_ring ? sample_ring : map_pages(fd_leader, 1, PROT_READ);
+        rdpmc_page_metrics = map_pages(fd_retiring, 1, PROT_READ);
+
+        if (!rdpmc_page_slots->cap_user_rdpmc || !rdpmc_page_metrics->cap_user_rdpmc) {
+            // not supported (e.g. disabled via /sys/bus/event_source/devices/cpu/rdpmc) -> fall back to read()
+            if (sample_ring != rdpmc_page_slots) {
+                munmap(rdpmc_page_slots, getpagesize());
+            }
+            munmap(rdpmc_page_metrics, getpagesize());
+            rdpmc_page_slots = nullptr;
+            rdpmc_page_metrics = nullptr;
+            use_rdpmc = false;
+        } else {
+            rdpmc_last_result = rdpmc_sync();
+        }
+    }
+}
+
+void perf_tmam_handle::open_core_group(uint32_t type, const perf_tmam_config_t& config, pid_t pid, int cpu) {
+    // phase 1: open leader
     // Note that "config" is using hardcoded values throughout.
     // This is because a) the documentation notes these numbers,
     // so they are assumed to be stable and b) they are hardcoded in the kernel as well.
@@ -150,14 +304,22 @@ perf_tmam_handle::perf_tmam_handle(bool use_rdpmc, pid_t pid, int cpu) : use_rdp
 #pragma GCC diagnostic push 
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
     struct perf_event_attr leader_perf_attr = {
-        .type = PERF_TYPE_RAW,
+        .type = type,
         .size = sizeof(struct perf_event_attr),
         .config = 0x400,
-        .read_format = PERF_FORMAT_GROUP,
+        .read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
         .disabled = 1,
+        .inherit = config.inherit,
+        .pinned = config.pinned,
     };
 #pragma GCC diagnostic pop 
 
+    if (0 != config.sample_period) {
+        // overflow sampling: every sample holds ip, timestamp & all counters of group
+        leader_perf_attr.sample_period = config.sample_period;
+        leader_perf_attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TIME | PERF_SAMPLE_READ;
+    }
+
     fd_leader = checked_perf_open(&leader_perf_attr,
                                   pid, // given thread, (0 == current by default)
                                   cpu, // given cpu (-1 == any by default)
@@ -165,16 +327,17 @@ perf_tmam_handle::perf_tmam_handle(bool use_rdpmc, pid_t pid, int cpu) : use_rdp
                                   0ul); // no flags
 
     // phase 2: open other events
-    auto get_tmam_perf_fd = [&](uint64_t config) {
+    auto get_tmam_perf_fd = [&](uint64_t event_config) {
         // ignore warnings, see above for explanation
 #pragma GCC diagnostic push 
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
         struct perf_event_attr perf_attr = {
-            .type = PERF_TYPE_RAW,
+            .type = type,
             .size = sizeof(struct perf_event_attr),
-            .config = config,
-            .read_format = PERF_FORMAT_GROUP,
+            .config = event_config,
+            .read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
             .disabled = 0,
+            .inherit = config.inherit,
         };
 #pragma GCC diagnostic pop 
 
@@ -185,99 +348,367 @@ perf_tmam_handle::perf_tmam_handle(bool use_rdpmc, pid_t pid, int cpu) : use_rdp
                                   0ul); // no flags
     };
 
-    if (!use_rdpmc) {
-        // perf with counters: open every counter individually
-        fd_retiring = get_tmam_perf_fd(0x8000);
-        fd_bad_spec = get_tmam_perf_fd(0x8100);
-        fd_fe_bound = get_tmam_perf_fd(0x8200);
-        fd_be_bound = get_tmam_perf_fd(0x8300);
+    // open every counter individually
+    // (required with rdpmc too: the kernel accumulates every metric event on context switches)
+    fd_retiring = get_tmam_perf_fd(0x8000);
+    fd_bad_spec = get_tmam_perf_fd(0x8100);
+    fd_fe_bound = get_tmam_perf_fd(0x8200);
+    fd_be_bound = get_tmam_perf_fd(0x8300);
 
+    if (config.level2) {
         fd_heavy_ops = get_tmam_perf_fd(0x8400);
         fd_br_mispredict = get_tmam_perf_fd(0x8500);
         fd_fetch_lat = get_tmam_perf_fd(0x8600);
         fd_mem_bound = get_tmam_perf_fd(0x8700);
     } else {
-        // rdpmc: only enable one counter, then use mmap
-        fd_retiring = get_tmam_perf_fd(0x8000);
-        rdpmc_mmap_ptr = mmap(0, // no pre-defined code region
-                              getpagesize(), // size of one page (duh)
-                              PROT_READ, // read-only
-                              MAP_SHARED, // share among all processes of the underlying file
-                              fd_retiring, // file to map (perf events)
-                              0); // no offset
-        if (MAP_FAILED == rdpmc_mmap_ptr) {
-            throw std::system_error(errno, std::generic_category(), "memory mapping for rdpmc failed");
-        }
+        // Ice Lake: PERF_METRICS only holds level 1
+        group_read_size = perf_tmam_group_read_size_l1;
+    }
 
-        // initial reset
-        ioctl(fd_leader, PERF_EVENT_IOC_RESET, 0);
+    // companions: general-purpose (or fixed) counters, read by the same group read
+    if (nullptr != config.companion_events) {
+        for (const auto& event : *config.companion_events) {
+#pragma GCC diagnostic push 
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+            struct perf_event_attr perf_attr = {
+                .type = event.type,
+                .size = sizeof(struct perf_event_attr),
+                .config = event.config,
+                .read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+                .disabled = 0,
+                .inherit = config.inherit,
+                .config1 = event.config1,
+            };
+#pragma GCC diagnostic pop 
+            fd_companions.push_back(checked_perf_open(&perf_attr, pid, cpu, fd_leader, 0ul));
+        }
     }
 
     // enable counting
     ioctl(fd_leader, PERF_EVENT_IOC_ENABLE);
 }
 
+void perf_tmam_handle::open_atom_group(uint32_t type, const perf_tmam_config_t& config, pid_t pid, int cpu) {
+    // E-cores (Gracemont) have no PERF_METRICS, but count level 1 categories in slots directly.
+    // The group is only scheduled while running on an E-core,
+    // so its time_running vs. time_enabled yields the E-core residency.
+    // (event codes: Intel Gracemont event list, e.g. https://perfmon-events.intel.com/)
+    const auto get_atom_perf_fd = [&](uint64_t event_config, int group) {
+#pragma GCC diagnostic push 
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+        struct perf_event_attr perf_attr = {
+            .type = type,
+            .size = sizeof(struct perf_event_attr),
+            .config = event_config,
+            .read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+            .disabled = -1 == group ? 1ull : 0ull,
+            .inherit = config.inherit,
+            .pinned = -1 == group && config.pinned,
+        };
+#pragma GCC diagnostic pop 
+        return checked_perf_open(&perf_attr, pid, cpu, group, 0ul);
+    };
+
+    fd_atom_cycles = get_atom_perf_fd(0x003c, -1); // CPU_CLK_UNHALTED.CORE
+    fd_atom_retiring = get_atom_perf_fd(0x00c2, fd_atom_cycles); // TOPDOWN_RETIRING.ALL
+    fd_atom_bad_spec = get_atom_perf_fd(0x0073, fd_atom_cycles); // TOPDOWN_BAD_SPECULATION.ALL
+    fd_atom_fe_bound = get_atom_perf_fd(0x0071, fd_atom_cycles); // TOPDOWN_FE_BOUND.ALL
+    fd_atom_be_bound = get_atom_perf_fd(0x0074, fd_atom_cycles); // TOPDOWN_BE_BOUND.ALL
+
+    ioctl(fd_atom_cycles, PERF_EVENT_IOC_ENABLE);
+}
+
 perf_tmam_handle::~perf_tmam_handle() {
-    close(fd_leader);
-    close(fd_retiring);
+    if (use_rdpmc) {
+        // unmap memory regions, mapped to support rdpmc
+        if (sample_ring != rdpmc_page_slots) {
+            munmap(rdpmc_page_slots, getpagesize());
+        }
+        munmap(rdpmc_page_metrics, getpagesize());
+    }
 
-    if (!use_rdpmc) {
-        // these FDs have only been opened when using vanilla perf (==NOT using rdpmc)
+    if (nullptr != sample_ring) {
+        munmap(sample_ring, getpagesize() + sample_ring_data_size);
+    }
+
+    if (-1 != fd_leader) {
+        close(fd_leader);
+        close(fd_retiring);
         close(fd_bad_spec);
         close(fd_fe_bound);
         close(fd_be_bound);
+    }
+
+    if (-1 != fd_heavy_ops) {
         close(fd_heavy_ops);
         close(fd_br_mispredict);
         close(fd_fetch_lat);
         close(fd_mem_bound);
-    } else {
-        // unmap mapped memory region, mapped to support rdpmc
-        munmap(rdpmc_mmap_ptr, getpagesize());
+    }
+
+    for (const int fd : fd_companions) {
+        close(fd);
+    }
+
+    if (-1 != fd_atom_cycles) {
+        close(fd_atom_cycles);
+        close(fd_atom_retiring);
+        close(fd_atom_bad_spec);
+        close(fd_atom_fe_bound);
+        close(fd_atom_be_bound);
     }
 }
 
+/**
+ * read hardware counter with rdpmc, as indicated by perf page
+ *
+ * @param index perf_event_mmap_page::index (i.e. +1 offset, 0 is invalid)
+ * @param width counter width in bits, 0 to return raw value
+ * @return counter value
+ */
+static inline uint64_t rdpmc_by_perf_index(uint32_t index, uint16_t width) {
+    uint64_t value = _rdpmc(index - 1);
+    if (0 != width) {
+        // sign-extend as described in perf_event_open(2)
+        int64_t extended = value << (64 - width);
+        value = extended >> (64 - width);
+    }
+    return value;
+}
+
+/**
+ * current time enabled of an event, as indicated by perf page (see perf_event_open(2))
+ *
+ * Must be called within the seqlock of the page, while the event is scheduled (index != 0).
+ * @param page perf page of event
+ * @return time enabled (ns), 0 if not provided by the kernel (cap_user_time unset)
+ */
+static inline uint64_t perf_page_time_enabled(const perf_event_mmap_page* page) {
+    if (!page->cap_user_time) {
+        return 0;
+    }
+
+    const uint64_t cycles = __rdtsc();
+    const uint64_t quot = cycles >> page->time_shift;
+    const uint64_t rem = cycles & ((1ull << page->time_shift) - 1);
+    return page->time_enabled + page->time_offset + quot * page->time_mult + ((rem * page->time_mult) >> page->time_shift);
+}
+
+/**
+ * convert 8-bit fraction of PERF_METRICS into slots
+ *
+ * @param metrics_raw PERF_METRICS register
+ * @param offset bit offset of requested metric
+ * @param slots number of slots the fraction refers to
+ * @return number of slots
+ */
+static inline uint64_t perf_metrics_to_slots(uint64_t metrics_raw, int offset, uint64_t slots) {
+    uint64_t extracted = (metrics_raw >> offset) & 0xffull;
+    // scale to number of slots
+    return extracted * slots / 0xffull;
+}
+
+perf_tmam_data_t perf_tmam_handle::rdpmc_sync() {
+    rdpmc_sync_data = perf_tmam_data_t::read_from_perf(fd_leader, group_read_size);
+
+    // record hardware state right after kernel readout:
+    // subsequent rdpmc readouts are relative to this state
+    uint32_t seq_slots, seq_metrics;
+    do {
+        seq_slots = rdpmc_page_slots->lock;
+        seq_metrics = rdpmc_page_metrics->lock;
+        __sync_synchronize();
+
+        const uint32_t idx_slots = rdpmc_page_slots->index;
+        const uint32_t idx_metrics = rdpmc_page_metrics->index;
+        if (0 == idx_slots || 0 == idx_metrics) {
+            // not currently scheduled -> next read() will sync again
+            seq_slots = ~rdpmc_page_slots->lock;
+            break;
+        }
+        rdpmc_sync_slots_raw = rdpmc_by_perf_index(idx_slots, rdpmc_page_slots->pmc_width);
+        rdpmc_sync_metrics_raw = rdpmc_by_perf_index(idx_metrics, 0);
+        rdpmc_sync_time = perf_page_time_enabled(rdpmc_page_slots);
+
+        __sync_synchronize();
+    } while (seq_slots != rdpmc_page_slots->lock || seq_metrics != rdpmc_page_metrics->lock);
+
+    rdpmc_sync_seq_slots = seq_slots;
+    rdpmc_sync_seq_metrics = seq_metrics;
+
+    return rdpmc_sync_data;
+}
+
 perf_tmam_data_t perf_tmam_handle::read() {
+    perf_tmam_data_t result = read_core();
+    add_atom(result);
+    if (level3_source) {
+        // only sets the level 3 members (its times are not the times of the TMAM groups, coverage refers to those)
+        perf_tmam_data_t level3 = level3_source->read();
+        level3.time_enabled = 0;
+        level3.time_running = 0;
+        result = result + level3;
+    }
+    return result;
+}
+
+uint64_t perf_tmam_handle::read_slots() {
+    // hybrid CPUs: E-core slots are only known by a readout of the atom group
+    if (!use_rdpmc || -1 == fd_leader || -1 != fd_atom_cycles) {
+        return read().slots;
+    }
+
+    // as read_core(): valid as long as the kernel has not read (reset) the counters since the last sync
+    uint64_t slots_raw;
+    uint32_t seq_slots;
+    do {
+        seq_slots = rdpmc_page_slots->lock;
+        __sync_synchronize();
+
+        const uint32_t idx_slots = rdpmc_page_slots->index;
+        if (seq_slots != rdpmc_sync_seq_slots || !rdpmc_page_slots->cap_user_rdpmc || 0 == idx_slots) {
+            return read().slots;
+        }
+        slots_raw = rdpmc_by_perf_index(idx_slots, rdpmc_page_slots->pmc_width);
+
+        __sync_synchronize();
+    } while (seq_slots != rdpmc_page_slots->lock);
+
+    return rdpmc_sync_data.slots + slots_raw - rdpmc_sync_slots_raw;
+}
+
+void perf_tmam_handle::add_atom(perf_tmam_data_t& data) const {
+    if (-1 == fd_atom_cycles) {
+        return;
+    }
+
+    // layout: nr, time_enabled, time_running, values[nr]
+    struct {
+        uint64_t nr;
+        uint64_t time_enabled;
+        uint64_t time_running;
+        uint64_t cycles;
+        uint64_t retiring;
+        uint64_t bad_spec;
+        uint64_t fe_bound;
+        uint64_t be_bound;
+    } atom;
+    if (sizeof(atom) != ::read(fd_atom_cycles, &atom, sizeof(atom))) {
+        throw std::runtime_error("perf read failed (E-core group)");
+    }
+
+    // Gracemont allocates 5 slots per cycle
+    const uint64_t atom_slots = 5 * atom.cycles;
+    data.slots += atom_slots;
+    data.ecore_slots = atom_slots;
+    data.retiring += atom.retiring;
+    data.bad_spec += atom.bad_spec;
+    data.fe_bound += atom.fe_bound;
+    data.be_bound += atom.be_bound;
+    data.ecore_retiring = atom.retiring;
+    data.ecore_bad_spec = atom.bad_spec;
+    data.ecore_fe_bound = atom.fe_bound;
+    data.ecore_be_bound = atom.be_bound;
+    // both groups are enabled for the same time, but only one of them runs at a time
+    data.time_enabled = std::max(data.time_enabled, atom.time_enabled);
+    data.time_running += atom.time_running;
+    data.time_ecore = atom.time_running;
+}
+
+perf_tmam_data_t perf_tmam_handle::read_core() {
+    if (-1 == fd_leader) {
+        return perf_tmam_data_t();
+    }
+
     if (!use_rdpmc) {
         // traditional perf with counters is trivial
-        return perf_tmam_data_t::read_from_perf(fd_leader);
+        return perf_tmam_data_t::read_from_perf(fd_leader, group_read_size, fd_companions.size());
     }
 
-    // see RDPMC instruction reference
-    constexpr uint32_t rdpmc_bitmask_fixed = 1ul << 30;
-    constexpr uint32_t rdpmc_bitmask_slots = 3ul;
-    constexpr uint32_t rdpmc_bitmask_tmam = 1ul << 29;
-
     // with rdpmc: emulate perf behavior
-    perf_tmam_data_t result;
-    result.nr = 9;
-    uint64_t new_slots = _rdpmc(rdpmc_bitmask_fixed | rdpmc_bitmask_slots);
-    uint64_t tmam_raw = _rdpmc(rdpmc_bitmask_tmam);
-
-    // split & scale according to tmam results
-    //result.slots = new_slots - rdpmc_last_result.slots;
-    result.slots = new_slots;
-    const auto split_and_scale = [=](int offset) {
-        uint64_t bitmask = 0xffull << offset;
-        uint64_t extracted = (tmam_raw & bitmask) >> offset;
-        // scale to number of slots
-        return extracted * result.slots / 0xffull;
+    //
+    // The kernel resets slots & PERF_METRICS whenever it reads the counters (read(), context switch, migration),
+    // which is tracked by the seqlock of the perf pages.
+    // As long as it has not done so since the last sync, the count for every metric is:
+    //     count at sync + (fraction now * slots now - fraction at sync * slots at sync)
+    // Otherwise (or when rdpmc is not possible right now) fall back to reading through the kernel.
+    uint64_t slots_raw, metrics_raw, time_now;
+    uint32_t seq_slots, seq_metrics;
+    do {
+        seq_slots = rdpmc_page_slots->lock;
+        seq_metrics = rdpmc_page_metrics->lock;
+        __sync_synchronize();
+
+        const uint32_t idx_slots = rdpmc_page_slots->index;
+        const uint32_t idx_metrics = rdpmc_page_metrics->index;
+        if (seq_slots != rdpmc_sync_seq_slots || seq_metrics != rdpmc_sync_seq_metrics ||
+            !rdpmc_page_slots->cap_user_rdpmc || 0 == idx_slots || 0 == idx_metrics) {
+            return rdpmc_last_result = rdpmc_sync();
+        }
+
+        slots_raw = rdpmc_by_perf_index(idx_slots, rdpmc_page_slots->pmc_width);
+        metrics_raw = rdpmc_by_perf_index(idx_metrics, 0);
+        time_now = perf_page_time_enabled(rdpmc_page_slots);
+
+        __sync_synchronize();
+    } while (seq_slots != rdpmc_page_slots->lock || seq_metrics != rdpmc_page_metrics->lock);
+
+    const uint64_t slots_since_sync = slots_raw - rdpmc_sync_slots_raw;
+
+    // precision of the 8-bit fractions degrades with slots since reset -> let kernel read (& reset) if necessary
+    const uint64_t interval_slots = rdpmc_sync_data.slots + slots_since_sync - rdpmc_last_result.slots;
+    if (0 != rdpmc_resync_ratio && slots_raw > rdpmc_resync_ratio * interval_slots) {
+        return rdpmc_last_result = rdpmc_sync();
+    }
+
+    perf_tmam_data_t result = rdpmc_sync_data;
+    result.slots += slots_since_sync;
+
+    // scheduled throughout since sync: running as long as enabled
+    // (without cap_user_time times only advance with kernel readouts)
+    if (0 != rdpmc_sync_time && time_now > rdpmc_sync_time) {
+        result.time_enabled = std::max(rdpmc_last_result.time_enabled, result.time_enabled + time_now - rdpmc_sync_time);
+        result.time_running = std::max(rdpmc_last_result.time_running, result.time_running + time_now - rdpmc_sync_time);
+    }
+
+    const auto accumulate = [&](uint64_t& field, uint64_t last, int offset) {
+        const uint64_t now = perf_metrics_to_slots(metrics_raw, offset, slots_raw);
+        const uint64_t at_sync = perf_metrics_to_slots(rdpmc_sync_metrics_raw, offset, rdpmc_sync_slots_raw);
+        // rounding of fractions may yield small negative deltas -> counters must never decrease
+        field = std::max(last, field + now - std::min(now, at_sync));
     };
 
-    result.retiring = split_and_scale(0);
-    result.bad_spec = split_and_scale(8);
-    result.fe_bound = split_and_scale(16);
-    result.be_bound = split_and_scale(24);
-    result.heavy_ops = split_and_scale(32);
-    result.br_mispredict = split_and_scale(40);
-    result.fetch_lat = split_and_scale(48);
-    result.mem_bound = split_and_scale(56);
-
-    // accumulate with next result
-    rdpmc_last_result = rdpmc_last_result + result;
-
-    // reset next period
-    ioctl(fd_leader, PERF_EVENT_IOC_RESET, 0);
-    return rdpmc_last_result;
+    accumulate(result.retiring, rdpmc_last_result.retiring, 0);
+    accumulate(result.bad_spec, rdpmc_last_result.bad_spec, 8);
+    accumulate(result.fe_bound, rdpmc_last_result.fe_bound, 16);
+    accumulate(result.be_bound, rdpmc_last_result.be_bound, 24);
+    if (-1 == fd_heavy_ops) {
+        return rdpmc_last_result = result;
+    }
+    accumulate(result.heavy_ops, rdpmc_last_result.heavy_ops, 32);
+    accumulate(result.br_mispredict, rdpmc_last_result.br_mispredict, 40);
+    accumulate(result.fetch_lat, rdpmc_last_result.fetch_lat, 48);
+    accumulate(result.mem_bound, rdpmc_last_result.mem_bound, 56);
+
+    return rdpmc_last_result = result;
+}
+
+bool perf_tmam_handle::parse_sample_record(const char* record, uint64_t size, perf_tmam_sample_t& sample) const {
+    // layout (see perf_event_open(2)): header, u64 ip, u64 time, u64 nr, u64 time_enabled, u64 time_running, u64 values[nr]
+    const uint64_t expected_size =
+        sizeof(perf_event_header) + (4 + fd_companions.size()) * sizeof(uint64_t) + group_read_size;
+    if (expected_size != size) {
+        return false;
+    }
+
+    const char* pos = record + sizeof(perf_event_header);
+    std::memcpy(&sample.ip, pos, sizeof(sample.ip));
+    pos += sizeof(sample.ip);
+    std::memcpy(&sample.time, pos, sizeof(sample.time));
+    pos += sizeof(sample.time);
+    copy_group_read(pos, group_read_size, fd_companions.size(), sample.data);
+
+    return group_read_size / sizeof(uint64_t) - 1 + fd_companions.size() == sample.data.nr;
 }
 
 void perf_tmam_handle::nullread() {
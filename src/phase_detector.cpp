@@ -0,0 +1,146 @@
+#include <phase_detector.hpp>
+#include <metric.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <stdexcept>
+
+phase_detector::phase_detector(double threshold, double drift, uint64_t min_intervals)
+    : threshold(threshold), drift(drift), max_step(0 == min_intervals ? threshold : threshold / min_intervals) {
+    if (!(0 < threshold) || !(0 <= drift)) {
+        throw std::invalid_argument("phase detection requires a positive PHASE_THRESHOLD and a non-negative PHASE_DRIFT");
+    }
+    if (max_step <= drift) {
+        throw std::invalid_argument("phase detection requires PHASE_THRESHOLD / PHASE_MIN_INTERVALS above PHASE_DRIFT");
+    }
+}
+
+std::array<double, phase_fraction_count> phase_detector::fractions(const perf_tmam_data_t& tmam) {
+    std::array<double, phase_fraction_count> fractions = {};
+    const uint64_t core_slots = tmam.slots - tmam.ecore_slots;
+    for (std::size_t category = 0; category < phase_fraction_count; category++) {
+        // category numbers: level 1 in [0, 4) of all slots, level 2 in [4, 12) of P-core slots (0 on E-cores only)
+        const uint64_t slots = 4 > category ? tmam.slots : core_slots;
+        if (0 != slots) {
+            fractions[category] = static_cast<double>(tmam_metric_t::extract_tmam_field(
+                static_cast<tmam_metric_category>(category), tmam)) / static_cast<double>(slots);
+        }
+    }
+    return fractions;
+}
+
+/**
+ * append interval to phase
+ * @param phase to extend
+ * @param delta counters of interval
+ * @param begin start of interval (gate_clock ticks)
+ * @param end end of interval (gate_clock ticks)
+ */
+static void extend(phase_t& phase, const perf_tmam_data_t& delta, uint64_t begin, uint64_t end) {
+    if (0 == phase.intervals) {
+        phase.begin = begin;
+        phase.total = delta;
+    } else {
+        phase.total = phase.total + delta;
+    }
+    phase.end = end;
+    phase.intervals++;
+}
+
+/**
+ * append phase to (earlier) phase
+ * @param phase to extend
+ * @param later phase following phase
+ */
+static void extend(phase_t& phase, const phase_t& later) {
+    if (0 == later.intervals) {
+        return;
+    }
+    extend(phase, later.total, later.begin, later.end);
+    phase.intervals += later.intervals - 1;
+}
+
+bool phase_detector::add(phase_state_t& state, const perf_tmam_data_t& delta, uint64_t begin, uint64_t end,
+                         phase_t& ended) const {
+    if (0 == delta.slots) {
+        // not running: no breakdown, extends the phase (or candidate) in time only
+        phase_t& phase = 0 < state.candidate.intervals ? state.candidate : state.current;
+        if (0 < phase.intervals) {
+            phase.end = end;
+        }
+        return false;
+    }
+
+    if (0 == state.current.intervals) {
+        extend(state.current, delta, begin, end);
+        state.mean = fractions(state.current.total);
+        return false;
+    }
+
+    const std::array<double, phase_fraction_count> latest = fractions(delta);
+    double distance = 0;
+    for (std::size_t category = 0; category < phase_fraction_count; category++) {
+        distance = std::max(distance, std::abs(latest[category] - state.mean[category]));
+    }
+    // bounded step: a single outlier (e.g. a very short interval) can not confirm a change on its own
+    state.cusum = std::max(0.0, state.cusum + std::min(distance, max_step) - drift);
+
+    if (0 == state.cusum) {
+        // no (more) deviation: candidate intervals were noise, they belong to the current phase
+        extend(state.current, state.candidate);
+        extend(state.current, delta, begin, end);
+        state.candidate = phase_t{};
+        state.mean = fractions(state.current.total);
+        return false;
+    }
+
+    extend(state.candidate, delta, begin, end);
+    if (state.cusum <= threshold) {
+        return false;
+    }
+
+    // change confirmed: new phase starts with the first deviating interval
+    ended = state.current;
+    state.current = state.candidate;
+    state.current.id = ended.id + 1;
+    state.candidate = phase_t{};
+    state.cusum = 0;
+    state.mean = fractions(state.current.total);
+    return true;
+}
+
+phase_t phase_detector::finish(const phase_state_t& state) {
+    phase_t phase = state.current;
+    extend(phase, state.candidate);
+    return phase;
+}
+
+void phase_summary::add(pid_t tid, const phase_t& phase) {
+    if (0 == phase.intervals) {
+        return;
+    }
+    phases.push_back({tid, phase});
+}
+
+void phase_summary::write(std::ostream& out, uint64_t time_origin, double ticks_per_us, bool level2) const {
+    std::vector<thread_phase_t> sorted = phases;
+    std::sort(sorted.begin(), sorted.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.phase.total.slots > rhs.phase.total.slots;
+    });
+
+    const double ticks_per_s = ticks_per_us * 1e6;
+    out << "tid;phase;begin_s;duration_s;intervals;" << perf_tmam_data_t::csv_header()
+        << "l1_bottleneck;l2_bottleneck" << std::endl;
+    for (const auto& [tid, phase] : sorted) {
+        out << tid << ";"
+            << phase.id << ";"
+            << std::setprecision(6) << std::fixed << static_cast<double>(phase.begin - time_origin) / ticks_per_s << ";"
+            << static_cast<double>(phase.end - phase.begin) / ticks_per_s << ";"
+            << phase.intervals << ";"
+            << phase.total.csv()
+            << tmam_metric_t(tmam_metric_t::get_l1_bottleneck(phase.total)).get_name() << ";"
+            << (level2 ? tmam_metric_t(tmam_metric_t::get_l2_bottleneck(phase.total)).get_name() : std::string())
+            << std::endl;
+    }
+}
@@ -0,0 +1,67 @@
+#include <pmu.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+#include <linux/perf_event.h>
+}
+
+/// sysfs directory listing all perf PMUs
+static const std::string pmu_sysfs_path = "/sys/bus/event_source/devices/";
+
+std::optional<uint32_t> read_pmu_type(const std::string& pmu_name) {
+    std::ifstream type_file(pmu_sysfs_path + pmu_name + "/type");
+    uint32_t type;
+    if (!(type_file >> type)) {
+        return std::nullopt;
+    }
+    return type;
+}
+
+std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || "\n" == range) {
+            continue;
+        }
+
+        const auto dash = range.find('-');
+        const int first = std::stoi(range.substr(0, dash));
+        const int last = std::string::npos == dash ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+bool tmam_pmus_t::is_atom_cpu(int cpu) const {
+    return std::find(atom_cpus.begin(), atom_cpus.end(), cpu) != atom_cpus.end();
+}
+
+const tmam_pmus_t& tmam_pmus_t::discover() {
+    static const tmam_pmus_t pmus = []() {
+        tmam_pmus_t result;
+        result.core_type = PERF_TYPE_RAW;
+
+        const auto core_type = read_pmu_type("cpu_core");
+        const auto atom_type = read_pmu_type("cpu_atom");
+        if (core_type && atom_type) {
+            result.core_type = *core_type;
+            result.atom_type = *atom_type;
+
+            std::ifstream cpus_file(pmu_sysfs_path + "cpu_atom/cpus");
+            std::string cpu_list;
+            std::getline(cpus_file, cpu_list);
+            result.atom_cpus = parse_cpu_list(cpu_list);
+        }
+
+        return result;
+    }();
+
+    return pmus;
+}
@@ -0,0 +1,3 @@
+#include <profile_plugin.hpp>
+
+SCOREP_METRIC_PLUGIN_CLASS(topdown_profile_plugin, "topdown_profile")
@@ -0,0 +1,241 @@
+#include <recording.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+static_assert(std::is_standard_layout_v<perf_tmam_data_t> && 0 == sizeof(perf_tmam_data_t) % sizeof(uint64_t),
+              "perf_tmam_data_t is recorded as array of uint64_t");
+
+/// magic number at start of every recorded stream
+static constexpr char recording_magic[8] = {'T', 'M', 'A', 'M', 'R', 'E', 'C', '1'};
+
+using tmam_fields_t = std::array<uint64_t, perf_tmam_field_count>;
+
+static tmam_fields_t to_fields(const perf_tmam_data_t& data) {
+    tmam_fields_t fields;
+    std::memcpy(fields.data(), static_cast<const void*>(&data), sizeof(data));
+    return fields;
+}
+
+static perf_tmam_data_t from_fields(const tmam_fields_t& fields) {
+    perf_tmam_data_t data;
+    std::memcpy(static_cast<void*>(&data), fields.data(), sizeof(data));
+    return data;
+}
+
+static void write_varint(std::ostream& out, uint64_t value) {
+    // LEB128: 7 bits per byte, MSB set if more bytes follow
+    char buf[10];
+    int len = 0;
+    do {
+        buf[len] = static_cast<char>(value & 0x7f);
+        value >>= 7;
+        if (0 != value) {
+            buf[len] |= static_cast<char>(0x80);
+        }
+        len++;
+    } while (0 != value);
+    out.write(buf, len);
+}
+
+/// read varint, false on end of stream
+static bool read_varint(std::istream& in, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        const int byte = in.get();
+        if (std::char_traits<char>::eof() == byte) {
+            return false;
+        }
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (0 == (byte & 0x80)) {
+            return true;
+        }
+    }
+    throw std::runtime_error("malformed recording: varint too long");
+}
+
+template <typename T>
+static void write_raw(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static void read_raw(std::istream& in, T& value) {
+    if (!in.read(reinterpret_cast<char*>(&value), sizeof(value))) {
+        throw std::runtime_error("malformed recording: truncated header");
+    }
+}
+
+tmam_recording_writer::tmam_recording_writer(const std::string& path, const tmam_recording_header_t& header)
+    : out(path, std::ios::binary | std::ios::trunc) {
+    if (!out) {
+        throw std::runtime_error("could not create recording " + path);
+    }
+
+    out.write(recording_magic, sizeof(recording_magic));
+    write_raw(out, header.field_count);
+    write_raw(out, static_cast<uint32_t>(header.backend.size()));
+    out.write(header.backend.data(), header.backend.size());
+    write_raw(out, header.supported_mask);
+}
+
+void tmam_recording_writer::append(uint64_t time_ns, const perf_tmam_data_t& data) {
+    write_varint(out, time_ns - last_time_ns);
+
+    const tmam_fields_t fields = to_fields(data);
+    const tmam_fields_t last_fields = to_fields(last_data);
+    for (std::size_t i = 0; i < perf_tmam_field_count; i++) {
+        write_varint(out, fields[i] - last_fields[i]);
+    }
+
+    last_time_ns = time_ns;
+    last_data = data;
+}
+
+tmam_recording_reader::tmam_recording_reader(const std::string& path) : in(path, std::ios::binary) {
+    if (!in) {
+        throw std::runtime_error("could not open recording " + path);
+    }
+
+    char magic[sizeof(recording_magic)];
+    if (!in.read(magic, sizeof(magic)) || 0 != std::memcmp(magic, recording_magic, sizeof(magic))) {
+        throw std::runtime_error("not a topdown recording: " + path);
+    }
+
+    read_raw(in, stream_header.field_count);
+    uint32_t name_length;
+    read_raw(in, name_length);
+    stream_header.backend.resize(name_length);
+    if (!in.read(stream_header.backend.data(), name_length)) {
+        throw std::runtime_error("malformed recording: truncated header");
+    }
+    read_raw(in, stream_header.supported_mask);
+}
+
+bool tmam_recording_reader::next(uint64_t& time_ns, perf_tmam_data_t& data) {
+    uint64_t delta;
+    if (!read_varint(in, delta)) {
+        return false;
+    }
+    time_ns = last_time_ns + delta;
+
+    // fields unknown to this version are skipped, missing fields stay zero
+    tmam_fields_t fields = to_fields(last_data);
+    for (uint32_t i = 0; i < stream_header.field_count; i++) {
+        if (!read_varint(in, delta)) {
+            throw std::runtime_error("malformed recording: truncated record");
+        }
+        if (i < perf_tmam_field_count) {
+            fields[i] += delta;
+        }
+    }
+
+    last_time_ns = time_ns;
+    last_data = from_fields(fields);
+    data = last_data;
+    return true;
+}
+
+recording_source::recording_source(std::unique_ptr<tmam_source> inner,
+                                   const std::string& path,
+                                   const tmam_recording_header_t& header)
+    : inner(std::move(inner)), writer(path, header) {
+    // nop
+}
+
+perf_tmam_data_t recording_source::read() {
+    const perf_tmam_data_t data = inner->read();
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    writer.append(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(), data);
+    return data;
+}
+
+replay_source::replay_source(const std::string& path)
+    : path(path), reader(std::make_unique<tmam_recording_reader>(path)) {
+    // nop
+}
+
+uint64_t recording_source::read_slots() {
+    return inner->read_slots();
+}
+
+uint64_t replay_source::read_slots() {
+    if (!pending) {
+        pending = read();
+    }
+    return pending->slots;
+}
+
+perf_tmam_data_t replay_source::read() {
+    if (pending) {
+        const perf_tmam_data_t data = *pending;
+        pending.reset();
+        return data;
+    }
+
+    uint64_t time_ns;
+    perf_tmam_data_t record;
+    if (!reader->next(time_ns, record)) {
+        if (2 > records_returned) {
+            throw std::runtime_error("recording holds less than two records: " + path);
+        }
+
+        // start over: continue from last returned value, first record only serves as base
+        reader = std::make_unique<tmam_recording_reader>(path);
+        reader->next(time_ns, base);
+        reader->next(time_ns, record);
+        offset = last;
+    }
+
+    last = offset + (record - base);
+    records_returned++;
+    return last;
+}
+
+synthetic_source::synthetic_source(uint64_t seed, std::size_t companions) : companions(companions) {
+    // splitmix64: spread small seeds over all bits (xorshift starts poorly from few set bits)
+    state = seed + 0x9e3779b97f4a7c15ull;
+    state = (state ^ (state >> 30)) * 0xbf58476d1ce4e5b9ull;
+    state = (state ^ (state >> 27)) * 0x94d049bb133111ebull;
+    state = state ^ (state >> 31);
+    if (0 == state) {
+        state = 1;
+    }
+
+    accumulated.nr = 9;
+}
+
+uint64_t synthetic_source::next_part(uint64_t n) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return static_cast<uint64_t>(static_cast<unsigned __int128>(n) * (state >> 32) >> 32);
+}
+
+perf_tmam_data_t synthetic_source::read() {
+    perf_tmam_data_t interval;
+    interval.slots = slots_per_read;
+
+    // level 1: split slots into 4 categories
+    interval.retiring = next_part(interval.slots);
+    interval.bad_spec = next_part(interval.slots - interval.retiring);
+    interval.fe_bound = next_part(interval.slots - interval.retiring - interval.bad_spec);
+    interval.be_bound = interval.slots - interval.retiring - interval.bad_spec - interval.fe_bound;
+
+    // level 2: split every level 1 category
+    interval.heavy_ops = next_part(interval.retiring);
+    interval.br_mispredict = next_part(interval.bad_spec);
+    interval.fetch_lat = next_part(interval.fe_bound);
+    interval.mem_bound = next_part(interval.be_bound);
+
+    // companions: some count of events per slot
+    for (std::size_t i = 0; i < companions; i++) {
+        interval.companion[i] = next_part(interval.slots);
+    }
+
+    accumulated = accumulated + interval;
+    return accumulated;
+}
@@ -0,0 +1,123 @@
+#include <run_summary.hpp>
+#include <metric.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <string>
+#include <tuple>
+
+/**
+ * write distribution of a per-thread quantity as one row
+ * @param out stream to write to
+ * @param name of quantity
+ * @param values one per thread
+ */
+static void write_spread(std::ostream& out, const std::string& name, const std::vector<double>& values) {
+    if (values.empty()) {
+        return;
+    }
+    double sum = 0;
+    for (const double value : values) {
+        sum += value;
+    }
+    const double mean = sum / static_cast<double>(values.size());
+    double squares = 0;
+    for (const double value : values) {
+        squares += (value - mean) * (value - mean);
+    }
+    const auto [min, max] = std::minmax_element(values.begin(), values.end());
+
+    // max/mean: 1 if balanced, number of threads if one thread did everything
+    out << name << ";"
+        << *min << ";"
+        << *max << ";"
+        << mean << ";"
+        << std::sqrt(squares / static_cast<double>(values.size())) << ";"
+        << (0 == mean ? 0.0 : *max / mean)
+        << std::endl;
+}
+
+void run_summary::add(const thread_summary_t& thread) {
+    if (0 == thread.total.slots) {
+        return;
+    }
+    threads.push_back(thread);
+}
+
+void run_summary::write(std::ostream& out, bool level2) const {
+    perf_tmam_data_t process_total;
+    double process_time_s = 0;
+    std::array<double, run_summary_category_count> process_bottleneck_time_s = {};
+    for (const auto& thread : threads) {
+        process_total = process_total + thread.total;
+        process_time_s += thread.time_s;
+        for (std::size_t category = 0; category < run_summary_category_count; category++) {
+            process_bottleneck_time_s[category] += thread.bottleneck_time_s[category];
+        }
+    }
+
+    const auto bottleneck_names = [level2](const perf_tmam_data_t& total) {
+        return tmam_metric_t(tmam_metric_t::get_l1_bottleneck(total)).get_name() + ";" +
+            (level2 ? tmam_metric_t(tmam_metric_t::get_l2_bottleneck(total)).get_name() : std::string());
+    };
+
+    // per-thread totals, process total: sum of slots, i.e. categories weighted by slots
+    out << "# totals" << std::endl;
+    out << "thread;tid;time_s;" << perf_tmam_data_t::csv_header() << "l1_bottleneck;l2_bottleneck" << std::endl;
+    for (std::size_t i = 0; i < threads.size(); i++) {
+        out << i << ";"
+            << threads[i].tid << ";"
+            << std::setprecision(6) << std::fixed << threads[i].time_s << ";"
+            << threads[i].total.csv()
+            << bottleneck_names(threads[i].total)
+            << std::endl;
+    }
+    out << "process;;"
+        << process_time_s << ";"
+        << process_total.csv()
+        << bottleneck_names(process_total)
+        << std::endl;
+
+    // histogram: time (summed over threads) the sampled intervals were dominated by a category
+    out << std::endl << "# bottleneck time" << std::endl;
+    out << "level;category;time_s;share" << std::endl;
+    // category numbers: level 1 in [0, 4), level 2 in [4, 12)
+    for (const auto& [level, first, last] : {std::tuple{1, 0, 4}, std::tuple{2, 4, 12}}) {
+        if (2 == level && !level2) {
+            break;
+        }
+        double level_time_s = 0;
+        for (int category = first; category < last; category++) {
+            level_time_s += process_bottleneck_time_s[category];
+        }
+        for (int category = first; category < last; category++) {
+            const double time_s = process_bottleneck_time_s[category];
+            out << level << ";"
+                << tmam_metric_t(static_cast<tmam_metric_category>(category)).get_name() << ";"
+                << time_s << ";"
+                << (0 == level_time_s ? 0.0 : time_s / level_time_s)
+                << std::endl;
+        }
+    }
+
+    // cross-thread imbalance: amount of work & how memory-bound it was
+    // (memory bound of P-core slots as l2 fractions, backend bound if only level 1 is counted)
+    std::vector<double> slots;
+    std::vector<double> bound_share;
+    for (const auto& thread : threads) {
+        const perf_tmam_data_t& total = thread.total;
+        slots.push_back(static_cast<double>(total.slots));
+        if (level2) {
+            const uint64_t pcore_slots = total.slots - total.ecore_slots;
+            bound_share.push_back(0 == pcore_slots ? 0.0 :
+                                  static_cast<double>(total.mem_bound) / static_cast<double>(pcore_slots));
+        } else {
+            bound_share.push_back(static_cast<double>(total.be_bound) / static_cast<double>(total.slots));
+        }
+    }
+    out << std::endl << "# imbalance" << std::endl;
+    out << "quantity;min;max;mean;stddev;max_over_mean" << std::endl;
+    write_spread(out, "slots", slots);
+    write_spread(out, level2 ? "mem_bound" : "be_bound", bound_share);
+}
@@ -0,0 +1,200 @@
+#include <sample_stream.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+}
+
+/// magic number at start of every stream
+static constexpr char sample_stream_magic[8] = {'T', 'M', 'A', 'M', 'S', 'T', 'R', '1'};
+
+/// names of counters as stored in header
+static constexpr const char* sample_stream_counter_names[sample_stream_counter_count] = {
+    "slots", "retiring", "bad_spec", "fe_bound", "be_bound", "heavy_ops", "br_mispredict", "fetch_lat", "mem_bound",
+    "ecore_slots", "ecore_retiring", "ecore_bad_spec", "ecore_fe_bound", "ecore_be_bound",
+};
+
+/// regions & header are page-aligned (regions of different threads never share a page)
+static uint64_t round_up_to_page(uint64_t size) {
+    const uint64_t page_size = sysconf(_SC_PAGESIZE);
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+/// current CLOCK_MONOTONIC time (ns)
+static uint64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+sample_stream::sample_stream(const std::string& path, const std::string& backend, bool per_cpu, const gate_clock& clock,
+                             uint64_t region_records, uint64_t max_bytes)
+    : path(path) {
+    if (0 == region_records) {
+        throw std::invalid_argument("stream regions must hold at least one record");
+    }
+
+    const uint64_t header_size = round_up_to_page(sizeof(sample_stream_header_t));
+    const uint64_t region_size =
+        round_up_to_page(sizeof(sample_stream_region_header_t) + region_records * sizeof(sample_stream_record_t));
+    max_regions = max_bytes > header_size ? (max_bytes - header_size) / region_size : 0;
+    if (0 == max_regions) {
+        throw std::invalid_argument("stream size limit is below one region");
+    }
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (0 > fd) {
+        throw std::system_error(errno, std::generic_category(), "could not create stream " + path);
+    }
+
+    // reserve address space for the maximum size, the file is extended by claim_region()
+    // (pages beyond the end of file are never touched)
+    mapping_size = header_size + max_regions * region_size;
+    mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (MAP_FAILED == mapping || 0 != ftruncate(fd, header_size)) {
+        const int error = errno;
+        if (MAP_FAILED != mapping) {
+            munmap(mapping, mapping_size);
+        }
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "could not map stream " + path);
+    }
+
+    header = new (mapping) sample_stream_header_t{};
+    std::memcpy(header->magic, sample_stream_magic, sizeof(header->magic));
+    header->header_size = header_size;
+    header->record_size = sizeof(sample_stream_record_t);
+    header->counter_count = sample_stream_counter_count;
+    header->per_cpu = per_cpu ? 1 : 0;
+    header->region_size = region_size;
+    header->region_records = region_records;
+    header->ticks_per_us = clock.get_ticks_per_us();
+    header->ref_ticks = clock.now();
+    header->ref_ns = monotonic_ns();
+    for (std::size_t i = 0; i < sample_stream_counter_count; i++) {
+        std::strncpy(header->counter_names[i], sample_stream_counter_names[i], sizeof(header->counter_names[i]) - 1);
+    }
+    std::strncpy(header->backend, backend.c_str(), sizeof(header->backend) - 1);
+}
+
+sample_stream::~sample_stream() {
+    munmap(mapping, mapping_size);
+    close(fd);
+}
+
+bool sample_stream::claim_region(cursor_t& cursor) {
+    // checked before locking: threads keep calling when full
+    if (full.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    std::lock_guard lock(claim_mutex);
+
+    const uint64_t index = header->regions_used.load(std::memory_order_relaxed);
+    if (max_regions == index || 0 != ftruncate(fd, header->header_size + (index + 1) * header->region_size)) {
+        full = true;
+        return false;
+    }
+
+    if (0 == cursor.thread) {
+        cursor.thread = ++threads;
+    }
+
+    char* region = static_cast<char*>(mapping) + header->header_size + index * header->region_size;
+    cursor.region = new (region) sample_stream_region_header_t{};
+    cursor.region->thread = cursor.thread;
+    cursor.region->tid = syscall(SYS_gettid);
+    cursor.region->sequence = cursor.sequence++;
+    cursor.records = reinterpret_cast<sample_stream_record_t*>(region + sizeof(sample_stream_region_header_t));
+    cursor.count = 0;
+
+    // publish region only after its header is complete
+    header->regions_used.store(index + 1, std::memory_order_release);
+    return true;
+}
+
+uint64_t sample_stream::written() const {
+    uint64_t total = 0;
+    const uint64_t regions = header->regions_used.load(std::memory_order_acquire);
+    for (uint64_t i = 0; i < regions; i++) {
+        const char* region = static_cast<const char*>(mapping) + header->header_size + i * header->region_size;
+        total += reinterpret_cast<const sample_stream_region_header_t*>(region)->records.load(std::memory_order_acquire);
+    }
+    return total;
+}
+
+sample_stream_reader::sample_stream_reader(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (0 > fd) {
+        throw std::system_error(errno, std::generic_category(), "could not open stream " + path);
+    }
+
+    struct stat file_stat;
+    if (0 != fstat(fd, &file_stat) || sizeof(sample_stream_header_t) > static_cast<uint64_t>(file_stat.st_size)) {
+        close(fd);
+        throw std::runtime_error("not a topdown sample stream: " + path);
+    }
+
+    mapping_size = file_stat.st_size;
+    mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == mapping) {
+        throw std::system_error(errno, std::generic_category(), "could not map stream " + path);
+    }
+
+    stream_header = static_cast<const sample_stream_header_t*>(mapping);
+    if (0 != std::memcmp(stream_header->magic, sample_stream_magic, sizeof(sample_stream_magic))) {
+        munmap(const_cast<void*>(mapping), mapping_size);
+        throw std::runtime_error("not a topdown sample stream: " + path);
+    }
+
+    // regions must lie behind the header within the file (if any), and hold their records
+    const uint64_t header_size = stream_header->header_size;
+    const uint64_t region_size = stream_header->region_size;
+    const uint64_t region_capacity = region_size > sizeof(sample_stream_region_header_t) ?
+        (region_size - sizeof(sample_stream_region_header_t)) / sizeof(sample_stream_record_t) : 0;
+    if (sizeof(sample_stream_record_t) != stream_header->record_size ||
+        sample_stream_counter_count != stream_header->counter_count ||
+        sizeof(sample_stream_header_t) > header_size || header_size > mapping_size ||
+        0 != header_size % alignof(sample_stream_region_header_t) ||
+        0 != region_size % alignof(sample_stream_region_header_t) ||
+        0 == stream_header->region_records || stream_header->region_records > region_capacity) {
+        munmap(const_cast<void*>(mapping), mapping_size);
+        throw std::runtime_error("unsupported sample stream layout: " + path);
+    }
+}
+
+sample_stream_reader::~sample_stream_reader() {
+    munmap(const_cast<void*>(mapping), mapping_size);
+}
+
+void sample_stream_reader::for_each_region(
+    const std::function<void(const sample_stream_region_header_t&, const sample_stream_record_t*, uint64_t)>& fn) const {
+    // only regions fully contained in the file (the writer extends it before publishing a region)
+    const uint64_t regions_in_file = (mapping_size - stream_header->header_size) / stream_header->region_size;
+    const uint64_t regions = std::min(stream_header->regions_used.load(std::memory_order_acquire), regions_in_file);
+
+    for (uint64_t i = 0; i < regions; i++) {
+        const char* region = static_cast<const char*>(mapping) + stream_header->header_size + i * stream_header->region_size;
+        const auto* region_header = reinterpret_cast<const sample_stream_region_header_t*>(region);
+        const uint64_t records = std::min(region_header->records.load(std::memory_order_acquire), stream_header->region_records);
+        fn(*region_header, reinterpret_cast<const sample_stream_record_t*>(region + sizeof(sample_stream_region_header_t)),
+           records);
+    }
+}
+
+uint64_t sample_stream_reader::to_monotonic_ns(uint64_t time) const {
+    const double passed_ns = (static_cast<double>(time) - static_cast<double>(stream_header->ref_ticks)) /
+                             stream_header->ticks_per_us * 1e3;
+    return static_cast<uint64_t>(static_cast<double>(stream_header->ref_ns) + passed_ns);
+}
@@ -0,0 +1,433 @@
+/**
+ * topdown-run: count TMAM categories of a command (incl. all its threads & children), as perf stat does
+ *
+ * Standalone, no Score-P instrumentation required.
+ * Prints the level 1/2 breakdown at exit, optionally a CSV timeline and the variation over repeated runs.
+ */
+
+#include <backend.hpp>
+#include <metric.hpp>
+#include <perf_util.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+}
+
+namespace {
+
+/// command line options
+struct options_t {
+    /// backend name, empty to detect
+    std::string backend;
+
+    /// interval of CSV timeline in ms, 0 to disable
+    uint64_t interval_ms = 0;
+
+    /// file to write CSV timeline to, stdout if empty
+    std::string output;
+
+    /// number of runs
+    uint64_t repeat = 1;
+
+    /// command & arguments, nullptr-terminated
+    char** command = nullptr;
+};
+
+/// counters & outcome of one run
+struct run_result_t {
+    /// accumulated counters at exit
+    perf_tmam_data_t counters;
+
+    /// wall time from exec to exit
+    double elapsed_s = 0;
+
+    /// exit code (128 + signal if killed)
+    int exit_code = 0;
+};
+
+/// time between two checks for the exit of the command while writing the timeline
+constexpr auto exit_poll_interval = std::chrono::milliseconds(5);
+
+void print_usage(std::ostream& out) {
+    out << "usage: topdown-run [options] [--] command [args...]\n"
+        << "\n"
+        << "Counts TMAM categories of command (incl. all threads & child processes) and prints the breakdown at exit.\n"
+        << "\n"
+        << "  -b, --backend NAME    backend (golden_cove, ice_lake, zen4, skylake, generic, synthetic), default: detected\n"
+        << "  -I, --interval MS     write slots, level 1/2 fractions & bottlenecks of every MS milliseconds as CSV\n"
+        << "  -o, --output FILE     write CSV to FILE instead of stdout\n"
+        << "  -r, --repeat N        run command N times, report mean & standard deviation\n"
+        << "  -h, --help            print this help\n";
+}
+
+/**
+ * parse command line, exits on error
+ * @return parsed options
+ */
+options_t parse_options(int argc, char** argv) {
+    static const option long_options[] = {
+        {"backend", required_argument, nullptr, 'b'},
+        {"interval", required_argument, nullptr, 'I'},
+        {"output", required_argument, nullptr, 'o'},
+        {"repeat", required_argument, nullptr, 'r'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    const auto parse_uint = [](const char* arg, const char* name) {
+        char* end;
+        const uint64_t value = std::strtoull(arg, &end, 10);
+        if ('\0' == *arg || '\0' != *end) {
+            std::cerr << "topdown-run: invalid " << name << ": " << arg << "\n";
+            std::exit(EXIT_FAILURE);
+        }
+        return value;
+    };
+
+    options_t options;
+    int opt;
+    // "+": stop at first non-option, i.e. the command
+    while (-1 != (opt = getopt_long(argc, argv, "+b:I:o:r:h", long_options, nullptr))) {
+        switch (opt) {
+        case 'b':
+            options.backend = optarg;
+            break;
+        case 'I':
+            options.interval_ms = parse_uint(optarg, "interval");
+            break;
+        case 'o':
+            options.output = optarg;
+            break;
+        case 'r':
+            options.repeat = std::max<uint64_t>(1, parse_uint(optarg, "repeat count"));
+            break;
+        case 'h':
+            print_usage(std::cout);
+            std::exit(EXIT_SUCCESS);
+        default:
+            print_usage(std::cerr);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind >= argc) {
+        print_usage(std::cerr);
+        std::exit(EXIT_FAILURE);
+    }
+    options.command = argv + optind;
+    return options;
+}
+
+/// name of a metric without "topdown-" prefix
+std::string short_name(const tmam_metric_t& metric) {
+    return metric.get_name().substr(std::string("topdown-").size());
+}
+
+/**
+ * write header of timeline: slots, then fractions & bottlenecks as printed by print_summary()
+ * @param out CSV stream
+ * @param backend backend runs are counted with, only its metrics are written
+ */
+void write_timeline_header(std::ostream& out, const tmam_backend& backend) {
+    out << "run;time_s;slots";
+    for (const auto& metric : tmam_metric_t::all) {
+        if (!metric.is_integral() && backend.supports(metric.category)) {
+            out << ";" << short_name(metric);
+        }
+    }
+    for (const auto category : {tmam_metric_category::l1_bottleneck, tmam_metric_category::l2_bottleneck}) {
+        if (backend.supports(category)) {
+            out << ";" << short_name(tmam_metric_t(category));
+        }
+    }
+    out << "\n";
+}
+
+/**
+ * write one timeline row, see write_timeline_header()
+ *
+ * Fractions & bottlenecks are left empty if the interval holds no slots (command not running).
+ * @param out CSV stream
+ * @param backend backend runs are counted with
+ * @param run index of run
+ * @param elapsed_s time since exec at end of interval
+ * @param interval counters of interval
+ */
+void write_timeline_row(std::ostream& out, const tmam_backend& backend, uint64_t run, double elapsed_s,
+                        const perf_tmam_data_t& interval) {
+    tmam_metric_values_t values;
+    values.derive(interval);
+
+    out << run << ";" << std::fixed << std::setprecision(6) << elapsed_s << ";" << interval.slots;
+    for (const auto& metric : tmam_metric_t::all) {
+        if (metric.is_integral() || !backend.supports(metric.category)) {
+            continue;
+        }
+        out << ";";
+        if (0 != interval.slots) {
+            out << values.by_index[metric.index].f64;
+        }
+    }
+    for (const auto category : {tmam_metric_category::l1_bottleneck, tmam_metric_category::l2_bottleneck}) {
+        if (!backend.supports(category)) {
+            continue;
+        }
+        out << ";";
+        if (0 != interval.slots) {
+            out << short_name(tmam_metric_t(static_cast<tmam_metric_category>(values[category].u64)));
+        }
+    }
+    out << "\n";
+}
+
+/**
+ * run command once, counted from exec until exit
+ *
+ * The command waits for the counters to be opened (inherit: all threads & children are counted).
+ * @param backend opens counters of the command
+ * @param options command line options
+ * @param run index of run (timeline only)
+ * @param timeline CSV stream, nullptr to not write a timeline
+ * @return counters & outcome
+ */
+run_result_t run_command(const tmam_backend& backend, const options_t& options, uint64_t run, std::ostream* timeline) {
+    // go: released by parent once the counters are opened
+    // exec_error: receives errno if exec fails, closed on successful exec
+    int go[2];
+    int exec_error[2];
+    if (0 != pipe2(go, O_CLOEXEC) || 0 != pipe2(exec_error, O_CLOEXEC)) {
+        throw std::system_error(errno, std::generic_category(), "pipe failed");
+    }
+
+    const pid_t child = fork();
+    if (0 > child) {
+        throw std::system_error(errno, std::generic_category(), "fork failed");
+    }
+    if (0 == child) {
+        close(go[1]);
+        close(exec_error[0]);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        char c;
+        while (0 > ::read(go[0], &c, sizeof(c)) && EINTR == errno) {
+            // retry
+        }
+        execvp(options.command[0], options.command);
+        const int error = errno;
+        [[maybe_unused]] const ssize_t written = ::write(exec_error[1], &error, sizeof(error));
+        _exit(127);
+    }
+    close(go[0]);
+    close(exec_error[1]);
+
+    const auto abort_child = [&]() {
+        close(go[1]);
+        close(exec_error[0]);
+        kill(child, SIGKILL);
+        waitpid(child, nullptr, 0);
+    };
+
+    std::unique_ptr<tmam_source> source;
+    try {
+        perf_tmam_config_t config;
+        config.inherit = true;
+        source = backend.open(config, child, -1);
+    } catch (...) {
+        abort_child();
+        throw;
+    }
+
+    const auto begin = std::chrono::steady_clock::now();
+    close(go[1]);
+
+    int error;
+    if (sizeof(error) == ::read(exec_error[0], &error, sizeof(error))) {
+        close(exec_error[0]);
+        waitpid(child, nullptr, 0);
+        throw std::runtime_error(std::string("could not execute ") + options.command[0] + ": " + std::strerror(error));
+    }
+    close(exec_error[0]);
+
+    const auto elapsed_s = [&]() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    };
+
+    int status = 0;
+    perf_tmam_data_t last;
+    if (nullptr == timeline) {
+        while (0 > waitpid(child, &status, 0) && EINTR == errno) {
+            // retry
+        }
+    } else {
+        const auto interval = std::chrono::milliseconds(options.interval_ms);
+        auto next = begin + interval;
+        for (;;) {
+            if (0 != waitpid(child, &status, WNOHANG)) {
+                break;
+            }
+            const auto now = std::chrono::steady_clock::now();
+            if (now < next) {
+                std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(next - now, exit_poll_interval));
+                continue;
+            }
+
+            const perf_tmam_data_t current = source->read();
+            write_timeline_row(*timeline, backend, run, elapsed_s(), current - last);
+            last = current;
+            next += interval;
+        }
+    }
+
+    run_result_t result;
+    result.elapsed_s = elapsed_s();
+    // counters of exited tasks stay readable (children are folded into the inherited events)
+    result.counters = source->read();
+    result.exit_code = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+
+    if (nullptr != timeline) {
+        // remainder of last interval
+        write_timeline_row(*timeline, backend, run, result.elapsed_s, result.counters - last);
+    }
+
+    return result;
+}
+
+/**
+ * print breakdown over all runs: fractions as mean (& standard deviation if repeated), bottlenecks of the sum of all runs
+ * @param out stream to print to
+ * @param backend backend runs have been counted with
+ * @param runs results of all runs
+ */
+void print_summary(std::ostream& out, const tmam_backend& backend, const std::vector<run_result_t>& runs) {
+    std::vector<tmam_metric_values_t> values(runs.size());
+    perf_tmam_data_t total;
+    for (std::size_t i = 0; i < runs.size(); i++) {
+        values[i].derive(runs[i].counters);
+        total = total + runs[i].counters;
+    }
+    tmam_metric_values_t total_values;
+    total_values.derive(total);
+
+    const bool repeated = 1 < runs.size();
+    // get: value of run i
+    const auto mean_stddev = [&](auto&& get) {
+        double sum = 0;
+        for (std::size_t i = 0; i < runs.size(); i++) {
+            sum += get(i);
+        }
+        const double mean = sum / runs.size();
+        double squares = 0;
+        for (std::size_t i = 0; i < runs.size(); i++) {
+            squares += (get(i) - mean) * (get(i) - mean);
+        }
+        return std::make_pair(mean, repeated ? std::sqrt(squares / (runs.size() - 1)) : 0.0);
+    };
+
+    out << "\n topdown counts (backend " << backend.name() << ")";
+    if (repeated) {
+        out << ", mean +- standard deviation of " << runs.size() << " runs";
+    }
+    out << ":\n\n";
+
+    const auto [slots_mean, slots_stddev] = mean_stddev([&](std::size_t i) {
+        return static_cast<double>(values[i][tmam_metric_category::slots].u64);
+    });
+    out << std::fixed << std::setprecision(0) << std::setw(20) << slots_mean << "    slots";
+    if (repeated) {
+        out << std::setprecision(2) << "    ( +- " << 100.0 * slots_stddev / slots_mean << "% )";
+    }
+    out << "\n";
+
+    for (const auto& metric : tmam_metric_t::all) {
+        if (metric.is_integral() || !backend.supports(metric.category)) {
+            continue;
+        }
+        const auto [mean, stddev] = mean_stddev([&](std::size_t i) { return values[i].by_index[metric.index].f64; });
+        out << std::setprecision(2) << std::setw(18) << 100.0 * mean << " %    " << short_name(metric);
+        if (repeated) {
+            out << std::string(std::max<std::size_t>(1, 28 - short_name(metric).size()), ' ')
+                << "( +- " << 100.0 * stddev << " %)";
+        }
+        out << "\n";
+    }
+
+    for (const auto category : {tmam_metric_category::l1_bottleneck, tmam_metric_category::l2_bottleneck}) {
+        if (!backend.supports(category)) {
+            continue;
+        }
+        const tmam_metric_t bottleneck(static_cast<tmam_metric_category>(total_values[category].u64));
+        out << std::setw(20) << short_name(bottleneck) << "    " << short_name(tmam_metric_t(category)) << "\n";
+    }
+
+    const auto [elapsed_mean, elapsed_stddev] = mean_stddev([&](std::size_t i) { return runs[i].elapsed_s; });
+    out << "\n" << std::setprecision(6) << std::setw(20) << elapsed_mean << "    seconds time elapsed";
+    if (repeated) {
+        out << std::setprecision(2) << "    ( +- " << 100.0 * elapsed_stddev / elapsed_mean << "% )";
+    }
+    out << "\n\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const options_t options = parse_options(argc, argv);
+
+    try {
+        const std::unique_ptr<tmam_backend> backend = make_tmam_backend(options.backend);
+
+        std::ofstream output_file;
+        std::ostream* timeline = nullptr;
+        if (0 != options.interval_ms) {
+            timeline = &std::cout;
+            if (!options.output.empty()) {
+                output_file.open(options.output);
+                if (!output_file) {
+                    throw std::runtime_error("could not create " + options.output);
+                }
+                timeline = &output_file;
+            }
+            write_timeline_header(*timeline, *backend);
+        }
+
+        // like perf stat: interrupts stop the command, not the report
+        signal(SIGINT, SIG_IGN);
+        signal(SIGQUIT, SIG_IGN);
+
+        std::vector<run_result_t> runs;
+        for (uint64_t run = 0; run < options.repeat; run++) {
+            runs.push_back(run_command(*backend, options, run, timeline));
+            if (0 != runs.back().exit_code && 1 < options.repeat) {
+                std::cerr << "topdown-run: run " << run << " exited with " << runs.back().exit_code << "\n";
+            }
+        }
+
+        if (nullptr != timeline) {
+            timeline->flush();
+        }
+        print_summary(std::cerr, *backend, runs);
+        return runs.back().exit_code;
+    } catch (const std::exception& e) {
+        std::cerr << "topdown-run: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,199 @@
+/**
+ * topdown-stream: convert a sample stream (see STREAM) to CSV
+ *
+ * Prints every readout (accumulated counters) or, with --fractions, the metrics of every interval between
+ * two readouts of a thread. May be run while the stream is still being written.
+ */
+
+#include <metric.hpp>
+#include <metric_batch.hpp>
+#include <perf_util.hpp>
+#include <sample_stream.hpp>
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <getopt.h>
+}
+
+namespace {
+
+/// command line options
+struct options_t {
+    /// stream to convert
+    std::string input;
+
+    /// file to write CSV to, stdout if empty
+    std::string output;
+
+    /// write derived metrics per interval instead of raw counters per readout
+    bool fractions = false;
+};
+
+/// all records of one thread, in order
+struct thread_records_t {
+    uint64_t tid = 0;
+    std::vector<const sample_stream_record_t*> records;
+};
+
+void print_usage(std::ostream& out) {
+    out << "usage: topdown-stream [options] STREAM\n"
+        << "\n"
+        << "Converts a sample stream written by the topdown plugin (STREAM) to CSV.\n"
+        << "\n"
+        << "  -f, --fractions       write metrics of every interval between two readouts instead of raw counters\n"
+        << "  -o, --output FILE     write CSV to FILE instead of stdout\n"
+        << "  -h, --help            print this help\n";
+}
+
+/**
+ * parse command line, exits on error
+ * @return parsed options
+ */
+options_t parse_options(int argc, char** argv) {
+    static const option long_options[] = {
+        {"fractions", no_argument, nullptr, 'f'},
+        {"output", required_argument, nullptr, 'o'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    options_t options;
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "fo:h", long_options, nullptr))) {
+        switch (opt) {
+        case 'f':
+            options.fractions = true;
+            break;
+        case 'o':
+            options.output = optarg;
+            break;
+        case 'h':
+            print_usage(std::cout);
+            std::exit(EXIT_SUCCESS);
+        default:
+            print_usage(std::cerr);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind + 1 != argc) {
+        print_usage(std::cerr);
+        std::exit(EXIT_FAILURE);
+    }
+    options.input = argv[optind];
+    return options;
+}
+
+/// write one row per record: raw accumulated counters
+void write_counters(std::ostream& out, const sample_stream_reader& stream, const std::map<uint64_t, thread_records_t>& threads) {
+    const sample_stream_header_t& header = stream.header();
+    out << "thread;tid;time_ns;cpu";
+    for (uint32_t i = 0; i < header.counter_count; i++) {
+        out << ";" << header.counter_names[i];
+    }
+    out << "\n";
+
+    for (const auto& [thread, records] : threads) {
+        for (const sample_stream_record_t* record : records.records) {
+            out << thread << ";" << records.tid << ";" << stream.to_monotonic_ns(record->time) << ";" << record->cpu;
+            for (uint32_t i = 0; i < header.counter_count; i++) {
+                out << ";" << record->counters[i];
+            }
+            out << "\n";
+        }
+    }
+}
+
+/// write one row per interval between two records of a thread: metrics as reported by the plugin
+void write_fractions(std::ostream& out, const sample_stream_reader& stream, const std::map<uint64_t, thread_records_t>& threads) {
+    std::vector<tmam_metric_t> metrics;
+    out << "thread;tid;time_ns;cpu";
+    for (const auto& metric : tmam_metric_t::all) {
+        if (tmam_batch_values_t::covers(metric.category)) {
+            metrics.push_back(metric);
+            out << ";" << metric.get_name();
+        }
+    }
+    out << "\n";
+
+    const bool per_cpu = 0 != stream.header().per_cpu;
+    tmam_sample_batch_t samples;
+    tmam_batch_values_t values;
+    for (const auto& [thread, records] : threads) {
+        samples.clear();
+        for (const sample_stream_record_t* record : records.records) {
+            samples.push_back(record->get_counters());
+        }
+        derive_batch(samples, values);
+
+        for (std::size_t i = 0; i < values.size(); i++) {
+            const sample_stream_record_t& begin = *records.records[i];
+            const sample_stream_record_t& end = *records.records[i + 1];
+            if (per_cpu && begin.cpu != end.cpu) {
+                // counters of different CPUs are not comparable
+                continue;
+            }
+
+            out << thread << ";" << records.tid << ";" << stream.to_monotonic_ns(end.time) << ";" << end.cpu;
+            for (const auto& metric : metrics) {
+                const tmam_metric_value_t value = values.get(metric.category, i);
+                if (metric.is_integral()) {
+                    out << ";" << value.u64;
+                } else {
+                    out << ";" << std::setprecision(6) << value.f64;
+                }
+            }
+            out << "\n";
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const options_t options = parse_options(argc, argv);
+
+    try {
+        const sample_stream_reader stream(options.input);
+
+        // regions of different threads are interleaved, regions of one thread are in order
+        std::map<uint64_t, thread_records_t> threads;
+        stream.for_each_region([&](const sample_stream_region_header_t& region, const sample_stream_record_t* records,
+                                   uint64_t count) {
+            thread_records_t& thread = threads[region.thread];
+            thread.tid = region.tid;
+            for (uint64_t i = 0; i < count; i++) {
+                thread.records.push_back(&records[i]);
+            }
+        });
+
+        std::ofstream output_file;
+        std::ostream* out = &std::cout;
+        if (!options.output.empty()) {
+            output_file.open(options.output);
+            if (!output_file) {
+                throw std::runtime_error("could not create " + options.output);
+            }
+            out = &output_file;
+        }
+
+        if (options.fractions) {
+            write_fractions(*out, stream, threads);
+        } else {
+            write_counters(*out, stream, threads);
+        }
+        out->flush();
+        return EXIT_SUCCESS;
+    } catch (const std::exception& e) {
+        std::cerr << "topdown-stream: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+}
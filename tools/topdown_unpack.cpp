@@ -0,0 +1,135 @@
+/**
+ * topdown-unpack: expand packed breakdowns (topdown-packed) into level 1 & 2 fractions
+ *
+ * Reads values from the command line or, if none are given, one per line from stdin
+ * (optionally followed by the slots of the same interval, e.g. "0x1a2b3c4d5e6f7080;1000000").
+ */
+
+#include <metric.hpp>
+#include <perf_util.hpp>
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <getopt.h>
+}
+
+namespace {
+
+/// slots assumed if not given: fractions only
+constexpr uint64_t default_slots = 0xff;
+
+/// level 1 & 2 metrics, in order of their categories
+std::vector<tmam_metric_t> breakdown_metrics() {
+    std::vector<tmam_metric_t> metrics;
+    for (const auto& metric : tmam_metric_t::all) {
+        if (metric.category <= tmam_metric_category::l2_memory_bound) {
+            metrics.push_back(metric);
+        }
+    }
+    return metrics;
+}
+
+void print_usage(std::ostream& out) {
+    out << "usage: topdown-unpack [options] [PACKED...]\n"
+        << "\n"
+        << "Expands values of topdown-packed into level 1 & 2 fractions (CSV).\n"
+        << "Without PACKED, reads one value per line from stdin, optionally followed by ';' and the slots of the interval.\n"
+        << "\n"
+        << "  -s, --slots SLOTS     slots of the intervals (default: fractions only), adds the slots of every category\n"
+        << "  -h, --help            print this help\n";
+}
+
+/**
+ * write one row: packed value, slots, fractions, slots per category (empty if slots unknown)
+ * @param out stream to write to
+ * @param metrics level 1 & 2 metrics
+ * @param packed packed breakdown
+ * @param slots slots of the interval, 0 if unknown
+ */
+void write_row(std::ostream& out, const std::vector<tmam_metric_t>& metrics, uint64_t packed, uint64_t slots) {
+    const perf_tmam_data_t tmam = tmam_unpack_breakdown(packed, 0 == slots ? default_slots : slots);
+    tmam_metric_values_t values;
+    values.derive(tmam);
+
+    out << "0x" << std::hex << std::setw(16) << std::setfill('0') << packed << std::dec << std::setfill(' ') << ";" << slots;
+    for (const auto& metric : metrics) {
+        out << ";" << std::setprecision(4) << values.by_index[metric.index].f64;
+    }
+    for (const auto& metric : metrics) {
+        // empty if slots unknown
+        out << ";";
+        if (0 != slots) {
+            out << metric.extract_tmam_field(tmam);
+        }
+    }
+    out << "\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    static const option long_options[] = {
+        {"slots", required_argument, nullptr, 's'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    uint64_t slots = 0;
+    try {
+        int opt;
+        while (-1 != (opt = getopt_long(argc, argv, "s:h", long_options, nullptr))) {
+            switch (opt) {
+            case 's':
+                slots = std::stoull(optarg, nullptr, 0);
+                break;
+            case 'h':
+                print_usage(std::cout);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(std::cerr);
+                return EXIT_FAILURE;
+            }
+        }
+
+        const std::vector<tmam_metric_t> metrics = breakdown_metrics();
+        std::cout << "packed;slots";
+        for (const auto& metric : metrics) {
+            std::cout << ";" << metric.get_name();
+        }
+        for (const auto& metric : metrics) {
+            std::cout << ";" << metric.get_name() << "-slots";
+        }
+        std::cout << "\n";
+
+        if (optind < argc) {
+            for (int i = optind; i < argc; i++) {
+                write_row(std::cout, metrics, std::stoull(argv[i], nullptr, 0), slots);
+            }
+            return EXIT_SUCCESS;
+        }
+
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            if (line.empty()) {
+                continue;
+            }
+            std::stringstream ss(line);
+            std::string packed, line_slots;
+            std::getline(ss, packed, ';');
+            std::getline(ss, line_slots, ';');
+            write_row(std::cout, metrics, std::stoull(packed, nullptr, 0),
+                      line_slots.empty() ? slots : std::stoull(line_slots, nullptr, 0));
+        }
+        return EXIT_SUCCESS;
+    } catch (const std::exception& e) {
+        std::cerr << "topdown-unpack: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+}